@@ -95,7 +95,7 @@ private:
 
 		if( _pNode->GetName() )
 		{	
-			printf( "'%s': ", _pNode->GetName() );
+			printf( "'%.*s': ", (int) _pNode->GetNameLength(), _pNode->GetName() );
 		}
 	}
 
@@ -122,7 +122,7 @@ public:
 	virtual bool OnNull( JsonNode * _pNode )		{ PrintName( _pNode );	printf( "null" );									Comma( _pNode );	Endline(); return true; }
 	virtual bool OnBool( JsonNode * _pNode )		{ PrintName( _pNode );	printf( _pNode->GetBool() ? "true" : "false" );		Comma( _pNode );	Endline(); return true; }
 	virtual bool OnNumber( JsonNode * _pNode )		{ PrintName( _pNode );	printf( "%f", _pNode->GetNumber() );				Comma( _pNode );	Endline(); return true; }
-	virtual bool OnString( JsonNode * _pNode )		{ PrintName( _pNode );	printf( "'%s'", _pNode->GetString() );				Comma( _pNode );	Endline(); return true; }
+	virtual bool OnString( JsonNode * _pNode )		{ PrintName( _pNode );	printf( "'%.*s'", (int) _pNode->GetStringLength(), _pNode->GetString() );	Comma( _pNode );	Endline(); return true; }
 	virtual bool OnArrayBegin( JsonNode * _pNode )	{ PrintName( _pNode );	printf( "[" );										++m_Level;			Endline(); return true; }
 	virtual bool OnArrayEnd( JsonNode * _pNode )	{ --m_Level; Indent();	printf( "]" );										Comma( _pNode );	Endline(); return true; }
 	virtual bool OnObjectBegin( JsonNode * _pNode ) { PrintName( _pNode );	printf( "{" );										++m_Level;			Endline(); return true; }
@@ -130,6 +130,64 @@ public:
 };
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+struct PlayerStats
+{
+	int hp;
+	double mp;
+};
+
+struct Player
+{
+	std::string name;
+	int level;
+	float speed;
+	bool alive;
+	PlayerStats stats;
+};
+
+MINJA_BIND_BEGIN( PlayerStats )
+	MINJA_BIND_FIELD( hp )
+	MINJA_BIND_FIELD( mp )
+MINJA_BIND_END()
+
+MINJA_BIND_BEGIN( Player )
+	MINJA_BIND_FIELD( name )
+	MINJA_BIND_FIELD( level )
+	MINJA_BIND_FIELD( speed )
+	MINJA_BIND_FIELD( alive )
+	MINJA_BIND_FIELD( stats )
+MINJA_BIND_END()
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+// hands its text out a few bytes at a time, so that tokens straddle reads
+class TrickleStream : public JsonInputStream
+{
+	const char * m_pText;
+	size_t m_Step;
+
+public:
+	TrickleStream( const char * _pText, size_t _Step ) : m_pText( _pText ), m_Step( _Step ) {}
+
+	virtual size_t Read( char * _pBuffer, size_t _Size )
+	{
+		size_t size = strlen( m_pText );
+		size = size < m_Step ? size : m_Step;
+		size = size < _Size ? size : _Size;
+		memcpy( _pBuffer, m_pText, size );
+		m_pText += size;
+		return size;
+	}
+};
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -221,6 +279,49 @@ void main()
 
 
 
+	const char * pErr;
+
+	ASSERT_TRUE( JsonTokenizer::ValidateUtf8( "plain ascii", "plain ascii" + 11, &pErr ) );
+
+	const char goodUtf8 [] = "caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80 0123456789abcd\xE2\x82\xAC tail";
+	ASSERT_TRUE( JsonTokenizer::ValidateUtf8( goodUtf8, goodUtf8 + sizeof(goodUtf8) - 1, &pErr ) );
+
+	// overlong, surrogate, above U+10FFFF, lonely continuation, truncated at the end of a 16 bytes block
+	const char overlong [] = "0123456789abcdef0123 \xC0\xAF tail";
+	ASSERT_FALSE( JsonTokenizer::ValidateUtf8( overlong, overlong + sizeof(overlong) - 1, &pErr ) );
+	ASSERT_EQ( overlong + 21, pErr );
+
+	const char surrogate [] = "\xED\xA0\x80";
+	ASSERT_FALSE( JsonTokenizer::ValidateUtf8( surrogate, surrogate + 3, &pErr ) );
+
+	const char tooLarge [] = "\xF4\x90\x80\x80";
+	ASSERT_FALSE( JsonTokenizer::ValidateUtf8( tooLarge, tooLarge + 4, &pErr ) );
+
+	const char lonely [] = "abc\x80";
+	ASSERT_FALSE( JsonTokenizer::ValidateUtf8( lonely, lonely + 4, &pErr ) );
+	ASSERT_EQ( lonely + 3, pErr );
+
+	const char truncated [] = "0123456789abcde\xE2";
+	ASSERT_FALSE( JsonTokenizer::ValidateUtf8( truncated, truncated + 16, &pErr ) );
+	ASSERT_EQ( truncated + 15, pErr );
+
+	// UTF-8 validation is opt-in
+	JsonTokenizer::TokenProcessor U;
+	U.SetOptions( JsonTokenizer::Option_ValidateUtf8 );
+
+	res = JsonTokenizer::ReadString( U, "\"caf\xC3\xA9\"", &pE );
+	ASSERT_EQ( JsonTokenizer::ParseOK, res );
+
+	const char badString [] = "\"bad \xC3\x28 string\"";
+	res = JsonTokenizer::ReadString( U, badString, &pE );
+	ASSERT_NE( JsonTokenizer::ParseOK, res );
+	ASSERT_EQ( badString + 5, pE );
+
+	res = JsonTokenizer::ReadString( C, badString, &pE );
+	ASSERT_EQ( JsonTokenizer::ParseOK, res );
+
+
+
 	const char text [] = "[ 123, 456, 789.0123, true, False, 'Marco', 'Polo',]";
 
 	res = JsonTokenizer::ReadArray( C, text, &pE );
@@ -312,6 +413,52 @@ void main()
 	res = JsonTokenizer::ReadObject( C, text3, &pE );
 	ASSERT_EQ( JsonTokenizer::ParseOK, res );
 
+	// validation only: same grammar, no callback, no allocation
+	ASSERT_TRUE( JsonValidate( text1, sizeof(text1) - 1 ).IsValid() );
+	ASSERT_TRUE( JsonValidate( text3, sizeof(text3) - 1 ).IsValid() );
+	ASSERT_TRUE( JsonValidate( text, sizeof(text) - 1 ).IsValid() );
+	ASSERT_TRUE( JsonValidate( "{ 'a': 1, 'b': 2, }", 19 ).IsValid() );
+
+	JsonValidateResult check = JsonValidate( text2, sizeof(text2) - 1 );
+	ASSERT_EQ( JsonValidateError_ExpectedObjectEnd, check.Error );
+	ASSERT_EQ( '\'', text2[check.Offset] );
+	ASSERT_EQ( JsonValidateError_ExpectedKey, JsonValidate( "{,}", 3 ).Error );
+	ASSERT_EQ( JsonValidateError_ExpectedValue, JsonValidate( "[ ,]", 4 ).Error );
+	ASSERT_EQ( JsonValidateError_TrailingCharacters, JsonValidate( "{} x", 4 ).Error );
+	ASSERT_EQ( JsonValidateError_UnterminatedString, JsonValidate( "{ 'abc': 'de", 12 ).Error );
+	ASSERT_EQ( JsonValidateError_BadNumber, JsonValidate( "[ 1.e5 ]", 8 ).Error );
+	ASSERT_EQ( 4u, JsonValidate( "[ 1.e5 ]", 8 ).Offset );
+	ASSERT_EQ( JsonValidateError_BadEscape, JsonValidate( "[ 'a\\q' ]", 9 ).Error );
+
+	// the length bounds the scan, whatever follows in memory
+	ASSERT_EQ( JsonValidateError_ExpectedArrayEnd, JsonValidate( "[ true, false ]", 13 ).Error );
+	ASSERT_EQ( JsonValidateError_InvalidUtf8, JsonValidate( "[ 'bad \xC3\x28' ]", 11, JsonTokenizer::Option_ValidateUtf8 ).Error );
+	ASSERT_EQ( JsonValidateError_BadRoot, JsonValidate( badString, sizeof(badString) - 1 ).Error );
+
+#if MINJA_CONSTEXPR
+	// literals are parsed by the compiler into a read-only node table: a syntax error fails the build
+	static constexpr char defaultsText [] = "{ 'retries': 3, 'backoff': 1.5e-1, 'hosts': [ 'a', 'bb', ], 'tls': { 'enabled': TRUE, 'ca': null } }";
+	static constexpr auto defaults = MINJA_JSON_LITERAL( defaultsText );
+	static_assert( defaults.GetNbNodes() == 9, "one node per value, the root included" );
+	static_assert( defaults["retries"].GetNumber() == 3.0f, "numbers are converted at compile time" );
+	static_assert( defaults["tls"]["enabled"].GetBool(), "keywords are read in any case" );
+	static_assert( !defaults["tls"]["missing"][(size_t) 2].IsValid(), "missing children are invalid nodes" );
+
+	JsonDocument * pDefaults = JsonDocument::Parse( defaultsText );
+	ASSERT_EQ( (*pDefaults)["backoff"].GetNumber(), defaults["backoff"].GetNumber() );
+	ASSERT_EQ( 2, defaults["hosts"].GetNbChildren() );
+	ASSERT_EQ( 2, defaults["hosts"][1].GetStringLength() );
+	ASSERT_FALSE( memcmp( "bb", defaults["hosts"][1].GetString(), 2 ) );
+	ASSERT_FALSE( memcmp( "ca", defaults["tls"].GetChild( 1 )->GetName(), 2 ) );
+	ASSERT_EQ( JsonNodeType_Null, defaults["tls"]["ca"].GetType() );
+
+	size_t nbLiteralChildren = 0;
+	for( JsonLiteralNode::const_iterator iter = defaults.GetRoot().begin(); iter != defaults.GetRoot().end(); ++iter, ++nbLiteralChildren )
+		ASSERT_TRUE( pDefaults->GetChild( iter->GetName(), iter->GetNameLength() ) != NULL );
+	ASSERT_EQ( pDefaults->GetNbChildren(), nbLiteralChildren );
+	delete pDefaults;
+#endif
+
 	JsonDocument * pDoc = JsonDocument::Parse( text3 );
 
 	if( pDoc )
@@ -330,6 +477,1179 @@ void main()
 		}
 	}
 	
+	// borrowed buffer: strings and keys are views into text3, not copies
+	JsonDocument * pDoc3 = JsonDocument::Parse( text3, JsonParseMode_BorrowBuffer );
+	ASSERT_TRUE( pDoc3 != NULL );
+
+	const JsonNode & title = (*pDoc3)["glossary"]["title"];
+	ASSERT_EQ( JsonNodeType_String, title.GetType() );
+	ASSERT_EQ( 16, title.GetStringLength() );
+	ASSERT_TRUE( !memcmp( title.GetString(), "example glossary", 16 ) );
+	ASSERT_TRUE( title.GetString() > text3 && title.GetString() < text3 + sizeof(text3) );
+	ASSERT_TRUE( title.GetName() > text3 && title.GetName() < text3 + sizeof(text3) );
+	ASSERT_EQ( 5, title.GetNameLength() );
+	ASSERT_TRUE( (*pDoc3)["glossary"].GetChild( "GlossDivXXX", 8 ) != NULL );
+	ASSERT_FALSE( (*pDoc3)["glossary"].GetChild( "Gloss" ) != NULL );
+
+	// short strings live inside their node, null terminated, even in borrowed mode
+	const JsonNode & glossId = (*pDoc3)["glossary"]["GlossDiv"]["GlossList"]["GlossEntry"]["ID"];
+	ASSERT_TRUE( glossId.GetString() < text3 || glossId.GetString() >= text3 + sizeof(text3) );
+	ASSERT_FALSE( strcmp( "SGML", glossId.GetString() ) );
+	ASSERT_TRUE( sizeof(JsonNode) <= 32 );
+
+	// missing children chain into an invalid node instead of crashing
+	const JsonNode & missing = (*pDoc3)["glossary"]["nope"][3]["title"];
+	ASSERT_FALSE( missing.IsValid() );
+	ASSERT_FALSE( missing.GetBool() );
+	ASSERT_EQ( 0.0f, missing.GetNumber() );
+	ASSERT_EQ( strlen( missing.GetString() ), missing.GetStringLength() );
+	ASSERT_TRUE( missing.IsLastChild() );
+	ASSERT_TRUE( title.IsValid() );
+
+	pDoc3->Visit( JsonPrinter(true, 2) );
+	delete pDoc3;
+
+	// a reused document recycles the very same storage
+	JsonDocument * pDoc4 = JsonDocument::Create();
+	bool bParsed = JsonDocument::ParseInto( *pDoc4, text3 );
+	ASSERT_TRUE( bParsed );
+	const JsonNode * pGlossary = &(*pDoc4)["glossary"];
+	const char * pGlossTitle = (*pDoc4)["glossary"]["title"].GetString();
+
+	pDoc4->Reset();
+	ASSERT_EQ( 0, pDoc4->GetNbChildren() );
+
+	bParsed = JsonDocument::ParseInto( *pDoc4, text3 );
+	ASSERT_TRUE( bParsed );
+	ASSERT_EQ( pGlossary, &(*pDoc4)["glossary"] );
+	ASSERT_EQ( pGlossTitle, (*pDoc4)["glossary"]["title"].GetString() );
+	ASSERT_FALSE( strcmp( "example glossary", pGlossTitle ) );
+
+	bParsed = JsonDocument::ParseInto( *pDoc4, text4 );
+	ASSERT_TRUE( bParsed );
+	ASSERT_EQ( 2, pDoc4->GetNbChildren() );
+	ASSERT_EQ( 33.0f, (*pDoc4)["age"].GetNumber() );
+
+	// a failed parse leaves an empty document
+	bParsed = JsonDocument::ParseInto( *pDoc4, text2 );
+	ASSERT_FALSE( bParsed );
+	ASSERT_EQ( 0, pDoc4->GetNbChildren() );
+	delete pDoc4;
+
+	// messages of a fixed shape have their keys predicted from the previous parse
+	const char shapeA [] = "{ 'id': 1, 'user': { 'name': 'ann', 'tags': [ 'a', 'b' ] }, 'ok': true }";
+	const char shapeB [] = "{ 'id': 2, 'user': { 'name': 'bob', 'tags': [ 'c', 'd' ] }, 'ok': false }";
+	const char shapeC [] = "{ 'id': 3, 'user': { 'nick': 'cy', 'tags': [ 'e', 'f', 'g' ] } }";
+	JsonDocument * pShaped = JsonDocument::Create();
+	pShaped->SetOptions( JsonTokenizer::Option_LearnShape );
+	bParsed = JsonDocument::ParseInto( *pShaped, shapeA );
+	ASSERT_TRUE( bParsed );
+	ASSERT_FALSE( pShaped->HasMatchedShape() );
+	bParsed = JsonDocument::ParseInto( *pShaped, shapeB );
+	ASSERT_TRUE( bParsed );
+	ASSERT_TRUE( pShaped->HasMatchedShape() );
+	const char * pUserName = pShaped->GetChild( "user" )->GetName();
+	bParsed = JsonDocument::ParseInto( *pShaped, shapeA );
+	ASSERT_TRUE( bParsed );
+	ASSERT_TRUE( pShaped->HasMatchedShape() );
+	ASSERT_EQ( pUserName, pShaped->GetChild( "user" )->GetName() );
+	ASSERT_FALSE( strcmp( "ann", (*pShaped)["user"]["name"].GetString() ) );
+	ASSERT_TRUE( (*pShaped)["ok"].GetBool() );
+
+	bParsed = JsonDocument::ParseInto( *pShaped, shapeC );
+	ASSERT_TRUE( bParsed );
+	ASSERT_FALSE( pShaped->HasMatchedShape() );
+	ASSERT_EQ( 2, pShaped->GetNbChildren() );
+	ASSERT_FALSE( strcmp( "cy", (*pShaped)["user"]["nick"].GetString() ) );
+	ASSERT_EQ( 3, (*pShaped)["user"]["tags"].GetNbChildren() );
+	bParsed = JsonDocument::ParseInto( *pShaped, shapeC );
+	ASSERT_TRUE( bParsed );
+	ASSERT_TRUE( pShaped->HasMatchedShape() );
+	bParsed = JsonDocument::ParseInto( *pShaped, shapeB );
+	ASSERT_TRUE( bParsed );
+	ASSERT_FALSE( pShaped->HasMatchedShape() );
+	ASSERT_FALSE( strcmp( "bob", (*pShaped)["user"]["name"].GetString() ) );
+	ASSERT_EQ( 2, (*pShaped)["user"]["tags"].GetNbChildren() );
+	ASSERT_FALSE( (*pShaped)["ok"].GetBool() );
+	delete pShaped;
+
+	// borrowed names are recorded before their buffer goes away
+	pShaped = JsonDocument::Create( JsonParseMode_BorrowBuffer );
+	pShaped->SetOptions( JsonTokenizer::Option_LearnShape );
+	char * pShapeBuffer = new char [sizeof(shapeC)];
+	memcpy( pShapeBuffer, shapeC, sizeof(shapeC) );
+	bool bShapeParsed = JsonDocument::ParseInto( *pShaped, pShapeBuffer );
+	ASSERT_TRUE( bShapeParsed );
+	delete [] pShapeBuffer;
+	bShapeParsed = JsonDocument::ParseInto( *pShaped, shapeC );
+	ASSERT_TRUE( bShapeParsed );
+	ASSERT_TRUE( pShaped->HasMatchedShape() );
+
+	// trees larger than a shape can hold only have their beginning predicted
+	std::string hugeShape( "[ " );
+	for( int i=0; i<70000; ++i )
+		hugeShape += "0, ";
+	std::string hugeShapeB = hugeShape + "{ 'b': 1 } ]";
+	hugeShape += "{ 'a': 1 } ]";
+	bShapeParsed = JsonDocument::ParseInto( *pShaped, hugeShape.c_str() );
+	ASSERT_TRUE( bShapeParsed );
+	bShapeParsed = JsonDocument::ParseInto( *pShaped, hugeShapeB.c_str() );
+	ASSERT_TRUE( bShapeParsed );
+	ASSERT_FALSE( pShaped->HasMatchedShape() );
+	ASSERT_EQ( 1.0f, (*pShaped)[70000]["b"].GetNumber() );
+	bShapeParsed = JsonDocument::ParseInto( *pShaped, hugeShapeB.c_str() );
+	ASSERT_TRUE( bShapeParsed );
+	ASSERT_FALSE( pShaped->HasMatchedShape() );
+	delete pShaped;
+
+	// arrays of numbers only are stored as contiguous floats, and unpacked on demand
+	const char packed [] = "{ 'xyz': [ 1, 2.5, -3, 4e1, 5, 6, 7, 8, 9, 10 ], 'mixed': [ 1, 2, 'three' ], 'empty': [], 'rows': [ [ 1, 2 ], [ 3 ] ] }";
+	JsonDocument * pPacked = JsonDocument::Parse( packed, JsonParseMode_Copy, JsonTokenizer::Option_PackNumbers );
+	const JsonNode & xyz = (*pPacked)["xyz"];
+	ASSERT_TRUE( xyz.IsPacked() );
+	ASSERT_EQ( 10, xyz.GetNbChildren() );
+	ASSERT_EQ( 2.5f, xyz.GetNumbers()[1] );
+	ASSERT_EQ( 40.0f, xyz.GetNumbers()[3] );
+	ASSERT_EQ( 10.0f, xyz.GetNumbers()[9] );
+	ASSERT_FALSE( (*pPacked)["mixed"].IsPacked() );
+	ASSERT_EQ( 3, (*pPacked)["mixed"].GetNbChildren() );
+	ASSERT_EQ( 2.0f, (*pPacked)["mixed"][1].GetNumber() );
+	ASSERT_FALSE( strcmp( "three", (*pPacked)["mixed"][2].GetString() ) );
+	ASSERT_TRUE( (*pPacked)["empty"].GetNumbers() == NULL );
+	ASSERT_FALSE( (*pPacked)["rows"].IsPacked() );
+	ASSERT_TRUE( (*pPacked)["rows"][(size_t) 0].IsPacked() );
+
+	JsonDocument * pPackedCopy = pPacked->Clone();
+	ASSERT_TRUE( (*pPackedCopy)["xyz"].IsPacked() );
+	ASSERT_TRUE( pPackedCopy->IsEqual( *pPacked ) );
+	ASSERT_EQ( pPacked->GetHash(), pPackedCopy->GetHash() );
+
+	// const iterators read the packed numbers through views they own, mutable access unpacks them transparently
+	JsonNode::const_iterator packedFirst = xyz.begin();
+	const JsonNode * pPackedView = *packedFirst;
+	ASSERT_EQ( &xyz, pPackedView->GetParent() );
+	ASSERT_FALSE( pPackedView->IsLastChild() );
+	float packedSum = 0.0f;
+	size_t nbLastChildren = 0;
+	for( JsonNode::const_iterator iter = xyz.begin(); iter != xyz.end(); ++iter )
+	{
+		packedSum += (*iter)->GetNumber();
+		nbLastChildren += (*iter)->IsLastChild() ? 1 : 0;
+	}
+	ASSERT_EQ( 85.5f, packedSum );
+	ASSERT_EQ( 1, nbLastChildren );
+	ASSERT_EQ( 1.0f, pPackedView->GetNumber() );
+	ASSERT_EQ( 10, xyz.end() - xyz.begin() );
+	ASSERT_TRUE( xyz.IsPacked() );
+
+	JsonDocument * pPackedDiff = JsonDocument::Parse( "{ 'xyz': [ 1, 2.5, -3, 4e1, 5, 6, 7, 8, 9, 11 ], 'mixed': [ 1, 2, 'three' ], 'empty': [], 'rows': [ [ 1, 2 ], [ 3 ] ] }" );
+	JsonDocument * pPackedPatch = JsonDiff( *pPacked, *pPackedDiff );
+	ASSERT_EQ( 1, pPackedPatch->GetNbChildren() );
+	ASSERT_FALSE( strcmp( "/xyz/9", (*pPackedPatch)[(size_t) 0]["path"].GetString() ) );
+	ASSERT_EQ( 11.0f, (*pPackedPatch)[(size_t) 0]["value"].GetNumber() );
+	ASSERT_TRUE( xyz.IsPacked() );
+	ASSERT_FALSE( pPacked->IsEqual( *pPackedDiff ) );
+	ASSERT_TRUE( xyz.IsPacked() );
+	delete pPackedPatch;
+	delete pPackedDiff;
+
+	ASSERT_EQ( -3.0f, pPacked->GetChild( "xyz" )->GetChild( 2 )->GetNumber() );
+	ASSERT_FALSE( xyz.IsPacked() );
+	ASSERT_EQ( &xyz, xyz[2].GetParent() );
+	ASSERT_EQ( 10, xyz.GetNbChildren() );
+	ASSERT_TRUE( pPackedCopy->IsEqual( *pPacked ) );
+	ASSERT_EQ( pPacked->GetHash(), pPackedCopy->GetHash() );
+	delete pPacked;
+
+	JsonNode * pPackedRow = pPackedCopy->GetChild( "rows" )->GetChild( (size_t) 1 );
+	pPackedRow->AddString( NULL, "four" );
+	ASSERT_FALSE( pPackedRow->IsPacked() );
+	ASSERT_EQ( 3.0f, (*pPackedRow)[(size_t) 0].GetNumber() );
+	ASSERT_FALSE( strcmp( "four", (*pPackedRow)[1].GetString() ) );
+
+	const float values [] = { 0.5f, 1.5f };
+	JsonNode * pValues = pPackedCopy->AddNumbers( "values", values, 2 );
+	ASSERT_TRUE( pValues->IsPacked() );
+	ASSERT_EQ( 1.5f, pValues->GetNumbers()[1] );
+	pPackedCopy->Freeze();
+	ASSERT_FALSE( pValues->IsPacked() );
+	ASSERT_EQ( 1.5f, (*pValues)[1].GetNumber() );
+	delete pPackedCopy;
+
+	// packed numbers count as nodes for the limits
+	JsonParseLimits fewNodes;
+	fewNodes.MaxNodes = 8;
+	ASSERT_TRUE( JsonDocument::Parse( packed, fewNodes, JsonParseMode_Copy, JsonTokenizer::Option_PackNumbers ) == NULL );
+
+	// clones are deep, mutable copies of any object or array
+	JsonDocument * pDoc5 = JsonDocument::Parse( text3, JsonParseMode_BorrowBuffer );
+	JsonDocument * pGlossEntry = (*pDoc5)["glossary"]["GlossDiv"]["GlossList"]["GlossEntry"].Clone();
+	ASSERT_EQ( JsonNodeType_Object, pGlossEntry->GetType() );
+	ASSERT_EQ( 7, pGlossEntry->GetNbChildren() );
+	ASSERT_FALSE( strcmp( "XML", (*pGlossEntry)["GlossDef"]["GlossSeeAlso"][1].GetString() ) );
+	pGlossEntry->AddString( "Extra", "Only in the clone" );
+	ASSERT_EQ( 7, (*pDoc5)["glossary"]["GlossDiv"]["GlossList"]["GlossEntry"].GetNbChildren() );
+
+	JsonDocument * pSeeAlso = (*pGlossEntry)["GlossDef"]["GlossSeeAlso"].Clone();
+	ASSERT_EQ( JsonNodeType_Array, pSeeAlso->GetType() );
+	ASSERT_EQ( 2, pSeeAlso->GetNbChildren() );
+	ASSERT_EQ( pSeeAlso, (*pSeeAlso)[1].GetParent() );
+	delete pSeeAlso;
+	delete pGlossEntry;
+
+	// diffing two documents gives a JSON Patch that turns one into the other
+	const char from [] = "{ 'name': 'Marco', 'level': 100, 'items': [ 1, 2, 3, 4 ], 'stats': { 'hp': 10, 'mp': 5 }, 'gone': true, 'a/b': 1 }";
+	const char to [] = "{ 'level': 101, 'name': 'Marco', 'items': [ 1, 2, 9, 3, 4 ], 'stats': { 'mp': 6, 'hp': 10 }, 'a/b': 2, 'new': 'x' }";
+
+	JsonDocument * pFrom = JsonDocument::Parse( from );
+	JsonDocument * pTo = JsonDocument::Parse( to );
+	ASSERT_NE( pFrom->GetHash(), pTo->GetHash() );
+	ASSERT_FALSE( pFrom->IsEqual( *pTo ) );
+
+	JsonDocument * pPatch = JsonDiff( *pFrom, *pTo );
+	ASSERT_EQ( JsonNodeType_Array, pPatch->GetType() );
+	ASSERT_EQ( 6, pPatch->GetNbChildren() );
+	ASSERT_FALSE( strcmp( "replace", (*pPatch)[(size_t) 0]["op"].GetString() ) );
+	ASSERT_FALSE( strcmp( "/level", (*pPatch)[(size_t) 0]["path"].GetString() ) );
+	ASSERT_FALSE( strcmp( "/items/2", (*pPatch)[1]["path"].GetString() ) );
+	ASSERT_FALSE( strcmp( "/a~1b", (*pPatch)[4]["path"].GetString() ) );
+
+	bool bPatched = pFrom->ApplyPatch( *pPatch );
+	ASSERT_TRUE( bPatched );
+	ASSERT_EQ( pFrom->GetHash(), pTo->GetHash() );
+	ASSERT_TRUE( pFrom->IsEqual( *pTo ) );
+	ASSERT_EQ( 9.0f, (*pFrom)["items"][2].GetNumber() );
+	delete pPatch;
+
+	pPatch = JsonDiff( *pFrom, *pTo );
+	ASSERT_EQ( 0, pPatch->GetNbChildren() );
+	delete pPatch;
+
+	pPatch = JsonDocument::Parse( "[																				\
+		{ 'op': 'test', 'path': '/stats/hp', 'value': 10 },											\
+		{ 'op': 'move', 'from': '/stats/hp', 'path': '/hp' },										\
+		{ 'op': 'copy', 'from': '/items', 'path': '/stats/items' },									\
+		{ 'op': 'remove', 'path': '/items/0' },														\
+		{ 'op': 'add', 'path': '/items/-', 'value': { 'last': true } },								\
+		{ 'op': 'replace', 'path': '/name', 'value': 'Polo' }										\
+	]" );
+	bPatched = pFrom->ApplyPatch( *pPatch );
+	ASSERT_TRUE( bPatched );
+	ASSERT_EQ( 10.0f, (*pFrom)["hp"].GetNumber() );
+	ASSERT_FALSE( (*pFrom)["stats"]["hp"].IsValid() );
+	ASSERT_EQ( 5, (*pFrom)["stats"]["items"].GetNbChildren() );
+	ASSERT_EQ( 5, (*pFrom)["items"].GetNbChildren() );
+	ASSERT_TRUE( (*pFrom)["items"][4]["last"].GetBool() );
+	ASSERT_FALSE( strcmp( "Polo", (*pFrom)["name"].GetString() ) );
+	ASSERT_EQ( 'n', pFrom->GetChild( (size_t) 0 )->GetName()[0] );
+	delete pPatch;
+
+	pPatch = JsonDocument::Parse( "[ { 'op': 'test', 'path': '/name', 'value': 'Marco' } ]" );
+	bPatched = pFrom->ApplyPatch( *pPatch );
+	ASSERT_FALSE( bPatched );
+	delete pPatch;
+	delete pFrom;
+	delete pTo;
+
+	// copying a container into itself copies it as it was before the patch
+	pFrom = JsonDocument::Parse( "{ 'a': [ 1, [ 2 ] ] }" );
+	pPatch = JsonDocument::Parse( "[ { 'op': 'copy', 'from': '/a', 'path': '/a/-' } ]" );
+	bPatched = pFrom->ApplyPatch( *pPatch );
+	ASSERT_TRUE( bPatched );
+	ASSERT_EQ( 3, (*pFrom)["a"].GetNbChildren() );
+	ASSERT_EQ( 2, (*pFrom)["a"][2].GetNbChildren() );
+	ASSERT_EQ( 2.0f, (*pFrom)["a"][2][1][(size_t) 0].GetNumber() );
+	ASSERT_EQ( &(*pFrom)["a"][2], (*pFrom)["a"][2][1].GetParent() );
+	delete pPatch;
+	delete pFrom;
+
+	// streamed parsing: children of the root are tokenized as they come out of the stream
+	FILE * pFile = tmpfile();
+	fwrite( text3, 1, sizeof(text3) - 1, pFile );
+	rewind( pFile );
+	{
+		JsonFileInputStream file( pFile );
+		JsonDocument * pStreamed = JsonDocument::ParseStream( file );
+		ASSERT_TRUE( pStreamed != NULL );
+		ASSERT_EQ( pDoc5->GetHash(), pStreamed->GetHash() );
+		delete pStreamed;
+	}
+#if MINJA_THREADS
+	rewind( pFile );
+	{
+		// tiny chunks so that strings, keys and numbers straddle reads
+		JsonFileInputStream file( pFile );
+		JsonReadAheadStream readAhead( file, 7, 3 );
+		JsonDocument * pStreamed = JsonDocument::ParseStream( readAhead );
+		ASSERT_TRUE( pStreamed != NULL );
+		ASSERT_EQ( pDoc5->GetHash(), pStreamed->GetHash() );
+		delete pStreamed;
+	}
+#endif
+	fclose( pFile );
+
+	pFile = tmpfile();
+	fwrite( text1, 1, sizeof(text1) - 10, pFile );
+	rewind( pFile );
+	{
+		JsonFileInputStream file( pFile );
+		ASSERT_TRUE( JsonDocument::ParseStream( file ) == NULL );
+	}
+	fclose( pFile );
+	ASSERT_TRUE( JsonDocument::ParseFile( "this/file/does/not/exist.json" ) == NULL );
+
+	// the elements of a nested array come one at a time, in recycled storage
+	const char exported [] = "{ 'meta': { 'rows': [ 'x', ',' ], 'note': 'a ] \\' b' }, 'data': { 'skip': [ 1, { 'rows': 2 } ],\n"
+		"'rows': [ { 'id': 1, 'name': 'alpha' }, 7, [ 1, 2 ], { 'id': 4 }, ] }, 'after': ";
+	TrickleStream trickle( exported, 3 );
+	JsonElementReader rows( trickle, "/data/rows" );
+	JsonNode * pRow = rows.Next();
+	ASSERT_TRUE( pRow != NULL );
+	ASSERT_EQ( 1.0f, (*pRow)["id"].GetNumber() );
+	ASSERT_FALSE( strcmp( "alpha", (*pRow)["name"].GetString() ) );
+	JsonNode * pNext = rows.Next();
+	ASSERT_EQ( 7.0f, pNext->GetNumber() );
+	pNext = rows.Next();
+	ASSERT_EQ( 2, pNext->GetNbChildren() );
+	pNext = rows.Next();
+	ASSERT_EQ( pRow, pNext );
+	ASSERT_EQ( 4.0f, (*pRow)["id"].GetNumber() );
+	pNext = rows.Next();
+	ASSERT_TRUE( pNext == NULL );
+	ASSERT_FALSE( rows.HasFailed() );
+	ASSERT_EQ( 4, rows.GetNbElements() );
+
+	TrickleStream missingTrickle( exported, 5 );
+	JsonElementReader missingRows( missingTrickle, "/meta/note" );
+	pNext = missingRows.Next();
+	ASSERT_TRUE( pNext == NULL );
+	ASSERT_TRUE( missingRows.HasFailed() );
+
+	TrickleStream truncatedTrickle( "[ 'first', 'sec", 4 );
+	JsonElementReader truncatedItems( truncatedTrickle, "", JsonParseMode_BorrowBuffer );
+	pNext = truncatedItems.Next();
+	ASSERT_FALSE( strcmp( "first", pNext->GetString() ) );
+	pNext = truncatedItems.Next();
+	ASSERT_TRUE( pNext == NULL );
+	ASSERT_TRUE( truncatedItems.HasFailed() );
+	ASSERT_EQ( JsonValidateError_ExpectedArrayEnd, truncatedItems.GetError().Syntax );
+	ASSERT_EQ( 15u, truncatedItems.GetError().Offset );
+
+	// an edit only parses again the innermost container around it
+	const char edited [] = "{ 'name': 'minja',\n  'list': [ 1, 2, 3 ],\n  'nested': { 'a': { 'b': 1 }, 'c': [ true ] },\n  'last': 'end' }";
+	JsonIncrementalParser editor;
+	bool bEdited = editor.SetText( edited, sizeof(edited) - 1 );
+	ASSERT_TRUE( bEdited );
+	ASSERT_EQ( sizeof(edited) - 1, editor.GetLastParsedLength() );
+	const JsonNode * pEditedList = editor.GetDocument()->GetChild( "list" );
+	const JsonNode * pEditedNested = editor.GetDocument()->GetChild( "nested" );
+
+	size_t inner = editor.GetText().find( "'b': 1" ) + 5;
+	bEdited = editor.Edit( inner, 1, "42", 2 );
+	ASSERT_TRUE( bEdited );
+	ASSERT_EQ( 11u, editor.GetLastParsedLength() );
+	ASSERT_EQ( 42.0f, (*editor.GetDocument())["nested"]["a"]["b"].GetNumber() );
+	ASSERT_EQ( pEditedNested, editor.GetDocument()->GetChild( "nested" ) );
+
+	// the offsets after the edit have moved along
+	size_t spanBegin, spanEnd;
+	ASSERT_TRUE( editor.GetSpan( pEditedNested->GetChild( "c" ), &spanBegin, &spanEnd ) );
+	ASSERT_EQ( '[', editor.GetText()[spanBegin] );
+	ASSERT_EQ( ']', editor.GetText()[spanEnd] );
+	bEdited = editor.Edit( spanEnd, 0, ", null", 6 );
+	ASSERT_TRUE( bEdited );
+	ASSERT_EQ( 2, (*editor.GetDocument())["nested"]["c"].GetNbChildren() );
+	bEdited = editor.Edit( editor.GetText().find( "3 ]" ), 1, "'three', 4", 10 );
+	ASSERT_TRUE( bEdited );
+	ASSERT_EQ( pEditedList, editor.GetDocument()->GetChild( "list" ) );
+	ASSERT_EQ( 4, pEditedList->GetNbChildren() );
+	ASSERT_FALSE( strcmp( "three", (*pEditedList)[2].GetString() ) );
+
+	// an edit that doesn't parse leaves no document, the next one that fixes it parses everything
+	size_t colon = editor.GetText().find( "'c'" ) + 3;
+	bEdited = editor.Edit( colon, 1, "", 0 );
+	ASSERT_FALSE( bEdited );
+	ASSERT_TRUE( editor.GetDocument() == NULL );
+	ASSERT_EQ( JsonValidateError_ExpectedColon, editor.GetError().Syntax );
+	ASSERT_EQ( colon + 1, editor.GetError().Offset );
+	bEdited = editor.Edit( colon, 0, ":", 1 );
+	ASSERT_TRUE( bEdited );
+	ASSERT_EQ( editor.GetText().size(), editor.GetLastParsedLength() );
+
+	// brackets that no longer match make the whole text parse again
+	bEdited = editor.Edit( editor.GetText().find( "'three'" ), 0, "], 'more': [ ", 13 );
+	ASSERT_TRUE( bEdited );
+	ASSERT_EQ( editor.GetText().size(), editor.GetLastParsedLength() );
+	ASSERT_EQ( 2, (*editor.GetDocument())["more"].GetNbChildren() );
+
+	// many small edits give the same tree as parsing the final text
+	for( int e=0; e<200; ++e )
+	{
+		size_t digit = editor.GetText().find( "'b': " ) + 5;
+		char value[2] = { (char) ('1' + e % 9), 0 };
+		bEdited = editor.Edit( digit, 1, value, 1 );
+		ASSERT_TRUE( bEdited );
+	}
+	JsonDocument * pReparsed = JsonDocument::Parse( editor.GetText().c_str() );
+	ASSERT_TRUE( pReparsed->IsEqual( *editor.GetDocument() ) );
+	delete pReparsed;
+
+	// the packed numbers parsed again don't add up against the node limit either, which would
+	// make every edit fall back to parsing the whole text
+	JsonParseLimits editLimits;
+	editLimits.MaxNodes = 20;
+	JsonIncrementalParser packedEditor( JsonTokenizer::Option_PackNumbers, editLimits );
+	const char packedEdited [] = "{ 'v': [ 1, 2, 3, 4, 5, 6, 7, 8 ], 'w': 0 }";
+	bEdited = packedEditor.SetText( packedEdited, sizeof(packedEdited) - 1 );
+	for( int e=0; e<50 && bEdited; ++e )
+	{
+		char value[2] = { (char) ('1' + e % 9), 0 };
+		bEdited = packedEditor.Edit( packedEditor.GetText().find( "8 ]" ) - 3, 1, value, 1 ) && packedEditor.GetLastParsedLength() == 26;
+	}
+	ASSERT_TRUE( bEdited );
+	ASSERT_TRUE( (*packedEditor.GetDocument())["v"].IsPacked() );
+	ASSERT_EQ( 8, (*packedEditor.GetDocument())["v"].GetNbChildren() );
+
+#if MINJA_ZLIB
+	{
+		// gzip fixture made of two members, split in the middle of the document
+		std::vector<unsigned char> gzip( 2 * sizeof(text3) + 256 );
+		z_stream deflater;
+		memset( &deflater, 0, sizeof(deflater) );
+		size_t half = sizeof(text3) / 2;
+		size_t gzipSize = 0;
+		int zResult = deflateInit2( &deflater, 9, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY );
+		ASSERT_EQ( Z_OK, zResult );
+		for( int member=0; member<2; ++member )
+		{
+			deflater.next_in = (Bytef *) text3 + (member ? half : 0);
+			deflater.avail_in = (uInt) (member ? sizeof(text3) - 1 - half : half);
+			deflater.next_out = &gzip[gzipSize];
+			deflater.avail_out = (uInt) (gzip.size() - gzipSize);
+			zResult = deflate( &deflater, Z_FINISH );
+			ASSERT_EQ( Z_STREAM_END, zResult );
+			gzipSize = deflater.next_out - &gzip[0];
+			zResult = deflateReset( &deflater );
+			ASSERT_EQ( Z_OK, zResult );
+		}
+		deflateEnd( &deflater );
+
+		pFile = tmpfile();
+		fwrite( &gzip[0], 1, gzipSize, pFile );
+		rewind( pFile );
+		{
+			JsonFileInputStream file( pFile );
+			JsonInflateInputStream inflater( file, 16 );
+#if MINJA_THREADS
+			JsonReadAheadStream readAhead( inflater, 64, 2 );
+			JsonDocument * pInflated = JsonDocument::ParseStream( readAhead );
+#else
+			JsonDocument * pInflated = JsonDocument::ParseStream( inflater );
+#endif
+			ASSERT_TRUE( pInflated != NULL );
+			ASSERT_EQ( pDoc5->GetHash(), pInflated->GetHash() );
+			delete pInflated;
+		}
+
+		fclose( pFile );
+
+		// running out of input in the middle of a member is an error
+		pFile = tmpfile();
+		fwrite( &gzip[0], 1, 40, pFile );
+		rewind( pFile );
+		{
+			char chunk[32];
+			JsonFileInputStream file( pFile );
+			JsonInflateInputStream inflater( file );
+			while( inflater.Read( chunk, sizeof(chunk) ) )
+				;
+			ASSERT_TRUE( inflater.HasFailed() );
+		}
+		fclose( pFile );
+	}
+#endif
+
+	// columns out of an array of objects, without any node
+	const char records [] = "{ 'meta': { 'rows': [ 0 ] }, 'data': { 'rows': [												\
+		{ 'id': 1, 'host': 'alpha', 'bytes': 1.5e3, 'tags': [ 'a', { 'id': 99 } ] },								\
+		{ 'host': 'beta', 'id': -2, 'bytes': null, 'extra': { 'bytes': 7 } },										\
+		{ 'id': 'three', 'bytes': 12, 'host': 'gam\\\"ma' },															\
+		7,																											\
+		{ 'id': 4000000000123, 'bytes': true },																		\
+		{ 'id': 9223372036854775807 }, { 'id': -9223372036854775808 }, { 'id': 9223372036854775808 },				\
+		{ 'id': 1e300 }, { 'id': -2.5e3 }																			\
+	] } }";
+
+	JsonColumnExtractor extractor( "/data/rows" );
+	size_t idColumn = extractor.AddColumn( "id", JsonColumnType_Int64 );
+	size_t hostColumn = extractor.AddColumn( "host", JsonColumnType_String );
+	size_t bytesColumn = extractor.AddColumn( "bytes", JsonColumnType_Double );
+	bool bExtracted = extractor.Extract( records );
+	ASSERT_TRUE( bExtracted );
+	ASSERT_EQ( 9, extractor.GetNbRows() );
+
+	const JsonColumn & ids = extractor.GetColumn( idColumn );
+	ASSERT_EQ( 9, ids.GetNbRows() );
+	ASSERT_EQ( 1, ids.GetInt64s()[0] );
+	ASSERT_EQ( -2, ids.GetInt64s()[1] );
+	ASSERT_TRUE( ids.IsNull( 2 ) );
+	ASSERT_EQ( 4000000000123LL, ids.GetInt64s()[3] );
+	ASSERT_EQ( 9223372036854775807LL, ids.GetInt64s()[4] );
+	ASSERT_EQ( -9223372036854775807LL - 1, ids.GetInt64s()[5] );
+	ASSERT_TRUE( ids.IsNull( 6 ) );
+	ASSERT_TRUE( ids.IsNull( 7 ) );
+	ASSERT_EQ( -2500, ids.GetInt64s()[8] );
+	ASSERT_EQ( 0x3B, ids.GetValidity()[0] );
+	ASSERT_EQ( 0x01, ids.GetValidity()[1] );
+
+	const JsonColumn & bytes = extractor.GetColumn( bytesColumn );
+	ASSERT_EQ( 1500.0, bytes.GetDoubles()[0] );
+	ASSERT_TRUE( bytes.IsNull( 1 ) );
+	ASSERT_EQ( 12.0, bytes.GetDoubles()[2] );
+	ASSERT_EQ( 1.0, bytes.GetDoubles()[3] );
+
+	size_t hostLength;
+	const JsonColumn & hosts = *extractor.FindColumn( "host" );
+	ASSERT_EQ( &hosts, &extractor.GetColumn( hostColumn ) );
+	ASSERT_FALSE( memcmp( "beta", hosts.GetString( 1, hostLength ), 4 ) );
+	ASSERT_EQ( 4, hostLength );
+	ASSERT_FALSE( memcmp( "gam\\\"ma", hosts.GetString( 2, hostLength ), 6 ) );
+	ASSERT_TRUE( hosts.IsNull( 3 ) );
+	hosts.GetString( 3, hostLength );
+	ASSERT_EQ( 0, hostLength );
+
+	JsonColumnExtractor rootExtractor( "" );
+	rootExtractor.AddColumn( "age", JsonColumnType_Int64 );
+	bExtracted = rootExtractor.Extract( "[ { 'age': 33 }, { 'age': 34 } ]" );
+	ASSERT_TRUE( bExtracted );
+	ASSERT_EQ( 67, rootExtractor.GetColumn( 0 ).GetInt64s()[0] + rootExtractor.GetColumn( 0 ).GetInt64s()[1] );
+	bExtracted = rootExtractor.Extract( text4 );
+	ASSERT_TRUE( bExtracted );
+	ASSERT_EQ( 0, rootExtractor.GetNbRows() );
+
+	// NDJSON filtered and aggregated without any node
+	const char logs [] = "{ 'host': 'alpha', 'status': 500, 'bytes': 100, 'path': '/a', 'headers': { 'status': 200 } }\n"
+		"{ 'status': 200, 'host': 'alpha', 'bytes': 5 }\r\n"
+		"\n"
+		"{ 'host': 'beta', 'bytes': 7.5, 'status': 500, 'tags': [ 1, 2 ] }\n"
+		"not a record\n"
+		"{ 'host': 'alpha', 'status': 500, 'bytes': 'n/a' }\n"
+		"{ 'status': 500, 'bytes': 1 }";
+
+	JsonQuery query;
+	query.Where( "status", JsonQuery::Compare_Equal, 500.0 ).GroupBy( "host" );
+	query.Aggregate( JsonQuery::Function_Count ).Aggregate( JsonQuery::Function_Sum, "bytes" ).Aggregate( JsonQuery::Function_Max, "bytes" );
+	query.Select( "host" ).Select( "tags" );
+
+	JsonQueryResult queryResult;
+	query.Run( logs, sizeof(logs) - 1, queryResult );
+	ASSERT_EQ( 6, queryResult.GetNbRecords() );
+	ASSERT_EQ( 1, queryResult.GetNbErrors() );
+	ASSERT_EQ( 4, queryResult.GetNbMatches() );
+	ASSERT_EQ( 3, queryResult.GetNbGroups() );
+	ASSERT_FALSE( strcmp( "", queryResult.GetGroup( 0 ).Key.c_str() ) );
+
+	const JsonQueryGroup * pAlpha = queryResult.FindGroup( "alpha" );
+	ASSERT_TRUE( pAlpha != NULL );
+	ASSERT_EQ( 2, pAlpha->NbRecords );
+	ASSERT_EQ( 2.0, pAlpha->Values[0] );
+	ASSERT_EQ( 100.0, pAlpha->Values[1] );
+	ASSERT_EQ( 1, pAlpha->NbValues[1] );
+	ASSERT_EQ( 7.5, queryResult.FindGroup( "beta" )->Values[2] );
+	ASSERT_TRUE( queryResult.FindGroup( "gamma" ) == NULL );
+
+	ASSERT_EQ( 4, queryResult.GetNbRows() );
+	ASSERT_FALSE( strcmp( "{\"host\":\"beta\",\"tags\":[ 1, 2 ]}", queryResult.GetRow( 1 ).c_str() ) );
+	ASSERT_FALSE( strcmp( "{}", queryResult.GetRow( 3 ).c_str() ) );
+
+	// selected names and strings are written escaped, whatever quotes delimited them
+	const char quotes [] = "{ 'msg': 'say \\\"hi\\\"\tnow', 'a\tb': 1 }";
+	JsonQuery quoteQuery;
+	quoteQuery.Select( "msg" ).Select( "a\tb" );
+	JsonQueryResult quoteResult;
+	quoteQuery.Run( quotes, sizeof(quotes) - 1, quoteResult );
+	ASSERT_EQ( 1, quoteResult.GetNbRows() );
+	ASSERT_FALSE( strcmp( "{\"msg\":\"say \\\"hi\\\"\\tnow\",\"a\\tb\":1}", quoteResult.GetRow( 0 ).c_str() ) );
+	JsonDocument * pQuoteRow = JsonDocument::Parse( quoteResult.GetRow( 0 ).c_str() );
+	ASSERT_TRUE( pQuoteRow != NULL );
+	delete pQuoteRow;
+
+	JsonQuery countQuery;
+	countQuery.Where( "host", JsonQuery::Compare_NotEqual, "alpha" ).Aggregate( JsonQuery::Function_Count, "status" );
+	countQuery.Run( logs, sizeof(logs) - 1, queryResult );
+	ASSERT_EQ( 1, queryResult.GetNbGroups() );
+	ASSERT_EQ( 1.0, queryResult.GetGroup( 0 ).Values[0] );
+
+	// blocks of a few lines, spread over threads, give the same results
+	std::string manyLogs;
+	for( int i=0; i<1000; ++i )
+	{
+		char line[96];
+		sprintf( line, "{ 'host': 'h%d', 'status': %d, 'bytes': %d }\n", i % 7, (i % 3) ? 200 : 500, i );
+		manyLogs += line;
+	}
+
+	JsonQuery sumQuery;
+	sumQuery.Where( "status", JsonQuery::Compare_GreaterEqual, 500.0 ).GroupBy( "host" );
+	sumQuery.Aggregate( JsonQuery::Function_Sum, "bytes" ).Aggregate( JsonQuery::Function_Min, "bytes" ).Select( "bytes" );
+	JsonQueryResult sumResult;
+	sumQuery.Run( manyLogs.c_str(), manyLogs.size(), sumResult, 4 );
+	ASSERT_EQ( 334, sumResult.GetNbMatches() );
+	ASSERT_EQ( 7, sumResult.GetNbGroups() );
+	ASSERT_EQ( 0.0, sumResult.FindGroup( "h0" )->Values[1] );
+	ASSERT_FALSE( strcmp( "{\"bytes\":999}", sumResult.GetRow( 333 ).c_str() ) );
+
+	double totalBytes = 0.0;
+	for( size_t g=0; g<sumResult.GetNbGroups(); ++g )
+		totalBytes += sumResult.GetGroup( g ).Values[0];
+	ASSERT_EQ( 166833.0, totalBytes );
+
+	pFile = tmpfile();
+	fwrite( manyLogs.c_str(), 1, manyLogs.size(), pFile );
+	rewind( pFile );
+	{
+		JsonFileInputStream file( pFile );
+		bool bRan = sumQuery.Run( file, queryResult, 3, 100 );
+		ASSERT_TRUE( bRan );
+		ASSERT_EQ( 1000, queryResult.GetNbRecords() );
+		ASSERT_EQ( sumResult.GetNbRows(), queryResult.GetNbRows() );
+		ASSERT_FALSE( strcmp( "{\"bytes\":999}", queryResult.GetRow( 333 ).c_str() ) );
+		ASSERT_EQ( sumResult.FindGroup( "h3" )->Values[0], queryResult.FindGroup( "h3" )->Values[0] );
+	}
+	fclose( pFile );
+
+	// duplicate keys are resolved by an opt-in policy
+	const char dupKeys [] = "{ 'a': 1, 'b': { 'x': 1, 'x': 2 }, 'a': 3, 'c': 4 }";
+	JsonDocument * pDup = JsonDocument::Parse( dupKeys );
+	ASSERT_EQ( 4, pDup->GetNbChildren() );
+	delete pDup;
+	ASSERT_TRUE( JsonDocument::Parse( dupKeys, JsonParseMode_Copy, JsonTokenizer::Option_RejectDuplicateKeys ) == NULL );
+	pDup = JsonDocument::Parse( dupKeys, JsonParseMode_Copy, JsonTokenizer::Option_KeepFirstKey );
+	ASSERT_EQ( 3, pDup->GetNbChildren() );
+	ASSERT_EQ( 1.0f, (*pDup)["a"].GetNumber() );
+	ASSERT_EQ( 1, (*pDup)["b"].GetNbChildren() );
+	ASSERT_EQ( 1.0f, (*pDup)["b"]["x"].GetNumber() );
+	delete pDup;
+	pDup = JsonDocument::Parse( dupKeys, JsonParseMode_Copy, JsonTokenizer::Option_KeepLastKey );
+	ASSERT_EQ( 3, pDup->GetNbChildren() );
+	ASSERT_EQ( 3.0f, (*pDup)["a"].GetNumber() );
+	ASSERT_EQ( 2.0f, (*pDup)["b"]["x"].GetNumber() );
+	ASSERT_FALSE( strcmp( "c", pDup->GetChild( 2 )->GetName() ) );
+
+	pDup->SetOptions( JsonTokenizer::Option_RejectDuplicateKeys );
+	JsonNode * pAdded = pDup->AddNumber( "a", 5.0f );
+	ASSERT_TRUE( pAdded == NULL );
+	pAdded = pDup->AddString( "d", "new" );
+	ASSERT_TRUE( pAdded != NULL );
+	pAdded = pDup->GetChild( "b" )->AddBool( "x", true );
+	ASSERT_TRUE( pAdded == NULL );
+	pAdded = pDup->AddObject( "d" );
+	ASSERT_TRUE( pAdded == NULL );
+	pDup->SetOptions( JsonTokenizer::Option_KeepLastKey );
+	pDup->AddNumber( "a", 6.0f );
+	ASSERT_EQ( 6.0f, (*pDup)["a"].GetNumber() );
+	ASSERT_EQ( 4, pDup->GetNbChildren() );
+	pDup->SetOptions( JsonTokenizer::Option_KeepFirstKey );
+	pDup->AddNumber( "a", 7.0f );
+	ASSERT_EQ( 6.0f, (*pDup)["a"].GetNumber() );
+	ASSERT_EQ( 4, pDup->GetNbChildren() );
+	delete pDup;
+
+	// parse limits fail fast with an error, the document being left empty
+	const char limited [] = "{ 'name': 'minja', 'list': [ [ 1, 2 ], 3 ] }";
+	JsonParseLimits limits;
+	limits.MaxDepth = 3;
+	limits.MaxNodes = 6;
+	limits.MaxBytes = sizeof(limited) - 1;
+	limits.MaxStringLength = 5;
+	limits.MaxKeyLength = 4;
+	JsonDocument * pLimited = JsonDocument::Parse( limited, limits );
+	ASSERT_TRUE( pLimited != NULL );
+	ASSERT_EQ( 3.0f, (*pLimited)["list"][1].GetNumber() );
+	delete pLimited;
+
+	JsonParseLimits tooSmall = limits;
+	tooSmall.MaxDepth = 2;
+	ASSERT_TRUE( JsonDocument::Parse( limited, tooSmall ) == NULL );
+	tooSmall = limits;
+	tooSmall.MaxNodes = 5;
+	ASSERT_TRUE( JsonDocument::Parse( limited, tooSmall ) == NULL );
+	tooSmall = limits;
+	tooSmall.MaxBytes = sizeof(limited) - 2;
+	ASSERT_TRUE( JsonDocument::Parse( limited, tooSmall ) == NULL );
+	tooSmall = limits;
+	tooSmall.MaxStringLength = 4;
+	ASSERT_TRUE( JsonDocument::Parse( limited, tooSmall ) == NULL );
+	tooSmall = limits;
+	tooSmall.MaxKeyLength = 3;
+	ASSERT_TRUE( JsonDocument::Parse( limited, tooSmall ) == NULL );
+	tooSmall = limits;
+	tooSmall.MaxMemory = 4 * sizeof(JsonNode);
+	ASSERT_TRUE( JsonDocument::Parse( limited, tooSmall ) == NULL );
+
+	// hostile nesting stops at the limit instead of recursing through the stack
+	std::string deep( 1000000, '[' );
+	JsonParseLimits shallow;
+	shallow.MaxDepth = 64;
+	ASSERT_TRUE( JsonDocument::Parse( deep.c_str(), shallow ) == NULL );
+
+	// numbers are only bounded by the string length limit
+	std::string longNumber = "{ 'n': 0.25" + std::string( 100, '0' ) + ", 'p': [ 1" + std::string( 30, '0' ) + "e-30 ] }";
+	JsonDocument * pLongNumber = JsonDocument::Parse( longNumber.c_str(), JsonParseMode_Copy, JsonTokenizer::Option_PackNumbers );
+	ASSERT_TRUE( pLongNumber != NULL );
+	ASSERT_EQ( 0.25f, (*pLongNumber)["n"].GetNumber() );
+	ASSERT_EQ( 1.0f, (*pLongNumber)["p"].GetNumbers()[0] );
+	delete pLongNumber;
+	JsonParseLimits shortNumbers;
+	shortNumbers.MaxStringLength = 64;
+	JsonParseError numberError;
+	pLongNumber = JsonDocument::Parse( longNumber.c_str(), shortNumbers, JsonParseMode_Copy, 0, &numberError );
+	ASSERT_TRUE( pLongNumber == NULL );
+	ASSERT_EQ( JsonParseError_NumberTooLong, numberError.Code );
+
+	pLimited = JsonDocument::Create();
+	pLimited->SetLimits( tooSmall );
+	bParsed = JsonDocument::ParseInto( *pLimited, limited );
+	ASSERT_FALSE( bParsed );
+	ASSERT_EQ( 0, pLimited->GetNbChildren() );
+	pLimited->SetLimits( JsonParseLimits() );
+	bParsed = JsonDocument::ParseInto( *pLimited, limited );
+	ASSERT_TRUE( bParsed );
+	delete pLimited;
+
+	TrickleStream boundedTrickle( limited, 7 );
+	pLimited = JsonDocument::ParseStream( boundedTrickle, limits );
+	ASSERT_TRUE( pLimited != NULL );
+	ASSERT_EQ( 2, (*pLimited)["list"][(size_t) 0].GetNbChildren() );
+	delete pLimited;
+	TrickleStream hungryTrickle( limited, 7 );
+	ASSERT_TRUE( JsonDocument::ParseStream( hungryTrickle, tooSmall ) == NULL );
+	tooSmall = limits;
+	tooSmall.MaxBytes = 20;
+	TrickleStream truncatedLimited( limited, 7 );
+	ASSERT_TRUE( JsonDocument::ParseStream( truncatedLimited, tooSmall ) == NULL );
+
+	// a failed parse gives back a few integers; the text is only built when asked for
+	JsonParseError error;
+	const char errorText [] = "{\n  'a': 1,\n  'b' 2\n}";
+	ASSERT_TRUE( JsonDocument::Parse( errorText, JsonParseMode_Copy, 0, &error ) == NULL );
+	ASSERT_EQ( JsonParseError_Syntax, error.Code );
+	ASSERT_EQ( JsonValidateError_ExpectedColon, error.Syntax );
+	ASSERT_EQ( '2', errorText[error.Offset] );
+	ASSERT_EQ( 1u, error.Depth );
+	ASSERT_FALSE( strcmp( "':'", error.GetExpected() ) );
+	size_t line, column;
+	error.GetLineColumn( errorText, &line, &column );
+	ASSERT_EQ( 3u, line );
+	ASSERT_EQ( 7u, column );
+	ASSERT_FALSE( strcmp( "'b' ", error.GetSnippet( errorText, 4 ).c_str() ) );
+	ASSERT_TRUE( JsonDocument::Parse( "[ 1.e5 ]", JsonParseMode_Copy, 0, &error ) == NULL );
+	ASSERT_FALSE( strcmp( "Line 1, column 5: Dot in numbers must be followed by one digit at least, expected a digit. Location: [ 1.<-Here!", error.Format( "[ 1.e5 ]" ).c_str() ) );
+
+	// syntax errors are located where JsonValidate locates them, streamed or not
+	const char * invalidTexts [] = { "{,}", "[ ,]", "{ 'abc': 'de", "[ 'a\\q' ]", "{ 'a' : }", "[ 1 2 ]", "x", "{ 'a': tru }", text2 };
+	for( size_t i=0; i<sizeof(invalidTexts) / sizeof(invalidTexts[0]); ++i )
+	{
+		JsonValidateResult expected = JsonValidate( invalidTexts[i], strlen( invalidTexts[i] ) );
+		ASSERT_TRUE( JsonDocument::Parse( invalidTexts[i], JsonParseMode_Copy, 0, &error ) == NULL );
+		ASSERT_EQ( expected.Error, error.Syntax );
+		ASSERT_EQ( expected.Offset, error.Offset );
+	}
+	TrickleStream errorTrickle( text2, 3 );
+	ASSERT_TRUE( JsonDocument::ParseStream( errorTrickle, 0, &error ) == NULL );
+	ASSERT_EQ( JsonValidateError_ExpectedObjectEnd, error.Syntax );
+	ASSERT_EQ( JsonValidate( text2, sizeof(text2) - 1 ).Offset, error.Offset );
+
+	// limits have their own codes
+	tooSmall = limits;
+	tooSmall.MaxKeyLength = 3;
+	ASSERT_TRUE( JsonDocument::Parse( limited, tooSmall, JsonParseMode_Copy, 0, &error ) == NULL );
+	ASSERT_EQ( JsonParseError_KeyTooLong, error.Code );
+	ASSERT_EQ( 2u, error.Offset );
+	ASSERT_FALSE( strcmp( "", error.GetExpected() ) );
+	tooSmall = limits;
+	tooSmall.MaxNodes = 5;
+	ASSERT_TRUE( JsonDocument::Parse( limited, tooSmall, JsonParseMode_Copy, 0, &error ) == NULL );
+	ASSERT_EQ( JsonParseError_TooManyNodes, error.Code );
+	tooSmall = limits;
+	tooSmall.MaxBytes = 10;
+	ASSERT_TRUE( JsonDocument::Parse( limited, tooSmall, JsonParseMode_Copy, 0, &error ) == NULL );
+	ASSERT_EQ( JsonParseError_InputTooLarge, error.Code );
+	ASSERT_EQ( 10u, error.Offset );
+	ASSERT_TRUE( JsonDocument::Parse( deep.c_str(), shallow, JsonParseMode_Copy, 0, &error ) == NULL );
+	ASSERT_EQ( JsonParseError_TooDeep, error.Code );
+	ASSERT_EQ( 64u, error.Offset );
+	ASSERT_TRUE( JsonDocument::ParseFile( "this/file/does/not/exist.json", 0, &error ) == NULL );
+	ASSERT_EQ( JsonParseError_ReadError, error.Code );
+
+	// a reused document keeps the error of its last parse only
+	pLimited = JsonDocument::Create();
+	bParsed = JsonDocument::ParseInto( *pLimited, "{ 'a': [ 1, }" );
+	ASSERT_FALSE( bParsed );
+	ASSERT_EQ( JsonValidateError_ExpectedValue, pLimited->GetError().Syntax );
+	ASSERT_EQ( 2u, pLimited->GetError().Depth );
+	bParsed = JsonDocument::ParseInto( *pLimited, limited );
+	ASSERT_TRUE( bParsed );
+	ASSERT_FALSE( pLimited->GetError().IsError() );
+	delete pLimited;
+
+	// structs are filled straight from the tokenizer, without any node
+	Player player;
+	player.level = 0;
+	player.alive = false;
+	player.speed = 0.0f;
+	bool bRead = JsonRead( player, "{ 'name': 'Marco', 'skills': [ { 'level': 3 } ], 'level': 100, 'alive': true, 'extra': { 'level': 2 }, 'stats': { 'mp': 2.5, 'hp': 10 }, 'speed': null }" );
+	ASSERT_TRUE( bRead );
+	ASSERT_FALSE( strcmp( "Marco", player.name.c_str() ) );
+	ASSERT_EQ( 100, player.level );
+	ASSERT_TRUE( player.alive );
+	ASSERT_EQ( 0.0f, player.speed );
+	ASSERT_EQ( 10, player.stats.hp );
+	ASSERT_EQ( 2.5, player.stats.mp );
+
+	Player broken;
+	bRead = JsonRead( broken, "{ 'level': 'high' }" );
+	ASSERT_FALSE( bRead );
+	bRead = JsonRead( broken, "{ 'stats': [ 1, 2 ] }" );
+	ASSERT_FALSE( bRead );
+	bRead = JsonRead( broken, "{ 'level': 1" );
+	ASSERT_FALSE( bRead );
+	bRead = JsonRead( broken, "{ 'level': 1e20 }" );
+	ASSERT_FALSE( bRead );
+	bRead = JsonRead( broken, "{ 'level': -2147483648.5 }" );
+	ASSERT_TRUE( bRead );
+	ASSERT_EQ( -2147483647 - 1, broken.level );
+
+	std::string written;
+	player.speed = 1.5f;
+	JsonWrite( player, written );
+	ASSERT_FALSE( strcmp( "{\"name\":\"Marco\",\"level\":100,\"speed\":1.5,\"alive\":true,\"stats\":{\"hp\":10,\"mp\":2.5}}", written.c_str() ) );
+
+	Player reread;
+	bRead = JsonRead( reread, written.c_str() );
+	ASSERT_TRUE( bRead );
+	ASSERT_EQ( player.stats.mp, reread.stats.mp );
+	ASSERT_TRUE( reread.name == player.name );
+
+	// strings are escaped and non finite numbers written as null, as by JsonWriteNode
+	volatile float hugeSpeed = 1e38f;
+	player.name = "say \"hi\"\n";
+	player.speed = hugeSpeed * 10.0f;
+	written.clear();
+	JsonWrite( player, written );
+	ASSERT_FALSE( strcmp( "{\"name\":\"say \\\"hi\\\"\\n\",\"level\":100,\"speed\":null,\"alive\":true,\"stats\":{\"hp\":10,\"mp\":2.5}}", written.c_str() ) );
+	bool bReread = JsonRead( reread, written.c_str() );
+	ASSERT_TRUE( bReread );
+
+	// values and children are edited in place
+	JsonDocument * pEdit = JsonDocument::Parse( "{ 'name': 'Marco', 'level': 100, 'items': [ 1, 2, 3 ], 'alive': true }" );
+	JsonNode * pName = pEdit->GetChild( "name" );
+	const char * pOldName = pName->GetString();
+	pName->SetString( "Pol" );
+	ASSERT_EQ( pOldName, pName->GetString() );
+	ASSERT_EQ( 3, pName->GetStringLength() );
+	pName->SetString( "Marco Polo" );
+	ASSERT_FALSE( strcmp( "Marco Polo", (*pEdit)["name"].GetString() ) );
+	pEdit->GetChild( "level" )->SetNumber( 101.0f );
+	ASSERT_EQ( 101.0f, (*pEdit)["level"].GetNumber() );
+	pEdit->GetChild( "alive" )->SetBool( false );
+	ASSERT_FALSE( (*pEdit)["alive"].GetBool() );
+	pEdit->GetChild( "level" )->SetNull();
+	ASSERT_EQ( JsonNodeType_Null, (*pEdit)["level"].GetType() );
+
+	JsonNode * pItems = pEdit->GetChild( "items" );
+	pItems->InsertAt( 0, NULL, JsonNodeType_Number )->SetNumber( 0.0f );
+	ASSERT_EQ( 4, pItems->GetNbChildren() );
+	ASSERT_EQ( 1.0f, (*pItems)[1].GetNumber() );
+	bool bRemoved = pItems->RemoveChild( 1 );
+	ASSERT_TRUE( bRemoved );
+	ASSERT_EQ( 2.0f, (*pItems)[1].GetNumber() );
+	bRemoved = pItems->RemoveChild( (size_t) 0, false );
+	ASSERT_TRUE( bRemoved );
+	ASSERT_EQ( 3.0f, (*pItems)[(size_t) 0].GetNumber() );
+	bRemoved = pItems->RemoveChild( 5 );
+	ASSERT_FALSE( bRemoved );
+
+	JsonNode * pReplaced = pEdit->ReplaceChild( "items", (*pEdit)["items"] );
+	ASSERT_EQ( pEdit, pReplaced->GetParent() );
+	ASSERT_FALSE( strcmp( "items", pReplaced->GetName() ) );
+	ASSERT_EQ( 2, pReplaced->GetNbChildren() );
+	ASSERT_EQ( pReplaced, (*pReplaced)[1].GetParent() );
+
+	{
+		JsonDocument * pNested = JsonDocument::Parse( "{ 'a': { 'b': 1, 'c': 2 } }" );
+		JsonNode * pA = pNested->GetChild( "a" );
+		JsonNode * pB = pA->ReplaceChild( "b", *pA );
+		ASSERT_EQ( 2, pA->GetNbChildren() );
+		ASSERT_EQ( pB, pA->GetChild( "b" ) );
+		ASSERT_EQ( 1.0f, (*pB)["b"].GetNumber() );
+		ASSERT_EQ( 2.0f, (*pB)["c"].GetNumber() );
+		ASSERT_EQ( 2.0f, (*pA)["c"].GetNumber() );
+		delete pNested;
+	}
+
+	JsonNode * pStats = pEdit->InsertAt( 1, "stats", JsonNodeType_Object );
+	pStats->AddNumber( "hp", 10.0f );
+	ASSERT_FALSE( strcmp( "stats", pEdit->GetChild( 1 )->GetName() ) );
+	bRemoved = pEdit->RemoveChild( "alive" );
+	ASSERT_TRUE( bRemoved );
+	bRemoved = pEdit->RemoveChild( "alive" );
+	ASSERT_FALSE( bRemoved );
+	ASSERT_EQ( 4, pEdit->GetNbChildren() );
+
+	// child arrays grow in the document storage
+	JsonNode * pMany = pEdit->AddArray( "many" );
+	for( int i=0; i<1000; ++i )
+		pMany->AddNumber( NULL, (float) i );
+	ASSERT_EQ( 1000, pMany->GetNbChildren() );
+	ASSERT_EQ( 999.0f, (*pMany)[999].GetNumber() );
+	ASSERT_EQ( pMany, (*pMany)[500].GetParent() );
+	ASSERT_TRUE( (*pMany)[999].IsLastChild() );
+	ASSERT_EQ( 1000, pMany->end() - pMany->begin() );
+
+	pName->SetString( "a name much too long to fit inline" );
+	pName->SetString( "tiny" );
+	ASSERT_EQ( 4, (*pEdit)["name"].GetStringLength() );
+	ASSERT_FALSE( strcmp( "tiny", (*pEdit)["name"].GetString() ) );
+	delete pEdit;
+
+	// frozen documents are shared through reference counted handles
+	JsonDocumentRef shared( pDoc5 );
+	ASSERT_TRUE( pDoc5->IsFrozen() );
+	{
+		JsonDocumentRef copy = shared;
+		ASSERT_EQ( shared.Get(), copy.Get() );
+		ASSERT_FALSE( memcmp( "example glossary", (*copy)["glossary"]["title"].GetString(), 16 ) );
+	}
+	ASSERT_TRUE( shared.IsValid() );
+	shared.Release();
+	ASSERT_FALSE( shared.IsValid() );
+
+	// byte identical inputs are parsed once, and documents compare regardless of layout
+	ASSERT_EQ( 0xEF46DB3751D8E999ULL, JsonHashContent( "", 0 ) );
+	ASSERT_EQ( 0x44BC2CF5AD770999ULL, JsonHashContent( "abc", 3 ) );
+	ASSERT_EQ( 0xA76190C3ACF08A1CULL, JsonHashContent( "0123456789abcdef0123456789abcdef0123456789", 42 ) );
+
+	JsonParseCache cache( 2 );
+	JsonDocumentRef cached = cache.Parse( text1 );
+	ASSERT_TRUE( cached.IsValid() );
+	ASSERT_TRUE( cached->IsFrozen() );
+	JsonDocumentRef reparsed = cache.Parse( text1 );
+	ASSERT_EQ( cached.Get(), reparsed.Get() );
+	cache.Parse( text2 );
+	reparsed = cache.Parse( text1, strlen( text1 ) );
+	ASSERT_EQ( cached.Get(), reparsed.Get() );
+	cache.Parse( text3 );
+	ASSERT_EQ( 2, cache.GetNbEntries() );
+	reparsed = cache.Parse( text1 );
+	ASSERT_EQ( cached.Get(), reparsed.Get() );
+	cache.Parse( text2 );
+	ASSERT_EQ( 4, cache.GetNbMisses() );
+	reparsed = cache.Parse( "{ 'broken': " );
+	ASSERT_FALSE( reparsed.IsValid() );
+	ASSERT_EQ( 3, cache.GetNbHits() );
+	ASSERT_EQ( 5, cache.GetNbMisses() );
+	cache.Clear();
+	ASSERT_EQ( 0, cache.GetNbEntries() );
+	ASSERT_TRUE( cached.IsValid() );
+
+	JsonDocumentRef layout1 = cache.Parse( "{ 'a': 1, 'b': [ true, 'x', { 'c': null, 'd': 2 } ] }" );
+	JsonDocumentRef layout2 = cache.Parse( "{'b':[true,'x',{'d':2,'c':null}],'a':1}" );
+	ASSERT_NE( layout1.Get(), layout2.Get() );
+	ASSERT_EQ( layout1->GetHash(), layout2->GetHash() );
+	ASSERT_TRUE( layout1->IsEqual( *layout2 ) );
+	ASSERT_FALSE( (*layout1)["b"].IsEqual( (*layout2)["a"] ) );
+
+#if MINJA_THREADS
+	{
+		class CountingListener : public JsonParserPool::Listener
+		{
+		public:
+			JsonParserPool * m_pPool;
+			std::mutex m_Mutex;
+			int m_NbOK;
+			int m_NbFailed;
+
+			virtual void OnParsed( const char * _pBuffer, JsonDocument * _pDoc, void * _pUserData )
+			{
+				std::unique_lock<std::mutex> lock( m_Mutex );
+				_pDoc ? ++m_NbOK : ++m_NbFailed;
+				m_pPool->Release( _pDoc );
+			}
+		};
+
+		// a queue much smaller than the batch exercises the backpressure path
+		JsonParserPool pool( 4, 2 );
+
+		const char * buffers [] = { text1, text2, text3, text4, text1, text3, text4, text2 };
+		const size_t nbBuffers = sizeof(buffers) / sizeof(buffers[0]);
+		JsonDocument * docs [nbBuffers];
+
+		pool.ParseBatch( buffers, nbBuffers, docs );
+
+		ASSERT_EQ( 3, docs[0]->GetNbChildren() );
+		ASSERT_EQ( NULL, docs[1] );
+		ASSERT_FALSE( strcmp( "example glossary", (*docs[2])["glossary"]["title"].GetString() ) );
+		ASSERT_EQ( 33.0f, (*docs[6])["age"].GetNumber() );
+		ASSERT_EQ( NULL, docs[7] );
+
+		for( size_t d=0; d<nbBuffers; ++d )
+			pool.Release( docs[d] );
+
+		CountingListener listener;
+		listener.m_pPool = &pool;
+		listener.m_NbOK = 0;
+		listener.m_NbFailed = 0;
+
+		for( int r=0; r<25; ++r )
+			for( size_t b=0; b<nbBuffers; ++b )
+				pool.Submit( buffers[b], listener );
+
+		pool.WaitIdle();
+		ASSERT_EQ( 25 * 6, listener.m_NbOK );
+		ASSERT_EQ( 25 * 2, listener.m_NbFailed );
+	}
+
+	{
+		class CacheUser
+		{
+		public:
+			static void Run( JsonParseCache * _pCache, const char * const * _ppBuffers, size_t _NbBuffers )
+			{
+				for( int r=0; r<50; ++r )
+					for( size_t b=0; b<_NbBuffers; ++b )
+						_pCache->Parse( _ppBuffers[(b + r) % _NbBuffers] );
+			}
+		};
+
+		// more distinct inputs than entries keeps the eviction path busy on all threads
+		const char * buffers [] = { text1, text2, text3, text4, dupKeys, limited };
+		JsonParseCache sharedCache( 3 );
+		std::thread threads [4];
+		for( int t=0; t<4; ++t )
+			threads[t] = std::thread( &CacheUser::Run, &sharedCache, buffers, sizeof(buffers) / sizeof(buffers[0]) );
+		for( int t=0; t<4; ++t )
+			threads[t].join();
+
+		ASSERT_EQ( 3, sharedCache.GetNbEntries() );
+		ASSERT_EQ( 4 * 50 * 6, sharedCache.GetNbHits() + sharedCache.GetNbMisses() );
+	}
+#endif
+
+	// builders taking measured strings: borrowed ones are referenced, not copied
+	static const char s_Status [] = "all systems nominal";
+	std::string region( "eu-west-1" );
+	JsonDocument * pBuilt = JsonDocument::Create();
+	pBuilt->ReserveChildren( 4 );
+	JsonNode * const * ppBuiltChildren = pBuilt->begin();
+	JsonNode * pStatus = pBuilt->AddString( JsonStringRef::Borrow( "status", 6 ), JsonStringRef::Borrow( s_Status, sizeof(s_Status) - 1 ) );
+	ASSERT_EQ( s_Status, pStatus->GetString() );
+	ASSERT_FALSE( strcmp( "status", pStatus->GetName() ) );
+	pStatus->SetString( "all systems go" );
+	ASSERT_FALSE( strcmp( "all systems go", pStatus->GetString() ) );
+	ASSERT_FALSE( strcmp( "all systems nominal", s_Status ) );
+	JsonNode * pRegion = pBuilt->AddString( "region", region );
+	ASSERT_NE( region.data(), pRegion->GetString() );
+	ASSERT_EQ( region.size(), pRegion->GetStringLength() );
+	pBuilt->AddString( JsonStringRef( "codes", 4 ), JsonStringRef( "abcdef", 3 ) );
+	ASSERT_FALSE( strcmp( "abc", (*pBuilt)["code"].GetString() ) );
+
+	JsonNode * pBuiltItems = pBuilt->AddArray( std::string( "items" ), 100 );
+	JsonNode * const * ppBuiltItems = pBuiltItems->begin();
+	for( int i=0; i<100; ++i )
+		pBuiltItems->AddNumber( JsonStringRef(), (float) i );
+	ASSERT_EQ( ppBuiltItems, pBuiltItems->begin() );
+	ASSERT_EQ( ppBuiltChildren, pBuilt->begin() );
+	ASSERT_EQ( 99.0f, (*pBuilt)["items"][99].GetNumber() );
+
+#if MINJA_UNIQUE_PTR
+	// whole documents are moved under a node with their storage
+	std::unique_ptr<JsonDocument> pMoved( JsonDocument::Parse( text4 ) );
+	JsonNode * pMovedNode = pBuilt->AttachDocument( "person", std::move( pMoved ) );
+	ASSERT_TRUE( pMoved.get() == NULL );
+	ASSERT_EQ( pBuilt, pMovedNode->GetParent() );
+	ASSERT_EQ( pMovedNode, (*pMovedNode)["age"].GetParent() );
+	ASSERT_EQ( 33.0f, (*pBuilt)["person"]["age"].GetNumber() );
+	pBuilt->AddString( "after", "the move" );
+	ASSERT_EQ( 33.0f, (*pBuilt)["person"]["age"].GetNumber() );
+
+	// strings borrowed by a grafted document are not overwritten either
+	char borrowedText [] = "{ 'motto': 'borrowed, not owned' }";
+	std::unique_ptr<JsonDocument> pBorrowing( JsonDocument::Parse( borrowedText, JsonParseMode_BorrowBuffer ) );
+	JsonNode * pGrafted = pBuilt->AttachDocument( "quote", std::move( pBorrowing ) );
+	pGrafted->GetChild( "motto" )->SetString( "now owned" );
+	ASSERT_FALSE( strcmp( "now owned", (*pGrafted)["motto"].GetString() ) );
+	ASSERT_FALSE( strcmp( "{ 'motto': 'borrowed, not owned' }", borrowedText ) );
+
+	pBuilt->SetOptions( JsonTokenizer::Option_RejectDuplicateKeys );
+	std::unique_ptr<JsonDocument> pRefused( JsonDocument::Parse( text4 ) );
+	pAdded = pBuilt->AttachDocument( "person", std::move( pRefused ) );
+	ASSERT_TRUE( pAdded == NULL );
+	ASSERT_TRUE( pRefused.get() != NULL );
+#endif
+	delete pBuilt;
+
+	// compact text, written in one go or cut into parts written on several threads
+	std::string compact;
+	JsonDocument * pSmall = JsonDocument::Parse( "{ 'a': [ 1, 2.5, true, null ], 'e': 'x\\\"y' }", JsonParseMode_Copy, JsonTokenizer::Option_PackNumbers );
+	pSmall->AddString( "q", "say \"hi\"" );
+	JsonWriteNode( *pSmall, compact );
+	ASSERT_FALSE( strcmp( "{\"a\":[1,2.5,true,null],\"e\":\"x\\\"y\",\"q\":\"say \\\"hi\\\"\"}", compact.c_str() ) );
+	delete pSmall;
+
+	// builder strings are escaped so that the text parses back, and writes again the same
+	pSmall = JsonDocument::Create();
+	pSmall->AddString( "path", "C:\\dir\\" );
+	pSmall->AddString( "lines", "a\nb\tc\x01" );
+	pSmall->AddString( "u", "\\u00e9 \\u12" );
+	compact.clear();
+	JsonWriteNode( *pSmall, compact );
+	ASSERT_FALSE( strcmp( "{\"path\":\"C:\\\\dir\\\\\",\"lines\":\"a\\nb\\tc\\u0001\",\"u\":\"\\u00e9 \\\\u12\"}", compact.c_str() ) );
+	ASSERT_TRUE( JsonValidate( compact.c_str(), compact.size() ).IsValid() );
+	delete pSmall;
+	pSmall = JsonDocument::Parse( compact.c_str() );
+	ASSERT_TRUE( pSmall != NULL );
+	ASSERT_FALSE( strcmp( "C:\\\\dir\\\\", (*pSmall)["path"].GetString() ) );
+	std::string rewritten;
+	JsonWriteNode( *pSmall, rewritten );
+	ASSERT_TRUE( compact == rewritten );
+	delete pSmall;
+
+	JsonDocument * pLarge = JsonDocument::Create();
+	pLarge->AddObject( "meta" )->AddString( "name", "export" );
+	JsonNode * pLargeRows = pLarge->AddArray( "rows", 5000 );
+	for( int i=0; i<5000; ++i )
+	{
+		JsonNode * pLargeRow = pLargeRows->AddObject( JsonStringRef(), 3 );
+		pLargeRow->AddNumber( "id", (float) i );
+		pLargeRow->AddString( "name", i % 2 ? "odd" : "even" );
+		pLargeRow->AddArray( "tags" )->AddBool( NULL, i % 3 == 0 );
+	}
+	std::vector<float> largeNumbers( 20000, 0.25f );
+	pLarge->AddNumbers( "values", &largeNumbers[0], largeNumbers.size() );
+	pLarge->AddString( "end", "done" );
+
+	std::string serial;
+	JsonWriteNode( *pLarge, serial );
+	JsonParallelWriter writer( 4, 4096 );
+	std::string parallel;
+	writer.Write( *pLarge, parallel );
+	ASSERT_TRUE( writer.GetNbParts() > 8 );
+	ASSERT_TRUE( serial == parallel );
+	ASSERT_TRUE( (*pLarge)["values"].IsPacked() );
+
+	const std::vector<JsonParallelWriter::Chunk> & chunks = writer.WriteChunks( *pLarge );
+	std::string gathered;
+	for( size_t c=0; c<chunks.size(); ++c )
+		gathered.append( chunks[c].pData, chunks[c].Length );
+	ASSERT_TRUE( serial == gathered );
+
+	JsonDocument * pWritten = JsonDocument::Parse( parallel.c_str() );
+	ASSERT_TRUE( pWritten != NULL );
+	ASSERT_TRUE( pWritten->IsEqual( *pLarge ) );
+	delete pWritten;
+	delete pLarge;
+
 	JsonDocument * pDoc2 = JsonDocument::Create();
 	
 	pDoc2->AddString( "first_name", "Marc" );
@@ -1,5 +1,24 @@
 #include "minja.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+
+#if MINJA_SIMD_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MINJA_ATOMIC_INCREMENT( var )	_InterlockedIncrement( &(var) )
+#define MINJA_ATOMIC_DECREMENT( var )	_InterlockedDecrement( &(var) )
+#else
+#define MINJA_ATOMIC_INCREMENT( var )	__sync_add_and_fetch( &(var), 1 )
+#define MINJA_ATOMIC_DECREMENT( var )	__sync_sub_and_fetch( &(var), 1 )
+#endif
+
 
 namespace JsonTokenizer
 {
@@ -37,6 +56,177 @@ namespace JsonTokenizer
 	//------------------------------------------------------------------------------
 	//------------------------------------------------------------------------------
 
+	// returns the first byte of the first invalid sequence, or NULL if the whole range is valid
+	static const unsigned char * FindInvalidUtf8( const unsigned char * _pCurr, const unsigned char * _pEnd )
+	{
+		while( _pCurr < _pEnd )
+		{
+			unsigned char c = *_pCurr;
+
+			// 0_______
+			if( c < 0x80 )
+			{
+				++_pCurr;
+				continue;
+			}
+
+			// 10______ is a lonely continuation, 1100000_ is an overlong 2 bytes sequence
+			if( c < 0xC2 )
+				return _pCurr;
+
+			size_t length = (c < 0xE0) ? 2 : (c < 0xF0) ? 3 : (c < 0xF5) ? 4 : 0;
+			if( length == 0 || (size_t)(_pEnd - _pCurr) < length )
+				return _pCurr;
+
+			for( size_t b=1; b<length; ++b )
+				if( (_pCurr[b] & 0xC0) != 0x80 )
+					return _pCurr;
+
+			// overlong 3 and 4 bytes sequences, UTF-16 surrogates and code points above U+10FFFF
+			if(    (c == 0xE0 && _pCurr[1] < 0xA0)
+				|| (c == 0xED && _pCurr[1] >= 0xA0)
+				|| (c == 0xF0 && _pCurr[1] < 0x90)
+				|| (c == 0xF4 && _pCurr[1] >= 0x90) )
+				return _pCurr;
+
+			_pCurr += length;
+		}
+
+		return NULL;
+	}
+
+#if MINJA_SIMD_SSSE3
+	// Lookup table validator (Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte").
+	// Each byte is classified from the high nibble of the previous byte, its low nibble and the high 
+	// nibble of the current byte. The 3 lookups are and-ed together, leaving a non zero bit for each error.
+	// Only tells whether the range is valid: the scalar version is used to locate the error.
+	static bool IsValidUtf8Ssse3( const unsigned char * _pCurr, const unsigned char * _pEnd )
+	{
+		enum
+		{
+			TooShort		= 1 << 0,	// 11______ 0_______ or 11______ 11______
+			TooLong			= 1 << 1,	// 0_______ 10______
+			Overlong3		= 1 << 2,	// 11100000 100_____
+			TooLarge		= 1 << 3,	// 11110100 1001____ and above
+			Surrogate		= 1 << 4,	// 11101101 101_____
+			Overlong2		= 1 << 5,	// 1100000_ 10______
+			TooLarge1000	= 1 << 6,	// 11110101 1000____ and above
+			Overlong4		= 1 << 6,	// 11110000 1000____
+			TwoConts		= 1 << 7,	// 10______ 10______
+			Carry			= TooShort | TooLong | TwoConts
+		};
+
+		const __m128i byte1HighTable = _mm_setr_epi8(
+			TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong,
+			(char) TwoConts, (char) TwoConts, (char) TwoConts, (char) TwoConts,
+			TooShort | Overlong2,
+			TooShort,
+			TooShort | Overlong3 | Surrogate,
+			TooShort | TooLarge | TooLarge1000 | Overlong4 );
+
+		const __m128i byte1LowTable = _mm_setr_epi8(
+			(char) (Carry | Overlong3 | Overlong2 | Overlong4),
+			(char) (Carry | Overlong2),
+			(char) Carry,
+			(char) Carry,
+			(char) (Carry | TooLarge),
+			(char) (Carry | TooLarge | TooLarge1000),
+			(char) (Carry | TooLarge | TooLarge1000),
+			(char) (Carry | TooLarge | TooLarge1000),
+			(char) (Carry | TooLarge | TooLarge1000),
+			(char) (Carry | TooLarge | TooLarge1000),
+			(char) (Carry | TooLarge | TooLarge1000),
+			(char) (Carry | TooLarge | TooLarge1000),
+			(char) (Carry | TooLarge | TooLarge1000),
+			(char) (Carry | TooLarge | TooLarge1000 | Surrogate),
+			(char) (Carry | TooLarge | TooLarge1000),
+			(char) (Carry | TooLarge | TooLarge1000) );
+
+		const __m128i byte2HighTable = _mm_setr_epi8(
+			TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort,
+			(char) (TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge1000 | Overlong4),
+			(char) (TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge),
+			(char) (TooLong | Overlong2 | TwoConts | Surrogate | TooLarge),
+			(char) (TooLong | Overlong2 | TwoConts | Surrogate | TooLarge),
+			TooShort, TooShort, TooShort, TooShort );
+
+		// a block ending with any of these still expects continuation bytes in the next block
+		const __m128i incompleteMax = _mm_setr_epi8( -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char) (0xF0-1), (char) (0xE0-1), (char) (0xC0-1) );
+		const __m128i lowNibble = _mm_set1_epi8( 0x0F );
+
+		__m128i prevInput = _mm_setzero_si128();
+		__m128i prevIncomplete = _mm_setzero_si128();
+		__m128i error = _mm_setzero_si128();
+
+		while( _pCurr < _pEnd )
+		{
+			__m128i input;
+			if( _pEnd - _pCurr >= 16 )
+			{
+				input = _mm_loadu_si128( (const __m128i *) _pCurr );
+			}
+			else
+			{
+				// pad the tail with ASCII so that truncated sequences show up as TooShort
+				unsigned char tail[16] = { 0 };
+				memcpy( tail, _pCurr, _pEnd - _pCurr );
+				input = _mm_loadu_si128( (const __m128i *) tail );
+			}
+			_pCurr += 16;
+
+			if( _mm_movemask_epi8( input ) == 0 )
+			{
+				// pure ASCII block: only an unfinished sequence from the previous block can be wrong
+				error = _mm_or_si128( error, prevIncomplete );
+			}
+			else
+			{
+				__m128i prev1 = _mm_alignr_epi8( input, prevInput, 15 );
+				__m128i byte1High = _mm_shuffle_epi8( byte1HighTable, _mm_and_si128( _mm_srli_epi16( prev1, 4 ), lowNibble ) );
+				__m128i byte1Low = _mm_shuffle_epi8( byte1LowTable, _mm_and_si128( prev1, lowNibble ) );
+				__m128i byte2High = _mm_shuffle_epi8( byte2HighTable, _mm_and_si128( _mm_srli_epi16( input, 4 ), lowNibble ) );
+				__m128i specialCases = _mm_and_si128( byte1High, _mm_and_si128( byte1Low, byte2High ) );
+
+				// 3rd and 4th bytes of a sequence must be continuations, which is what TwoConts flagged
+				__m128i prev2 = _mm_alignr_epi8( input, prevInput, 14 );
+				__m128i prev3 = _mm_alignr_epi8( input, prevInput, 13 );
+				__m128i isThirdByte = _mm_subs_epu8( prev2, _mm_set1_epi8( (char) (0xE0-0x80) ) );
+				__m128i isFourthByte = _mm_subs_epu8( prev3, _mm_set1_epi8( (char) (0xF0-0x80) ) );
+				__m128i must23 = _mm_and_si128( _mm_or_si128( isThirdByte, isFourthByte ), _mm_set1_epi8( (char) 0x80 ) );
+
+				error = _mm_or_si128( error, _mm_xor_si128( must23, specialCases ) );
+				prevIncomplete = _mm_subs_epu8( input, incompleteMax );
+			}
+
+			prevInput = input;
+		}
+
+		error = _mm_or_si128( error, prevIncomplete );
+		return _mm_movemask_epi8( _mm_cmpeq_epi8( error, _mm_setzero_si128() ) ) == 0xFFFF;
+	}
+#endif
+
+	bool ValidateUtf8( const char * _pBegin, const char * _pEnd, const char ** _ppError )
+	{
+		const unsigned char * pBegin = (const unsigned char *) _pBegin;
+		const unsigned char * pEnd = (const unsigned char *) _pEnd;
+
+#if MINJA_SIMD_SSSE3
+		if( IsValidUtf8Ssse3( pBegin, pEnd ) )
+			return true;
+#endif
+
+		const unsigned char * pError = FindInvalidUtf8( pBegin, pEnd );
+		if( _ppError )
+			*_ppError = (const char *) pError;
+
+		return pError == NULL;
+	}
+
+	//------------------------------------------------------------------------------
+	//------------------------------------------------------------------------------
+	//------------------------------------------------------------------------------
+
 	ParseResult ReadNumber( TokenProcessor & _Ctx,  const char * _pCurr, const char ** _ppEnd )
 	{
 		const char * pStart = _pCurr;
@@ -45,7 +235,7 @@ namespace JsonTokenizer
 		if( (*_pCurr < '0' || *_pCurr > '9') && *_pCurr != '-' && *_pCurr != '+' )
 		{ 										
 			*_ppEnd = _pCurr; 					
-			_Ctx.OnError(pStart, *_ppEnd, "Number must start with [0-9+-]"); 		
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "Number must start with [0-9+-]", JsonValidateError_BadNumber); 		
 			return ParseError;					
 		}
 
@@ -64,7 +254,7 @@ namespace JsonTokenizer
 			if( (*_pCurr < '0' || *_pCurr > '9') )
 			{
 				*_ppEnd = _pCurr;
-				_Ctx.OnError(pStart, *_ppEnd, "Dot in numbers must be followed by one digit at least");
+				_Ctx.OnSyntaxError(pStart, *_ppEnd, "Dot in numbers must be followed by one digit at least", JsonValidateError_BadNumber);
 				return ParseError;
 			}
 
@@ -81,7 +271,7 @@ namespace JsonTokenizer
 			if( (*_pCurr < '0' || *_pCurr > '9') && *_pCurr != '-' && *_pCurr != '+' )
 			{
 				*_ppEnd = _pCurr;
-				_Ctx.OnError(pStart, *_ppEnd, "exponent in numbers must be followed by [0-9+-]");
+				_Ctx.OnSyntaxError(pStart, *_ppEnd, "exponent in numbers must be followed by [0-9+-]", JsonValidateError_BadNumber);
 				return ParseError;
 			}
 
@@ -143,7 +333,7 @@ namespace JsonTokenizer
 		// something invalid starting with [tTfFnN] was detected
 		{
 			*_ppEnd = _pCurr;
-			_Ctx.OnError(pStart, *_ppEnd, "Syntax error. Was expecting null, true of false");
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "Syntax error. Was expecting null, true of false", JsonValidateError_ExpectedValue);
 			return ParseError;
 		}
 	}
@@ -156,13 +346,17 @@ namespace JsonTokenizer
 		if( !IsStringDelimiter(*_pCurr) )
 		{
 			*_ppEnd = _pCurr;
-			_Ctx.OnError(pStart, *_ppEnd, "String must start with a \" or a '");
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "String must start with a \" or a '", JsonValidateError_ExpectedKey);
 			return ParseError;
 		}
 
+		// or-ing every byte costs next to nothing and lets pure ASCII strings skip UTF-8 validation
+		unsigned char highBits = 0;
+
 		do
 		{
 			++_pCurr;
+			highBits |= (unsigned char) *_pCurr;
 
 			// special characters are despecialized with a '\'
 			if( *_pCurr == '\\' )
@@ -173,7 +367,7 @@ namespace JsonTokenizer
 				if( !IsOneOf( *_pCurr, "\"\\/bfnrtu" ) )
 				{
 					*_ppEnd = _pCurr;
-					_Ctx.OnError(pStart, *_ppEnd, "Unknown special character");
+					_Ctx.OnSyntaxError(pStart, *_ppEnd, "Unknown special character", JsonValidateError_BadEscape);
 					return ParseError;
 				}
 			}
@@ -182,6 +376,14 @@ namespace JsonTokenizer
 				// found a matching closing string delimiter
 				if( IsStringDelimiter(*_pCurr) )
 				{
+					const char * pError;
+					if( (highBits & 0x80) && (_Ctx.GetOptions() & Option_ValidateUtf8) && !ValidateUtf8( pStart + 1, _pCurr, &pError ) )
+					{
+						*_ppEnd = pError;
+						_Ctx.OnSyntaxError(pStart, *_ppEnd, "Invalid UTF-8 sequence in string", JsonValidateError_InvalidUtf8);
+						return ParseError;
+					}
+
 					*_ppEnd = ++_pCurr;
 
 					_Ctx.OnString( pStart, *_ppEnd );
@@ -193,22 +395,44 @@ namespace JsonTokenizer
 
 		{
 			*_ppEnd = _pCurr;
-			_Ctx.OnError(pStart, *_ppEnd, "Reach the end while parsing String");
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "Reach the end while parsing String", JsonValidateError_UnterminatedString);
 			return ParseError;
 		}
 	}
 
+	// counts one level of nesting on the processor while an object or an array is read
+	class DepthScope
+	{
+		TokenProcessor & m_Ctx;
+
+	public:
+		explicit DepthScope( TokenProcessor & _Ctx ) : m_Ctx( _Ctx )	{ m_Ctx.EnterContainer(); }
+		~DepthScope()													{ m_Ctx.LeaveContainer(); }
+
+	private:
+		DepthScope & operator = ( const DepthScope & );
+	};
+
 	ParseResult ReadArray( TokenProcessor & _Ctx,  const char * _pCurr, const char ** _ppEnd )
 	{
 		const char * pStart = _pCurr;
 
+		// checked before any callback, so that hostile nesting can't exhaust the stack
+		DepthScope depth( _Ctx );
+		if( _Ctx.IsTooDeep() )
+		{
+			*_ppEnd = _pCurr;
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "Too deeply nested", JsonValidateError_TooDeep);
+			return ParseError;
+		}
+
 		_Ctx.OnBeginArray( _pCurr );
 
 		// always starts with an open bracket
 		if( *_pCurr != '[' )
 		{
 			*_ppEnd = _pCurr;
-			_Ctx.OnError(pStart, *_ppEnd, "Arrays must start with a [");
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "Arrays must start with a [", JsonValidateError_BadRoot);
 			return ParseError;
 		}
 
@@ -244,7 +468,7 @@ namespace JsonTokenizer
 		if( *_pCurr != ']' )
 		{
 			*_ppEnd = _pCurr;
-			_Ctx.OnError(pStart, *_ppEnd, "Arrays must end with a ]");
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "Arrays must end with a ]", result == ParseOK ? JsonValidateError_ExpectedArrayEnd : JsonValidateError_ExpectedValue);
 			return ParseError;
 		}
 
@@ -258,6 +482,13 @@ namespace JsonTokenizer
 	{
 		_pCurr = SkipWhitespaces( _pCurr );
 
+		// the processor already reported why it stopped
+		if( _Ctx.IsStopped() )
+		{
+			*_ppEnd = _pCurr;
+			return ParseError;
+		}
+
 		if( IsStringDelimiter(*_pCurr) )
 			return ReadString( _Ctx, _pCurr, _ppEnd );
 
@@ -301,7 +532,7 @@ namespace JsonTokenizer
 		if( *_pCurr != ':' )
 		{
 			*_ppEnd = _pCurr;
-			_Ctx.OnError(pStart, *_ppEnd, "Key and value must be separated by a : in a pair");
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "Key and value must be separated by a : in a pair", JsonValidateError_ExpectedColon);
 			return ParseError;
 		}
 
@@ -311,7 +542,10 @@ namespace JsonTokenizer
 		result = ReadValue( _Ctx, _pCurr, &pItemEnd );
 		if( result != ParseOK )
 		{
-			return result;
+			*_ppEnd = pItemEnd;
+			if( result == ParseNoMatch )
+				_Ctx.OnSyntaxError(pStart, *_ppEnd, "A pair must have a value", JsonValidateError_ExpectedValue);
+			return ParseError;
 		}
 
 		_pCurr = pItemEnd;
@@ -326,13 +560,21 @@ namespace JsonTokenizer
 	{
 		const char * pStart = _pCurr;
 
+		DepthScope depth( _Ctx );
+		if( _Ctx.IsTooDeep() )
+		{
+			*_ppEnd = _pCurr;
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "Too deeply nested", JsonValidateError_TooDeep);
+			return ParseError;
+		}
+
 		_Ctx.OnBeginObject( _pCurr );
 
 		// an object always starts with an open curly brace
 		if( *_pCurr != '{' )
 		{
 			*_ppEnd = _pCurr;
-			_Ctx.OnError(pStart, *_ppEnd, "Object must start with a {");
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "Object must start with a {", JsonValidateError_BadRoot);
 			return ParseError;
 		}
 
@@ -372,7 +614,7 @@ namespace JsonTokenizer
 		if( *_pCurr != '}' )
 		{
 			*_ppEnd = _pCurr;
-			_Ctx.OnError(pStart, *_ppEnd, "Object must end with a }");
+			_Ctx.OnSyntaxError(pStart, *_ppEnd, "Object must end with a }", JsonValidateError_ExpectedObjectEnd);
 			return ParseError;
 		}
 
@@ -385,480 +627,5688 @@ namespace JsonTokenizer
 
 } //namespace JsonTokenizer
 
-
-//------------------------------------------------------------------------------
-//------------------------------------------------------------------------------
-//------------------------------------------------------------------------------
-
-class JsonDummyNode : public JsonNode
-{
-public:
-	virtual bool IsValid() const										{ return false; }
-	virtual bool GetBool() const										{ return false; }
-	virtual float GetNumber() const										{ return 0.0f; }
-	virtual const char * GetString() const								{ return "! invalid Json node"; }
-	virtual bool IsLastChild() const									{ return true; }	
-	virtual const JsonNode & operator [] ( size_t _Index ) const		{ return * this; }
-	virtual const JsonNode & operator [] ( const char * _pName ) const	{ return * this; }
-
-};
-
-JsonDummyNode s_JsonDummyNode;
-
-
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 
-JsonNode::JsonNode()
-	: m_Type(JsonNodeType_Unknown)
-	, m_pParent(NULL)
-	, m_pName(NULL)
+static JsonValidateResult MakeValidateResult( const char * _pBuffer, const char * _pError, JsonValidateError _Error )
 {
+	JsonValidateResult result;
+	result.Error = _Error;
+	result.Offset = _pError - _pBuffer;
+	return result;
 }
 
-JsonNode::~JsonNode()
+// returns the closing delimiter, or NULL on error with *_ppError set
+static inline const char * ScanString( const char * _pCurr, const char * _pEnd, unsigned int _Options, const char ** _ppError, JsonValidateError * _pError )
 {
-	if( m_Type == JsonNodeType_Object && m_Value.Children != NULL )
+	const char * pStart = _pCurr++;
+	unsigned char highBits = 0;
+
+	for( ;; )
 	{
-		for( size_t c=0; c<m_Value.Children->size(); ++c )
-			delete (*m_Value.Children)[c];
+#if MINJA_SIMD_SSSE3
+		// 16 bytes at a time until something other than plain characters shows up
+		while( _pCurr + 16 <= _pEnd )
+		{
+			__m128i chunk = _mm_loadu_si128( (const __m128i *) _pCurr );
+			__m128i special = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( chunk, _mm_set1_epi8( '"' ) ), _mm_cmpeq_epi8( chunk, _mm_set1_epi8( '\'' ) ) ),
+											_mm_or_si128( _mm_cmpeq_epi8( chunk, _mm_set1_epi8( '\\' ) ), _mm_cmpeq_epi8( chunk, _mm_setzero_si128() ) ) );
+			if( _mm_movemask_epi8( special ) )
+				break;
 
-		delete m_Value.Children;
-	}
+			highBits |= (unsigned char) (_mm_movemask_epi8( chunk ) ? 0x80 : 0);
+			_pCurr += 16;
+		}
+#endif
+		if( _pCurr >= _pEnd || *_pCurr == 0 )
+		{
+			*_ppError = _pCurr;
+			*_pError = JsonValidateError_UnterminatedString;
+			return NULL;
+		}
 
-	if( m_Type == JsonNodeType_Array && m_Value.Items != NULL )
-	{
-		for( size_t c=0; c<m_Value.Children->size(); ++c )
-			delete (*m_Value.Children)[c];
+		char c = *_pCurr;
+		highBits |= (unsigned char) c;
 
-		delete m_Value.Children;
+		if( c == '\\' )
+		{
+			// the only special characters supported are ["\/bfnrtu], like in ReadString
+			if( _pCurr + 1 >= _pEnd || !JsonTokenizer::IsOneOf( _pCurr[1], "\"\\/bfnrtu" ) )
+			{
+				*_ppError = _pCurr + 1;
+				*_pError = JsonValidateError_BadEscape;
+				return NULL;
+			}
+			_pCurr += 2;
+		}
+		else if( c == '"' || c == '\'' )
+		{
+			if( (highBits & 0x80) && (_Options & JsonTokenizer::Option_ValidateUtf8) && !JsonTokenizer::ValidateUtf8( pStart + 1, _pCurr, _ppError ) )
+			{
+				*_pError = JsonValidateError_InvalidUtf8;
+				return NULL;
+			}
+			return _pCurr;
+		}
+		else
+			++_pCurr;
 	}
 }
 
-JsonNodeType JsonNode::GetType() const
-{
-	return m_Type;
-}
-
-JsonNode * JsonNode::GetParent() const
+static inline bool MatchKeyword( const char * _pCurr, const char * _pEnd, const char * _pKeyword, size_t _Len )
 {
-	return m_pParent;
-}
+	if( (size_t) (_pEnd - _pCurr) < _Len )
+		return false;
 
-const char * JsonNode::GetName() const
-{
-	return m_pName;
-}
+	// keywords are case insensitive, like in ReadKeyword
+	for( size_t i=0; i<_Len; ++i )
+		if( (_pCurr[i] | 0x20) != _pKeyword[i] )
+			return false;
 
-bool JsonNode::IsValid() const 
-{ 
 	return true;
 }
 
-bool JsonNode::GetBool() const
+JsonValidateResult JsonValidate( const char * _pBuffer, size_t _Len, unsigned int _Options )
 {
-	ASSERT( m_Type == JsonNodeType_Bool, "Wrong node type. Not a bool" );
-	return m_Value.Bool;
-}
+	enum { MaxDepth = 1024 };
 
-float JsonNode::GetNumber() const
-{
-	ASSERT( m_Type == JsonNodeType_Number, "Wrong node type. Not a number" );
-	return m_Value.Number;
-}
+	// one bit per open container, set for objects: no allocation whatever the input
+	unsigned int isObject[MaxDepth / 32];
+	size_t depth = 0;
 
-const char * JsonNode::GetString() const
-{
-	ASSERT( m_Type == JsonNodeType_String, "Wrong node type. Not a string" );
-	return m_Value.String;
-}
+	const char * pCurr = _pBuffer;
+	const char * pEnd = _pBuffer + _Len;
+	const char * pError;
+	JsonValidateError error;
 
-const size_t JsonNode::GetNbChildren() const
-{
-	ASSERT( m_Type == JsonNodeType_Object, "Wrong node type. Not an Object" );
-	return m_Value.Children->size();
-}
+#define MINJA_SKIP_WHITESPACES()	while( pCurr < pEnd && (*pCurr == ' ' || *pCurr == '\t' || *pCurr == '\n') ) ++pCurr
+#define MINJA_PEEK()				(pCurr < pEnd ? *pCurr : 0)
+#define MINJA_FAIL( _Error )		return MakeValidateResult( _pBuffer, pCurr, _Error )
 
-const JsonNode * JsonNode::GetChild( const char * _pName ) const
-{
-	ASSERT( m_Type == JsonNodeType_Object, "Wrong node type. Not an Object" );
+	MINJA_SKIP_WHITESPACES();
+	if( MINJA_PEEK() != '{' && MINJA_PEEK() != '[' )
+		MINJA_FAIL( JsonValidateError_BadRoot );
 
-	NodeVector::const_iterator iter = m_Value.Children->begin();
-	NodeVector::const_iterator iend = m_Value.Children->end();
-	for( ; iter!=iend; ++iter )
-		if( !strcmp(_pName, (*iter)->m_pName ) )
-			return *iter;
+	for( ;; )
+	{
+		char c = MINJA_PEEK();
 
-	return NULL;
-}
+		// a value is expected here
+		if( c == '{' || c == '[' )
+		{
+			if( depth == MaxDepth )
+				MINJA_FAIL( JsonValidateError_TooDeep );
 
-const JsonNode * JsonNode::GetChild( size_t _Index ) const
-{
-	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
-	ASSERT( _Index < m_Value.Children->size(), "Index out of bounds" );
+			if( c == '{' )
+				isObject[depth / 32] |= 1u << (depth % 32);
+			else
+				isObject[depth / 32] &= ~(1u << (depth % 32));
+			++depth;
 
-	return (*m_Value.Items)[_Index ];
-}
+			++pCurr;
+			MINJA_SKIP_WHITESPACES();
 
-const JsonNode::NodeVector & JsonNode::GetChildren() const
-{
-	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
-	return (*m_Value.Children);
-}
+			if( c == '{' && MINJA_PEEK() != '}' )
+				goto ReadKey;
+			if( c == '[' && MINJA_PEEK() != ']' )
+				continue;
+		}
+		else if( c == '"' || c == '\'' )
+		{
+			pCurr = ScanString( pCurr, pEnd, _Options, &pError, &error );
+			if( pCurr == NULL )
+				return MakeValidateResult( _pBuffer, pError, error );
+			++pCurr;
+		}
+		else if( (c >= '0' && c <= '9') || c == '-' || c == '+' )
+		{
+			// same rules as ReadNumber: [0-9+-][0-9]*(.[0-9]+)?([eE][0-9+-][0-9]*)?
+			++pCurr;
+			while( pCurr < pEnd && *pCurr >= '0' && *pCurr <= '9' )
+				++pCurr;
 
-bool JsonNode::IsLastChild() const
-{
-	return (m_pParent == NULL) || (*(--(m_pParent->end())) == this);
-}
+			if( MINJA_PEEK() == '.' )
+			{
+				++pCurr;
+				if( MINJA_PEEK() < '0' || MINJA_PEEK() > '9' )
+					MINJA_FAIL( JsonValidateError_BadNumber );
+				while( pCurr < pEnd && *pCurr >= '0' && *pCurr <= '9' )
+					++pCurr;
+			}
 
-JsonNode::iterator JsonNode::begin()
-{
-	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
-	return m_Value.Children->begin();
-}
+			if( MINJA_PEEK() == 'e' || MINJA_PEEK() == 'E' )
+			{
+				++pCurr;
+				c = MINJA_PEEK();
+				if( (c < '0' || c > '9') && c != '-' && c != '+' )
+					MINJA_FAIL( JsonValidateError_BadNumber );
+				++pCurr;
+				while( pCurr < pEnd && *pCurr >= '0' && *pCurr <= '9' )
+					++pCurr;
+			}
+		}
+		else if( MatchKeyword( pCurr, pEnd, "null", 4 ) || MatchKeyword( pCurr, pEnd, "true", 4 ) )
+		{
+			pCurr += 4;
+		}
+		else if( MatchKeyword( pCurr, pEnd, "false", 5 ) )
+		{
+			pCurr += 5;
+		}
+		else if( !(c == ']' && depth > 0 && !(isObject[(depth-1) / 32] & (1u << ((depth-1) % 32)))) )
+		{
+			// ReadArray tolerates a trailing comma, so only a closing bracket may stand for a value
+			MINJA_FAIL( JsonValidateError_ExpectedValue );
+		}
 
-JsonNode::const_iterator JsonNode::begin() const
-{
-	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
-	return m_Value.Children->begin();
-}
+		// after a value: a separator, the end of the container or the end of the input
+		for( ;; )
+		{
+			MINJA_SKIP_WHITESPACES();
+			if( depth == 0 )
+			{
+				if( pCurr != pEnd )
+					MINJA_FAIL( JsonValidateError_TrailingCharacters );
 
-JsonNode::iterator JsonNode::end()
-{
-	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
-	return m_Value.Children->end();
-}
+				JsonValidateResult result = { JsonValidateError_None, _Len };
+				return result;
+			}
 
-JsonNode::const_iterator JsonNode::end() const
-{
-	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
-	return m_Value.Children->end();
-}
+			bool bObject = (isObject[(depth-1) / 32] & (1u << ((depth-1) % 32))) != 0;
+			c = MINJA_PEEK();
 
-const JsonNode & JsonNode::operator [] ( size_t _Index ) const
-{
-	const JsonNode * pRet = GetChild( _Index );
-	return pRet ? *pRet : s_JsonDummyNode;
-}
+			if( c == (bObject ? '}' : ']') )
+			{
+				++pCurr;
+				--depth;
+				continue;
+			}
 
-const JsonNode & JsonNode::operator [] ( const char * _pName ) const
-{
-	const JsonNode * pRet = GetChild( _pName );
-	return pRet ? *pRet : s_JsonDummyNode;
-}
+			if( c != ',' )
+				MINJA_FAIL( bObject ? JsonValidateError_ExpectedObjectEnd : JsonValidateError_ExpectedArrayEnd );
 
-JsonNode * JsonNode::CreateNode( const char * _pName, JsonNodeType _Type )
-{
-	JsonNode * pNode = new JsonNode();
-	ASSERT( pNode, "Could not create a new node" );
+			++pCurr;
+			MINJA_SKIP_WHITESPACES();
 
-	pNode->m_pParent = this;
-	if( _pName )
-	{
-		size_t len = strlen(_pName);
-		pNode->m_pName = new char [len + 1];
-		memcpy( pNode->m_pName, _pName, len );
-		pNode->m_pName[len] = 0;
-	}
+			// ReadObject tolerates a trailing comma too
+			if( bObject && MINJA_PEEK() == '}' )
+				continue;
+			break;
+		}
 
-	pNode->m_Type = _Type;
-	if( _Type == JsonNodeType_Array || _Type == JsonNodeType_Object )
-		pNode->m_Value.Children = new NodeVector;
+		if( !(isObject[(depth-1) / 32] & (1u << ((depth-1) % 32))) )
+			continue;
 
-	m_Value.Children->push_back( pNode );
+	ReadKey:
+		if( MINJA_PEEK() != '"' && MINJA_PEEK() != '\'' )
+			MINJA_FAIL( JsonValidateError_ExpectedKey );
 
-	return pNode;
-}
+		pCurr = ScanString( pCurr, pEnd, _Options, &pError, &error );
+		if( pCurr == NULL )
+			return MakeValidateResult( _pBuffer, pError, error );
+		++pCurr;
 
+		MINJA_SKIP_WHITESPACES();
+		if( MINJA_PEEK() != ':' )
+			MINJA_FAIL( JsonValidateError_ExpectedColon );
+		++pCurr;
+		MINJA_SKIP_WHITESPACES();
+	}
 
-JsonNode * JsonNode::AddNull( const char * _pName )
-{
-	ASSERT( (_pName && m_Type == JsonNodeType_Object) || (!_pName && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+#undef MINJA_SKIP_WHITESPACES
+#undef MINJA_PEEK
+#undef MINJA_FAIL
+}
 
-	JsonNode * pNode = CreateNode( _pName, JsonNodeType_Null );
 
-	pNode->m_Type = JsonNodeType_Null;
-	pNode->m_Value.String = NULL;
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
 
-	return pNode;
+JsonParseError::JsonParseError()
+	: Code( JsonParseError_None )
+	, Syntax( JsonValidateError_None )
+	, Offset( (size_t) -1 )
+	, Depth( 0 )
+	, pMessage( "" )
+{
 }
 
-JsonNode * JsonNode::AddBool( const char * _pName, bool _Value )
+const char * JsonParseError::GetExpected() const
 {
-	ASSERT( (_pName && m_Type == JsonNodeType_Object) || (!_pName && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+	switch( Syntax )
+	{
+	case JsonValidateError_BadRoot:				return "'{' or '['";
+	case JsonValidateError_ExpectedValue:		return "a value";
+	case JsonValidateError_ExpectedKey:			return "a key";
+	case JsonValidateError_ExpectedColon:		return "':'";
+	case JsonValidateError_ExpectedObjectEnd:	return "',' or '}'";
+	case JsonValidateError_ExpectedArrayEnd:	return "',' or ']'";
+	case JsonValidateError_BadNumber:			return "a digit";
+	case JsonValidateError_BadEscape:			return "an escape sequence";
+	case JsonValidateError_UnterminatedString:	return "a closing quote";
+	case JsonValidateError_InvalidUtf8:			return "valid UTF-8";
+	case JsonValidateError_TrailingCharacters:	return "the end of the input";
+	default:									return "";
+	}
+}
 
-	JsonNode * pNode = CreateNode( _pName, JsonNodeType_Bool );
+void JsonParseError::GetLineColumn( const char * _pInput, size_t * _pLine, size_t * _pColumn ) const
+{
+	if( Offset == (size_t) -1 )
+	{
+		*_pLine = *_pColumn = 0;
+		return;
+	}
 
-	pNode->m_Type = JsonNodeType_Bool;
-	pNode->m_Value.Bool = _Value;
+	// only paid for by callers who want it
+	size_t line = 1;
+	size_t lineStart = 0;
+	for( size_t i=0; i<Offset; ++i )
+	{
+		if( _pInput[i] == '\n' )
+		{
+			++line;
+			lineStart = i + 1;
+		}
+	}
 
-	return pNode;
+	*_pLine = line;
+	*_pColumn = Offset - lineStart + 1;
 }
 
-JsonNode * JsonNode::AddNumber( const char * _pName, float _Value )
+std::string JsonParseError::GetSnippet( const char * _pInput, size_t _MaxLength ) const
 {
-	ASSERT( (_pName && m_Type == JsonNodeType_Object) || (!_pName && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
-
-	JsonNode * pNode = CreateNode( _pName, JsonNodeType_Number );
-
-	pNode->m_Value.Number = _Value;
+	if( Offset == (size_t) -1 )
+		return std::string();
 
-	return pNode;
+	size_t len = Offset < _MaxLength ? Offset : _MaxLength;
+	return std::string( _pInput + Offset - len, len );
 }
 
-JsonNode * JsonNode::AddString( const char * _pName, const char * _pValue )
+std::string JsonParseError::Format( const char * _pInput ) const
 {
-	ASSERT( (_pName && m_Type == JsonNodeType_Object) || (!_pName && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
-	ASSERT( _pValue, "Cannot set a NULL string" );
+	if( Code == JsonParseError_None )
+		return std::string();
 
-	JsonNode * pNode = CreateNode( _pName, JsonNodeType_String );
+	char header[64];
+	std::string text;
+	if( Offset != (size_t) -1 )
+	{
+		size_t line, column;
+		GetLineColumn( _pInput, &line, &column );
+		sprintf( header, "Line %u, column %u: ", (unsigned int) line, (unsigned int) column );
+		text = header;
+	}
+
+	text += pMessage;
+	if( *GetExpected() )
+	{
+		text += ", expected ";
+		text += GetExpected();
+	}
 
-	size_t len = strlen(_pValue);
-	pNode->m_Value.String = new char [len + 1];
-	memcpy( pNode->m_Value.String, _pValue, len );
-	pNode->m_Value.String[len] = 0;
+	if( Offset != (size_t) -1 )
+	{
+		text += ". Location: ";
+		text += GetSnippet( _pInput );
+		text += "<-Here!";
+	}
 
-	return pNode;
+	return text;
 }
 
-JsonNode * JsonNode::AddString( const char * _pName, const char * _pBegin, size_t _Len )
-{
-	ASSERT( (_pName && m_Type == JsonNodeType_Object) || (!_pName && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
-	ASSERT( _pBegin, "Cannot set a NULL string" );
 
-	JsonNode * pNode = CreateNode( _pName, JsonNodeType_String );
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
 
-	pNode->m_Value.String = new char [_Len + 1];
-	memcpy( pNode->m_Value.String, _pBegin, _Len );
-	pNode->m_Value.String[_Len] = 0;
+// Cuts a streamed document into the children of its root: array items or object pairs.
+// Only strings and brackets are tracked; the children are left to the tokenizer.
+class JsonStreamFramer
+{
+	enum { InitialBufferSize = 64 * 1024 };
+
+	JsonInputStream & m_Stream;
+	std::vector<char> m_Buffer;
+	size_t m_Begin;				// start of the current child
+	size_t m_Scan;
+	size_t m_End;				// end of the data read so far, always followed by a 0
+	size_t m_Depth;
+	char m_RootClose;
+	bool m_bInString;
+	bool m_bEscape;
+	bool m_bDiscard;			// drops what was scanned on the next Fill, instead of carrying it over
+	size_t m_Consumed;			// bytes of input moved out of the buffer
 
-	return pNode;
-}
+public:
+	enum Result
+	{
+		Result_Error,
+		Result_Child,
+		Result_LastChild,		// followed by the end of the root
+	};
+
+	JsonStreamFramer( JsonInputStream & _Stream )
+		: m_Stream( _Stream )
+		, m_Buffer( InitialBufferSize )
+		, m_Begin( 0 )
+		, m_Scan( 0 )
+		, m_End( 0 )
+		, m_Depth( 0 )
+		, m_RootClose( 0 )
+		, m_bInString( false )
+		, m_bEscape( false )
+		, m_bDiscard( false )
+		, m_Consumed( 0 )
+	{
+		m_Buffer[0] = 0;
+	}
 
-JsonNode * JsonNode::AddArray( const char * _pName )
-{
-	ASSERT( (_pName && m_Type == JsonNodeType_Object) || (!_pName && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+	const char * GetPosition() const			{ return &m_Buffer[m_Scan < m_End ? m_Scan : m_End]; }
 
-	JsonNode * pNode = CreateNode( _pName, JsonNodeType_Array );
+	// the buffer moves as it fills: the base of the processor is updated after each call
+	void UpdateInputBase( JsonTokenizer::TokenProcessor & _Ctx ) const		{ _Ctx.SetInputBase( &m_Buffer[0], m_Consumed ); }
 
-	return pNode;
-}
+	// skips to the root and returns its opening character, or 0 if it is neither { nor [
+	char Begin()
+	{
+		for( ;; )
+		{
+			while( m_Scan < m_End && (m_Buffer[m_Scan] == ' ' || m_Buffer[m_Scan] == '\t' || m_Buffer[m_Scan] == '\n') )
+				++m_Scan;
 
-JsonNode * JsonNode::AddObject( const char * _pName )
-{
-	ASSERT( (_pName && m_Type == JsonNodeType_Object) || (!_pName && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+			if( m_Scan < m_End )
+				break;
 
-	JsonNode * pNode = CreateNode( _pName, JsonNodeType_Object );
+			if( !Fill() )
+				return 0;
+		}
 
-	return pNode;
-}
+		char root = m_Buffer[m_Scan];
+		if( root != '{' && root != '[' )
+			return 0;
+
+		m_RootClose = (root == '{') ? '}' : ']';
+		m_Depth = 1;
+		m_Begin = ++m_Scan;
+		return root;
+	}
+
+	// the child is returned null terminated, in place of its separator
+	Result Next( char ** _ppBegin, char ** _ppEnd )
+	{
+		for( ;; )
+		{
+			for( ; m_Scan < m_End; ++m_Scan )
+			{
+				char c = m_Buffer[m_Scan];
+
+				if( m_bInString )
+				{
+					// like ReadString, any delimiter closes a string
+					if( m_bEscape )
+						m_bEscape = false;
+					else if( c == '\\' )
+						m_bEscape = true;
+					else if( c == '"' || c == '\'' )
+						m_bInString = false;
+					continue;
+				}
+
+				if( c == '"' || c == '\'' )
+					m_bInString = true;
+				else if( c == '{' || c == '[' )
+					++m_Depth;
+				else if( c == '}' || c == ']' )
+				{
+					if( m_Depth == 1 )
+					{
+						if( c != m_RootClose )
+							return Result_Error;
+
+						return CutChild( _ppBegin, _ppEnd, Result_LastChild );
+					}
+					--m_Depth;
+				}
+				else if( c == ',' && m_Depth == 1 )
+					return CutChild( _ppBegin, _ppEnd, Result_Child );
+			}
+
+			if( !Fill() )
+				return Result_Error;
+		}
+	}
+
+	// inside an object root, skips to the value of _pKey and makes it the new root. Returns
+	// its opening character, or 0 if the key is missing or its value is not a container.
+	// The key is compared as is, escape sequences included.
+	char EnterKey( const char * _pKey, size_t _KeyLength )
+	{
+		// the values skipped on the way are not kept, however big they are
+		m_bDiscard = true;
+
+		for( ;; )
+		{
+			char c;
+			if( !SkipWhitespaces( c ) || c == m_RootClose )
+				break;
+
+			if( c == ',' )
+			{
+				++m_Scan;
+				continue;
+			}
+
+			if( c != '"' && c != '\'' )
+				break;
+
+			size_t k = 0;
+			bool bMatch = true;
+			bool bEscape = false;
+			for( ++m_Scan; ; ++m_Scan )
+			{
+				if( m_Scan == m_End && !Fill() )
+				{
+					m_bDiscard = false;
+					return 0;
+				}
+
+				c = m_Buffer[m_Scan];
+				if( !bEscape && (c == '"' || c == '\'') )
+					break;
+
+				bEscape = !bEscape && c == '\\';
+				bMatch = bMatch && k < _KeyLength && _pKey[k] == c;
+				++k;
+			}
+			++m_Scan;
+
+			if( !SkipWhitespaces( c ) || c != ':' )
+				break;
+			++m_Scan;
+
+			if( !SkipWhitespaces( c ) )
+				break;
+
+			if( bMatch && k == _KeyLength )
+			{
+				if( c != '{' && c != '[' )
+					break;
+
+				m_bDiscard = false;
+				m_RootClose = (c == '{') ? '}' : ']';
+				m_Depth = 1;
+				m_Begin = ++m_Scan;
+				return c;
+			}
+
+			char * pBegin;
+			char * pEnd;
+			if( Next( &pBegin, &pEnd ) != Result_Child )
+				break;
+		}
+
+		m_bDiscard = false;
+		return 0;
+	}
+
+protected:
+	bool SkipWhitespaces( char & _Curr )
+	{
+		for( ;; )
+		{
+			while( m_Scan < m_End && (m_Buffer[m_Scan] == ' ' || m_Buffer[m_Scan] == '\t' || m_Buffer[m_Scan] == '\n') )
+				++m_Scan;
+
+			if( m_Scan < m_End )
+			{
+				_Curr = m_Buffer[m_Scan];
+				return true;
+			}
+
+			if( !Fill() )
+				return false;
+		}
+	}
+
+	Result CutChild( char ** _ppBegin, char ** _ppEnd, Result _Result )
+	{
+		m_Buffer[m_Scan] = 0;
+		*_ppBegin = &m_Buffer[m_Begin];
+		*_ppEnd = &m_Buffer[m_Scan];
+		m_Begin = ++m_Scan;
+		return _Result;
+	}
+
+	bool Fill()
+	{
+		// the current child moves to the front, and the buffer only grows for children bigger than it
+		if( m_bDiscard )
+			m_Begin = m_Scan;
+
+		if( m_Begin > 0 )
+		{
+			m_Consumed += m_Begin;
+			memmove( &m_Buffer[0], &m_Buffer[m_Begin], m_End - m_Begin );
+			m_Scan -= m_Begin;
+			m_End -= m_Begin;
+			m_Begin = 0;
+		}
+
+		if( m_End + 1 == m_Buffer.size() )
+			m_Buffer.resize( m_Buffer.size() * 2 );
+
+		size_t size = m_Stream.Read( &m_Buffer[m_End], m_Buffer.size() - 1 - m_End );
+		m_End += size;
+		m_Buffer[m_End] = 0;
+
+		return size > 0;
+	}
+};
+
+bool JsonReadStream( JsonTokenizer::TokenProcessor & _Ctx, JsonInputStream & _Stream )
+{
+	JsonStreamFramer framer( _Stream );
+
+	char root = framer.Begin();
+	framer.UpdateInputBase( _Ctx );
+	if( root == 0 )
+	{
+		if( _Stream.HasFailed() )
+			_Ctx.OnError( framer.GetPosition(), framer.GetPosition(), "Read error" );
+		else
+			_Ctx.OnSyntaxError( framer.GetPosition(), framer.GetPosition(), "The root must be an Object or an Array", JsonValidateError_BadRoot );
+		return false;
+	}
+
+	// the root is read by the framer, not by ReadObject / ReadArray
+	JsonTokenizer::DepthScope depth( _Ctx );
+	if( _Ctx.IsTooDeep() )
+	{
+		_Ctx.OnSyntaxError( framer.GetPosition(), framer.GetPosition(), "Too deeply nested", JsonValidateError_TooDeep );
+		return false;
+	}
+
+	if( root == '{' )
+		_Ctx.OnBeginObject( framer.GetPosition() );
+	else
+		_Ctx.OnBeginArray( framer.GetPosition() );
+
+	for( ;; )
+	{
+		char * pBegin;
+		char * pEnd;
+		JsonStreamFramer::Result result = framer.Next( &pBegin, &pEnd );
+		framer.UpdateInputBase( _Ctx );
+		if( result == JsonStreamFramer::Result_Error )
+		{
+			if( _Stream.HasFailed() )
+				_Ctx.OnError( framer.GetPosition(), framer.GetPosition(), "Read error" );
+			else
+				_Ctx.OnSyntaxError( framer.GetPosition(), framer.GetPosition(), "Unterminated root", root == '{' ? JsonValidateError_ExpectedObjectEnd : JsonValidateError_ExpectedArrayEnd );
+			return false;
+		}
+
+		const char * pChild = JsonTokenizer::SkipWhitespaces( pBegin );
+		if( pChild == pEnd )
+		{
+			// only the last child may be empty: "[]", "{}" and a trailing comma, as in ReadArray / ReadObject
+			if( result == JsonStreamFramer::Result_LastChild )
+				break;
+
+			_Ctx.OnSyntaxError( pChild, pEnd, "Empty item before a ,", root == '{' ? JsonValidateError_ExpectedKey : JsonValidateError_ExpectedValue );
+			return false;
+		}
+
+		const char * pChildEnd;
+		JsonTokenizer::ParseResult parsed;
+		if( root == '{' )
+			parsed = JsonTokenizer::ReadPair( _Ctx, pChild, &pChildEnd );
+		else
+		{
+			_Ctx.OnNewArrayItem( pChild );
+			parsed = JsonTokenizer::ReadValue( _Ctx, pChild, &pChildEnd );
+		}
+
+		if( parsed != JsonTokenizer::ParseOK || JsonTokenizer::SkipWhitespaces( pChildEnd ) != pEnd )
+		{
+			if( parsed != JsonTokenizer::ParseError )
+				_Ctx.OnSyntaxError( pChild, JsonTokenizer::SkipWhitespaces( pChildEnd ), root == '{' ? "Object must end with a }" : "Arrays must end with a ]", root == '{' ? JsonValidateError_ExpectedObjectEnd : JsonValidateError_ExpectedArrayEnd );
+			return false;
+		}
+
+		if( result == JsonStreamFramer::Result_LastChild )
+			break;
+	}
+
+	if( root == '{' )
+		_Ctx.OnEndObject( framer.GetPosition() );
+	else
+		_Ctx.OnEndArray( framer.GetPosition() );
+
+	return true;
+}
+
+
+#if MINJA_ZLIB
+
+JsonInflateInputStream::JsonInflateInputStream( JsonInputStream & _Source, size_t _InputBufferSize )
+	: m_Source( _Source )
+	, m_Input( _InputBufferSize )
+	, m_bAtMemberEnd( false )
+	, m_bFailed( false )
+{
+	memset( &m_ZStream, 0, sizeof(m_ZStream) );
+
+	// 32 lets zlib detect gzip and zlib headers by itself
+	if( inflateInit2( &m_ZStream, 15 + 32 ) != Z_OK )
+		m_bFailed = true;
+}
+
+JsonInflateInputStream::~JsonInflateInputStream()
+{
+	inflateEnd( &m_ZStream );
+}
+
+size_t JsonInflateInputStream::Read( char * _pBuffer, size_t _Size )
+{
+	m_ZStream.next_out = (Bytef *) _pBuffer;
+	m_ZStream.avail_out = (uInt) _Size;
+
+	while( !m_bFailed && m_ZStream.avail_out == _Size )
+	{
+		if( m_ZStream.avail_in == 0 )
+		{
+			size_t size = m_Source.Read( &m_Input[0], m_Input.size() );
+
+			// the input may only run out between two members
+			if( size == 0 )
+			{
+				m_bFailed = !m_bAtMemberEnd || m_Source.HasFailed();
+				break;
+			}
+
+			m_ZStream.next_in = (Bytef *) &m_Input[0];
+			m_ZStream.avail_in = (uInt) size;
+		}
+
+		m_bAtMemberEnd = false;
+		int result = inflate( &m_ZStream, Z_NO_FLUSH );
+
+		if( result == Z_STREAM_END )
+		{
+			m_bAtMemberEnd = true;
+			inflateReset( &m_ZStream );
+		}
+		else if( result != Z_OK )
+			m_bFailed = true;
+	}
+
+	return _Size - m_ZStream.avail_out;
+}
+
+#endif //MINJA_ZLIB
+
+
+#if MINJA_THREADS
+
+JsonReadAheadStream::JsonReadAheadStream( JsonInputStream & _Source, size_t _ChunkSize, size_t _NbChunks )
+	: m_Source( _Source )
+	, m_Chunks( _NbChunks )
+	, m_Head( 0 )
+	, m_Tail( 0 )
+	, m_NbFilled( 0 )
+	, m_ReadOffset( 0 )
+	, m_bStopping( false )
+	, m_bFailed( false )
+{
+	ASSERT( _ChunkSize > 0 && _NbChunks > 0, "Read ahead needs at least one chunk" );
+
+	for( size_t c=0; c<m_Chunks.size(); ++c )
+	{
+		m_Chunks[c].Data.resize( _ChunkSize );
+		m_Chunks[c].Size = 0;
+	}
+
+	m_Reader = std::thread( &JsonReadAheadStream::ReaderLoop, this );
+}
+
+JsonReadAheadStream::~JsonReadAheadStream()
+{
+	{
+		std::unique_lock<std::mutex> lock( m_Mutex );
+		m_bStopping = true;
+	}
+	m_ChunkFreed.notify_all();
+	m_Reader.join();
+}
+
+void JsonReadAheadStream::ReaderLoop()
+{
+	for( ;; )
+	{
+		Chunk * pChunk;
+		{
+			std::unique_lock<std::mutex> lock( m_Mutex );
+			while( m_NbFilled == m_Chunks.size() && !m_bStopping )
+				m_ChunkFreed.wait( lock );
+
+			if( m_bStopping )
+				return;
+
+			pChunk = &m_Chunks[m_Tail];
+		}
+
+		// the tail chunk belongs to this thread until it is published
+		size_t size = m_Source.Read( &pChunk->Data[0], pChunk->Data.size() );
+		bool bFailed = (size == 0) && m_Source.HasFailed();
+
+		{
+			std::unique_lock<std::mutex> lock( m_Mutex );
+			pChunk->Size = size;
+			m_bFailed = bFailed;
+			m_Tail = (m_Tail + 1) % m_Chunks.size();
+			++m_NbFilled;
+		}
+		m_ChunkFilled.notify_one();
+
+		// an empty chunk marks the end of the input
+		if( size == 0 )
+			return;
+	}
+}
+
+size_t JsonReadAheadStream::Read( char * _pBuffer, size_t _Size )
+{
+	Chunk * pChunk;
+	{
+		std::unique_lock<std::mutex> lock( m_Mutex );
+		while( m_NbFilled == 0 )
+			m_ChunkFilled.wait( lock );
+
+		pChunk = &m_Chunks[m_Head];
+	}
+
+	// the end marker stays in place, so any further read returns 0 as well
+	if( pChunk->Size == 0 )
+		return 0;
+
+	size_t size = pChunk->Size - m_ReadOffset;
+	size = (size < _Size) ? size : _Size;
+	memcpy( _pBuffer, &pChunk->Data[m_ReadOffset], size );
+	m_ReadOffset += size;
+
+	if( m_ReadOffset == pChunk->Size )
+	{
+		{
+			std::unique_lock<std::mutex> lock( m_Mutex );
+			m_ReadOffset = 0;
+			m_Head = (m_Head + 1) % m_Chunks.size();
+			--m_NbFilled;
+		}
+		m_ChunkFreed.notify_one();
+	}
+
+	return size;
+}
+
+bool JsonReadAheadStream::HasFailed() const
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+	return m_bFailed;
+}
+
+#endif //MINJA_THREADS
+
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+// children, names and strings all live in the storage of the owning JsonDocument: nodes
+// don't need a destructor
+const JsonNode JsonNode::s_InvalidNode( JsonNode::Flag_Invalid );
+
+JsonNode::JsonNode()
+	: m_pParent(NULL)
+	, m_pName(NULL)
+	, m_Length(0)
+	, m_NameLength(0)
+	, m_Type(JsonNodeType_Unknown)
+	, m_Flags(0)
+{
+	m_Value.Children = NULL;
+}
+
+JsonNode::JsonNode( unsigned int _Flags )
+	: m_pParent(NULL)
+	, m_pName(NULL)
+	, m_Length(0)
+	, m_NameLength(0)
+	, m_Type(JsonNodeType_Unknown)
+	, m_Flags(_Flags)
+{
+	m_Value.Children = NULL;
+}
+
+const JsonNode * JsonNode::GetChild( const char * _pName ) const
+{
+	return GetChild( _pName, strlen(_pName) );
+}
+
+const JsonNode * JsonNode::GetChild( const char * _pName, size_t _NameLength ) const
+{
+	ASSERT( m_Type == JsonNodeType_Object, "Wrong node type. Not an Object" );
+
+	const_iterator iter = m_Value.Children;
+	const_iterator iend = m_Value.Children + m_Length;
+	for( ; iter!=iend; ++iter )
+		if( (*iter)->m_NameLength == _NameLength && !memcmp(_pName, (*iter)->m_pName, _NameLength) )
+			return *iter;
+
+	return NULL;
+}
+
+JsonNode * JsonNode::GetChild( const char * _pName )
+{
+	return const_cast<JsonNode *>( static_cast<const JsonNode *>( this )->GetChild( _pName ) );
+}
+
+JsonNode * JsonNode::GetChild( size_t _Index )
+{
+	// a caller getting a mutable node may well edit it: it has to be a real one
+	if( m_Flags & Flag_PackedNumbers )
+		UnpackNumbers();
+
+	return const_cast<JsonNode *>( static_cast<const JsonNode *>( this )->GetChild( _Index ) );
+}
+
+bool JsonNode::IsLastChild() const
+{
+	if( m_pParent && (m_pParent->m_Flags & Flag_PackedNumbers) )
+		return m_Length == m_pParent->m_Length - 1;
+	return (m_pParent == NULL) || (m_pParent->m_Value.Children[m_pParent->m_Length - 1] == this);
+}
+
+const JsonNode & JsonNode::operator [] ( size_t _Index ) const
+{
+	if( m_Flags & Flag_Invalid )
+		return *this;
+
+	const JsonNode * pRet = GetChild( _Index );
+	return pRet ? *pRet : s_InvalidNode;
+}
+
+const JsonNode & JsonNode::operator [] ( const char * _pName ) const
+{
+	if( m_Flags & Flag_Invalid )
+		return *this;
+
+	const JsonNode * pRet = GetChild( _pName );
+	return pRet ? *pRet : s_InvalidNode;
+}
+
+JsonDocument * JsonNode::GetDocument()
+{
+	// only documents can be roots: plain nodes are always created by a parent
+	JsonNode * pRoot = this;
+	while( pRoot->m_pParent )
+		pRoot = pRoot->m_pParent;
+
+	return static_cast<JsonDocument *>( pRoot );
+}
+
+JsonNode * JsonNode::CreateNode( JsonDocument & _Doc, const JsonStringRef & _Name, JsonNodeType _Type )
+{
+	if( _Name.pData && (_Doc.m_Options & JsonTokenizer::Option_DuplicateKeyPolicy) )
+		return _Doc.CreateKeyedNode( *this, _Name.pData, _Name.Length, _Name.bBorrowed, _Type );
+
+	return CreateNode( _Doc, _Name.pData, _Name.Length, _Name.bBorrowed, _Type );
+}
+
+JsonNode * JsonNode::CreateNode( JsonDocument & _Doc, const char * _pName, size_t _NameLength, bool _bBorrowName, JsonNodeType _Type )
+{
+	JsonNode * pNode = CreateDetachedNode( _Doc, _pName, _NameLength, _bBorrowName, _Type );
+
+	PushChild( _Doc, pNode );
+
+	return pNode;
+}
+
+JsonNode * JsonNode::CreateDetachedNode( JsonDocument & _Doc, const char * _pName, size_t _NameLength, bool _bBorrowName, JsonNodeType _Type )
+{
+	ASSERT( !_Doc.m_bFrozen, "Cannot modify a frozen document" );
+
+	ASSERT( _NameLength <= MaxNameLength, "Name too long" );
+
+	JsonNode * pNode = _Doc.AllocateNode();
+
+	pNode->m_pParent = this;
+	pNode->m_pName = NULL;
+	pNode->m_NameLength = 0;
+	pNode->m_Length = 0;
+	pNode->m_Flags = 0;
+	pNode->m_Value.Children = NULL;
+	if( _pName )
+	{
+		pNode->m_pName = _bBorrowName ? const_cast<char *>( _pName ) : _Doc.AllocateString( _pName, _NameLength );
+		pNode->m_NameLength = (unsigned int) _NameLength;
+	}
+
+	pNode->m_Type = _Type;
+
+	return pNode;
+}
+
+size_t JsonNode::GetChildCapacity() const
+{
+	return m_Value.Children ? reinterpret_cast<const size_t *>( m_Value.Children )[-1] : 0;
+}
+
+void JsonNode::ReserveChildren( JsonDocument & _Doc, size_t _Capacity )
+{
+	if( _Capacity <= GetChildCapacity() )
+		return;
+
+	JsonNode ** ppChildren = _Doc.AllocateChildren( _Capacity );
+	if( m_Value.Children )
+	{
+		memcpy( ppChildren, m_Value.Children, m_Length * ((m_Flags & Flag_PackedNumbers) ? sizeof(float) : sizeof(JsonNode *)) );
+		_Doc.ReleaseChildren( m_Value.Children );
+	}
+
+	m_Value.Children = ppChildren;
+}
+
+void JsonNode::PushChild( JsonDocument & _Doc, JsonNode * _pNode )
+{
+	// anything but a number among packed numbers
+	if( m_Flags & Flag_PackedNumbers )
+		UnpackNumbers();
+
+	if( m_Length == GetChildCapacity() )
+		ReserveChildren( _Doc, m_Length < 4 ? 4 : 2 * m_Length );
+
+	m_Value.Children[m_Length++] = _pNode;
+}
+
+void JsonNode::SetStringValue( JsonDocument & _Doc, const char * _pBegin, size_t _Len, bool _bBorrow )
+{
+	// short strings are cheaper to copy inline than to point to, even when they could be borrowed
+	if( _Len <= InlineStringCapacity )
+	{
+		memmove( m_Value.Inline, _pBegin, _Len );
+		m_Value.Inline[_Len] = 0;
+		m_Flags = (m_Flags & ~Flag_BorrowedString) | Flag_InlineString;
+	}
+	else
+	{
+		m_Value.String = _bBorrow ? const_cast<char *>( _pBegin ) : _Doc.AllocateString( _pBegin, _Len );
+		m_Flags = (m_Flags & ~(Flag_InlineString | Flag_BorrowedString)) | (_bBorrow ? Flag_BorrowedString : 0);
+	}
+
+	m_Length = (unsigned int) _Len;
+}
+
+// packed numbers live in a child array, which keeps its capacity in pointers: 
+// they get recycled and reserved the same way
+void JsonNode::PushNumber( JsonDocument & _Doc, float _Value )
+{
+	ASSERT( m_Type == JsonNodeType_Array && (m_Length == 0 || (m_Flags & Flag_PackedNumbers)), "Only empty or packed arrays take packed numbers" );
+
+	if( (m_Length + 1) * sizeof(float) > GetChildCapacity() * sizeof(JsonNode *) )
+	{
+		size_t capacity = m_Length < 8 ? 8 : 2 * m_Length;
+		ReserveChildren( _Doc, (capacity * sizeof(float) + sizeof(JsonNode *) - 1) / sizeof(JsonNode *) );
+	}
+
+	m_Flags |= Flag_PackedNumbers;
+	reinterpret_cast<float *>( m_Value.Children )[m_Length++] = _Value;
+}
+
+void JsonNode::SetPackedNumbers( JsonDocument & _Doc, const float * _pValues, size_t _Count )
+{
+	ASSERT( m_Type == JsonNodeType_Array && m_Length == 0, "Only empty arrays can be filled with packed numbers" );
+
+	if( _Count == 0 )
+		return;
+
+	ReserveChildren( _Doc, (_Count * sizeof(float) + sizeof(JsonNode *) - 1) / sizeof(JsonNode *) );
+	memcpy( m_Value.Children, _pValues, _Count * sizeof(float) );
+	m_Flags |= Flag_PackedNumbers;
+	m_Length = (unsigned int) _Count;
+	_Doc.m_NbPackedNumbers += _Count;
+}
+
+void JsonNode::UnpackNumbers()
+{
+	JsonDocument & doc = *GetDocument();
+	ASSERT( !doc.m_bFrozen, "Cannot modify a frozen document" );
+
+	// the numbers move to nodes, and their array goes back to the document for the next child arrays
+	JsonNode ** ppNumbers = m_Value.Children;
+	const float * pNumbers = reinterpret_cast<const float *>( ppNumbers );
+	size_t nbNumbers = m_Length;
+	size_t capacity = GetChildCapacity() * sizeof(JsonNode *) / sizeof(float);
+
+	m_Value.Children = doc.AllocateChildren( capacity );
+	m_Flags &= ~Flag_PackedNumbers;
+	for( size_t n=0; n<nbNumbers; ++n )
+	{
+		JsonNode * pNode = doc.AllocateNode();
+		pNode->m_pParent = this;
+		pNode->m_pName = NULL;
+		pNode->m_NameLength = 0;
+		pNode->m_Length = 0;
+		pNode->m_Flags = 0;
+		pNode->m_Type = JsonNodeType_Number;
+		pNode->m_Value.Number = pNumbers[n];
+		m_Value.Children[n] = pNode;
+	}
+
+	doc.ReleaseChildren( ppNumbers );
+	doc.m_NbPackedNumbers -= nbNumbers;
+}
+
+void JsonNode::UnpackSubtree()
+{
+	if( m_Flags & Flag_PackedNumbers )
+	{
+		UnpackNumbers();
+		return;
+	}
+
+	for( size_t c=0; c<m_Length; ++c )
+	{
+		JsonNode * pChild = m_Value.Children[c];
+		if( pChild->m_Type == JsonNodeType_Object || pChild->m_Type == JsonNodeType_Array )
+			pChild->UnpackSubtree();
+	}
+}
+
+
+JsonNode * JsonNode::AddNull( const char * _pName )
+{
+	return AddNull( JsonStringRef( _pName ) );
+}
+
+JsonNode * JsonNode::AddBool( const char * _pName, bool _Value )
+{
+	return AddBool( JsonStringRef( _pName ), _Value );
+}
+
+JsonNode * JsonNode::AddNumber( const char * _pName, float _Value )
+{
+	return AddNumber( JsonStringRef( _pName ), _Value );
+}
+
+JsonNode * JsonNode::AddString( const char * _pName, const char * _pValue )
+{
+	ASSERT( _pValue, "Cannot set a NULL string" );
+	return AddString( JsonStringRef( _pName ), JsonStringRef( _pValue ) );
+}
+
+JsonNode * JsonNode::AddString( const char * _pName, const char * _pBegin, size_t _Len )
+{
+	return AddString( JsonStringRef( _pName ), JsonStringRef( _pBegin, _Len ) );
+}
+
+JsonNode * JsonNode::AddNumbers( const char * _pName, const float * _pValues, size_t _Count )
+{
+	ASSERT( (_pName && m_Type == JsonNodeType_Object) || (!_pName && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+	ASSERT( _pValues || _Count == 0, "Cannot add NULL numbers" );
+
+	JsonDocument & doc = *GetDocument();
+	JsonNode * pNode = CreateNode( doc, _pName, JsonNodeType_Array );
+	if( pNode == NULL )
+		return NULL;
+
+	pNode->SetPackedNumbers( doc, _pValues, _Count );
+
+	return pNode;
+}
+
+JsonNode * JsonNode::AddArray( const char * _pName )
+{
+	return AddArray( JsonStringRef( _pName ) );
+}
+
+JsonNode * JsonNode::AddObject( const char * _pName )
+{
+	return AddObject( JsonStringRef( _pName ) );
+}
+
+JsonNode * JsonNode::AddNull( const JsonStringRef & _Name )
+{
+	ASSERT( (_Name.pData && m_Type == JsonNodeType_Object) || (!_Name.pData && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+
+	JsonNode * pNode = CreateNode( *GetDocument(), _Name, JsonNodeType_Null );
+	if( pNode == NULL )
+		return NULL;
+
+	pNode->m_Value.String = NULL;
+
+	return pNode;
+}
+
+JsonNode * JsonNode::AddBool( const JsonStringRef & _Name, bool _Value )
+{
+	ASSERT( (_Name.pData && m_Type == JsonNodeType_Object) || (!_Name.pData && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+
+	JsonNode * pNode = CreateNode( *GetDocument(), _Name, JsonNodeType_Bool );
+	if( pNode == NULL )
+		return NULL;
+
+	pNode->m_Value.Bool = _Value;
+
+	return pNode;
+}
+
+JsonNode * JsonNode::AddNumber( const JsonStringRef & _Name, float _Value )
+{
+	ASSERT( (_Name.pData && m_Type == JsonNodeType_Object) || (!_Name.pData && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+
+	JsonNode * pNode = CreateNode( *GetDocument(), _Name, JsonNodeType_Number );
+	if( pNode == NULL )
+		return NULL;
+
+	pNode->m_Value.Number = _Value;
+
+	return pNode;
+}
+
+JsonNode * JsonNode::AddString( const JsonStringRef & _Name, const JsonStringRef & _Value )
+{
+	ASSERT( (_Name.pData && m_Type == JsonNodeType_Object) || (!_Name.pData && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+	ASSERT( _Value.pData, "Cannot set a NULL string" );
+
+	JsonDocument & doc = *GetDocument();
+	JsonNode * pNode = CreateNode( doc, _Name, JsonNodeType_String );
+	if( pNode == NULL )
+		return NULL;
+
+	pNode->SetStringValue( doc, _Value.pData, _Value.Length, _Value.bBorrowed );
+
+	return pNode;
+}
+
+JsonNode * JsonNode::AddArray( const JsonStringRef & _Name, size_t _NbChildren )
+{
+	ASSERT( (_Name.pData && m_Type == JsonNodeType_Object) || (!_Name.pData && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+
+	JsonDocument & doc = *GetDocument();
+	JsonNode * pNode = CreateNode( doc, _Name, JsonNodeType_Array );
+	if( pNode && _NbChildren )
+		pNode->ReserveChildren( doc, _NbChildren );
+
+	return pNode;
+}
+
+JsonNode * JsonNode::AddObject( const JsonStringRef & _Name, size_t _NbChildren )
+{
+	ASSERT( (_Name.pData && m_Type == JsonNodeType_Object) || (!_Name.pData && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+
+	JsonDocument & doc = *GetDocument();
+	JsonNode * pNode = CreateNode( doc, _Name, JsonNodeType_Object );
+	if( pNode && _NbChildren )
+		pNode->ReserveChildren( doc, _NbChildren );
+
+	return pNode;
+}
+
+void JsonNode::ReserveChildren( size_t _NbChildren )
+{
+	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
+	JsonDocument & doc = *GetDocument();
+	ASSERT( !doc.m_bFrozen, "Cannot modify a frozen document" );
+
+	ReserveChildren( doc, _NbChildren );
+}
 
 void JsonNode::AttachNode( JsonNode * _pNode )
 {
-	ASSERT( (_pNode->GetName() && m_Type == JsonNodeType_Object) || (!_pNode->GetName() && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
-	ASSERT( _pNode, "Cannot add a NULL node" );
+	ASSERT( _pNode, "Cannot add a NULL node" );
+	ASSERT( (_pNode->GetName() && m_Type == JsonNodeType_Object) || (!_pNode->GetName() && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+	JsonDocument & doc = *GetDocument();
+	ASSERT( !doc.m_bFrozen, "Cannot modify a frozen document" );
+
+	_pNode->m_pParent = this;
+	PushChild( doc, _pNode );
+}
+
+#if MINJA_UNIQUE_PTR
+JsonNode * JsonNode::AttachDocument( const JsonStringRef & _Name, std::unique_ptr<JsonDocument> && _pDoc )
+{
+	ASSERT( (_Name.pData && m_Type == JsonNodeType_Object) || (!_Name.pData && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+	ASSERT( _pDoc.get(), "Cannot attach a NULL document" );
+	ASSERT( !_pDoc->m_bFrozen, "Cannot attach a frozen document" );
+
+	JsonDocument & doc = *GetDocument();
+	ASSERT( &doc != _pDoc.get(), "Cannot attach a document to itself" );
+
+	JsonNode * pNode = CreateNode( doc, _Name, _pDoc->GetType() );
+	if( pNode == NULL )
+		return NULL;
+
+	// the root hands its children over to the new node, whose storage now belongs to this document
+	JsonDocument & source = *_pDoc;
+	pNode->m_Value = source.m_Value;
+	pNode->m_Length = source.m_Length;
+	pNode->m_Flags |= source.m_Flags & Flag_PackedNumbers;
+	if( !(source.m_Flags & Flag_PackedNumbers) )
+	{
+		for( size_t c=0; c<source.m_Length; ++c )
+			source.m_Value.Children[c]->m_pParent = pNode;
+	}
+
+	doc.AdoptStorage( source );
+	_pDoc.reset();
+
+	return pNode;
+}
+#endif
+
+void JsonNode::BeginValueEdit( JsonNodeType _Type )
+{
+	// the root has to stay a container, GetDocument relies on it
+	ASSERT( m_pParent, "Cannot change the value of a document" );
+	ASSERT( !GetDocument()->m_bFrozen, "Cannot modify a frozen document" );
+
+	m_Type = _Type;
+	m_Length = 0;
+	m_Flags &= ~(Flag_InlineString | Flag_PackedNumbers | Flag_BorrowedString);
+}
+
+void JsonNode::SetNull()
+{
+	BeginValueEdit( JsonNodeType_Null );
+	m_Value.String = NULL;
+}
+
+void JsonNode::SetBool( bool _Value )
+{
+	BeginValueEdit( JsonNodeType_Bool );
+	m_Value.Bool = _Value;
+}
+
+void JsonNode::SetNumber( float _Value )
+{
+	BeginValueEdit( JsonNodeType_Number );
+	m_Value.Number = _Value;
+}
+
+void JsonNode::SetString( const char * _pValue )
+{
+	ASSERT( _pValue, "Cannot set a NULL string" );
+	SetString( _pValue, strlen(_pValue) );
+}
+
+void JsonNode::SetString( const char * _pBegin, size_t _Len )
+{
+	ASSERT( _pBegin, "Cannot set a NULL string" );
+
+	JsonDocument & doc = *GetDocument();
+	bool bInPlace = m_Type == JsonNodeType_String && !(m_Flags & (Flag_InlineString | Flag_BorrowedString)) && _Len <= m_Length;
+	char * pOld = m_Value.String;
+
+	BeginValueEdit( JsonNodeType_String );
+
+	// shorter strings are overwritten in place when the old value is our own copy,
+	// borrowed ones may live in read-only memory or in a buffer the caller still uses
+	if( bInPlace && _Len > InlineStringCapacity )
+	{
+		memmove( pOld, _pBegin, _Len );
+		pOld[_Len] = 0;
+		m_Value.String = pOld;
+		m_Length = (unsigned int) _Len;
+	}
+	else
+		SetStringValue( doc, _pBegin, _Len, false );
+}
+
+void JsonNode::MoveLastChildTo( size_t _Index )
+{
+	ASSERT( _Index < m_Length, "Index out of bounds" );
+
+	JsonNode ** ppChildren = m_Value.Children;
+	JsonNode * pNode = ppChildren[m_Length - 1];
+	memmove( ppChildren + _Index + 1, ppChildren + _Index, (m_Length - 1 - _Index) * sizeof(JsonNode *) );
+	ppChildren[_Index] = pNode;
+}
+
+size_t JsonNode::FindChildIndex( const JsonNode * _pChild ) const
+{
+	for( size_t c=0; c<m_Length; ++c )
+		if( m_Value.Children[c] == _pChild )
+			return c;
+
+	return m_Length;
+}
+
+JsonNode * JsonNode::InsertAt( size_t _Index, const char * _pName, JsonNodeType _Type )
+{
+	ASSERT( (_pName && m_Type == JsonNodeType_Object) || (!_pName && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+	ASSERT( _Index <= m_Length, "Index out of bounds" );
+	ASSERT( _Type != JsonNodeType_Unknown, "Cannot insert a node of unknown type" );
+
+	JsonDocument & doc = *GetDocument();
+	JsonNode * pNode = CreateNode( doc, _pName, _Type );
+	if( pNode == NULL )
+		return NULL;
+
+	// value nodes start as the zero value of their type
+	switch( _Type )
+	{
+	case JsonNodeType_Bool:		pNode->m_Value.Bool = false; break;
+	case JsonNodeType_Number:	pNode->m_Value.Number = 0.0f; break;
+	case JsonNodeType_String:	pNode->SetStringValue( doc, "", 0, false ); break;
+	case JsonNodeType_Null:		pNode->m_Value.String = NULL; break;
+	default:					break;
+	}
+
+	// a key already present is placed by the duplicate key policy instead
+	if( m_Length && m_Value.Children[m_Length - 1] == pNode )
+	{
+		MoveLastChildTo( _Index );
+		doc.m_pKeySetOwner = NULL;
+	}
+
+	return pNode;
+}
+
+JsonNode * JsonNode::ReplaceChild( size_t _Index, const JsonNode & _Source )
+{
+	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
+	ASSERT( _Index < m_Length, "Index out of bounds" );
+
+	if( m_Flags & Flag_PackedNumbers )
+		UnpackNumbers();
+
+	// copy first: the source may well be the replaced child, one of its descendants or one of its ancestors
+	JsonNode * pOld = m_Value.Children[_Index];
+	JsonNode * pNode = CopyNode( *GetDocument(), pOld->m_pName, pOld->m_NameLength, _Source );
+
+	--m_Length;
+	m_Value.Children[_Index] = pNode;
+
+	return pNode;
+}
+
+JsonNode * JsonNode::ReplaceChild( const char * _pName, const JsonNode & _Source )
+{
+	const JsonNode * pOld = GetChild( _pName );
+	if( pOld == NULL )
+		return NULL;
+
+	return ReplaceChild( FindChildIndex( pOld ), _Source );
+}
+
+bool JsonNode::RemoveChild( size_t _Index, bool _bKeepOrder )
+{
+	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
+	ASSERT( !GetDocument()->m_bFrozen, "Cannot modify a frozen document" );
+
+	if( _Index >= m_Length )
+		return false;
+
+	if( m_Flags & Flag_PackedNumbers )
+		UnpackNumbers();
+
+	GetDocument()->m_pKeySetOwner = NULL;
+
+	JsonNode ** ppChildren = m_Value.Children;
+	--m_Length;
+	if( _bKeepOrder )
+		memmove( ppChildren + _Index, ppChildren + _Index + 1, (m_Length - _Index) * sizeof(JsonNode *) );
+	else
+		ppChildren[_Index] = ppChildren[m_Length];
+
+	return true;
+}
+
+bool JsonNode::RemoveChild( const char * _pName, bool _bKeepOrder )
+{
+	const JsonNode * pOld = GetChild( _pName );
+	if( pOld == NULL )
+		return false;
+
+	return RemoveChild( FindChildIndex( pOld ), _bKeepOrder );
+}
+
+void JsonNode::MeasureSubtree( size_t & _NbNodes, size_t & _NbPackedNumbers, size_t & _NbStorageBytes ) const
+{
+	// child arrays take their capacity slot and the worst alignment padding
+	if( m_Flags & Flag_PackedNumbers )
+	{
+		_NbPackedNumbers += m_Length;
+		_NbStorageBytes += m_Length * sizeof(float) + 3 * sizeof(JsonNode *);
+		return;
+	}
+
+	if( m_Length )
+		_NbStorageBytes += (m_Length + 2) * sizeof(JsonNode *);
+
+	for( size_t c=0; c<m_Length; ++c )
+	{
+		const JsonNode * pChild = m_Value.Children[c];
+
+		++_NbNodes;
+		if( pChild->m_pName )
+			_NbStorageBytes += pChild->m_NameLength + 1;
+
+		if( pChild->m_Type == JsonNodeType_String && !(pChild->m_Flags & Flag_InlineString) )
+			_NbStorageBytes += pChild->m_Length + 1;
+		else if( pChild->m_Type == JsonNodeType_Object || pChild->m_Type == JsonNodeType_Array )
+			pChild->MeasureSubtree( _NbNodes, _NbPackedNumbers, _NbStorageBytes );
+	}
+}
+
+JsonNode * JsonNode::CopyNode( JsonDocument & _Doc, const char * _pName, size_t _NameLength, const JsonNode & _Source )
+{
+	// the copy is only attached once complete: the source may be this node or one of its ancestors
+	JsonNode * pNode = CreateDetachedNode( _Doc, _pName, _NameLength, false, _Source.GetType() );
+
+	switch( _Source.m_Type )
+	{
+	case JsonNodeType_String:
+		pNode->SetStringValue( _Doc, _Source.GetString(), _Source.m_Length, false );
+		break;
+
+	case JsonNodeType_Object:
+	case JsonNodeType_Array:
+		pNode->CloneChildren( _Doc, _Source );
+		break;
+
+	default:
+		pNode->m_Value = _Source.m_Value;
+		break;
+	}
+
+	PushChild( _Doc, pNode );
+
+	return pNode;
+}
+
+void JsonNode::CloneChildren( JsonDocument & _Doc, const JsonNode & _Source )
+{
+	// the copy of a packed array is packed too
+	if( _Source.m_Flags & Flag_PackedNumbers )
+	{
+		SetPackedNumbers( _Doc, _Source.GetNumbers(), _Source.m_Length );
+		return;
+	}
+
+	ReserveChildren( _Doc, m_Length + _Source.m_Length );
+
+	for( size_t c=0; c<_Source.m_Length; ++c )
+	{
+		const JsonNode * pChild = _Source.m_Value.Children[c];
+		CopyNode( _Doc, pChild->m_pName, pChild->m_NameLength, *pChild );
+	}
+}
+
+JsonNode * JsonNode::AddCopy( const char * _pName, const JsonNode & _Source )
+{
+	ASSERT( (_pName && m_Type == JsonNodeType_Object) || (!_pName && m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+
+	return CopyNode( *GetDocument(), _pName, _pName ? strlen(_pName) : 0, _Source );
+}
+
+JsonDocument * JsonNode::Clone() const
+{
+	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
+
+	// measure first so the whole copy goes into a single node block and a single string block
+	size_t nbNodes = 0;
+	size_t nbPackedNumbers = 0;
+	size_t nbStorageBytes = 0;
+	MeasureSubtree( nbNodes, nbPackedNumbers, nbStorageBytes );
+
+	JsonDocument * pDoc = JsonDocument::Create( JsonParseMode_Copy );
+	pDoc->m_Type = m_Type;
+	pDoc->Reserve( nbNodes, nbStorageBytes );
+	pDoc->CloneChildren( *pDoc, *this );
+
+	return pDoc;
+}
+
+bool JsonNode::Visit( JsonNodeVisitor & _Visitor )
+{
+	bool keepGoing;
+	switch( m_Type )
+	{
+	case JsonNodeType_Null: 
+		keepGoing = _Visitor.OnNull( this ); 
+		goto visitEarlyOut;
+
+	case JsonNodeType_Bool: 
+		keepGoing = _Visitor.OnBool( this ); 
+		goto visitEarlyOut;
+
+	case JsonNodeType_Number: 
+		keepGoing = _Visitor.OnNull( this ); 
+		goto visitEarlyOut;
+
+	case JsonNodeType_String: 
+		keepGoing = _Visitor.OnString( this ); 
+		goto visitEarlyOut;
+
+	case JsonNodeType_Array: 
+		keepGoing = _Visitor.OnArrayBegin( this );
+		if( !keepGoing )
+			goto visitEarlyOut;
+		if( m_Flags & Flag_PackedNumbers )
+			UnpackNumbers();
+		for( size_t c=0; c<m_Length; ++c )
+		{
+			keepGoing = m_Value.Children[c]->Visit( _Visitor );
+			if( !keepGoing )
+				goto visitEarlyOut;
+		}
+		keepGoing = _Visitor.OnArrayEnd( this ); 
+		goto visitEarlyOut;
+
+	case JsonNodeType_Object: 
+		keepGoing = _Visitor.OnObjectBegin( this ); 
+		for( size_t c=0; c<m_Length; ++c )
+		{
+			keepGoing = m_Value.Children[c]->Visit( _Visitor );
+			if( !keepGoing )
+				goto visitEarlyOut;
+		}
+		keepGoing = _Visitor.OnObjectEnd( this ); 
+		goto visitEarlyOut;
+
+	case JsonNodeType_Unknown:
+	default:
+		break;
+	}
+
+visitEarlyOut:
+	return keepGoing;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+static unsigned long long HashBytes( const char * _pData, size_t _Len, unsigned long long _Seed );
+
+// name -> child index within one object, open addressing. Only the used slots get cleared,
+// so the same set serves wide and tiny objects alike.
+class JsonKeySet
+{
+	struct Entry
+	{
+		size_t Index;			// child index + 1, 0 for empty slots
+		unsigned long long Hash;
+	};
+
+	std::vector<Entry> m_Entries;
+	std::vector<size_t> m_UsedSlots;
+
+public:
+	enum { NotFound = ~(size_t) 0 };
+
+	static unsigned long long Hash( const char * _pName, size_t _NameLength )	{ return HashBytes( _pName, _NameLength, 0 ); }
+
+	void Clear( size_t _ExpectedCount )
+	{
+		for( size_t u=0; u<m_UsedSlots.size(); ++u )
+			m_Entries[m_UsedSlots[u]].Index = 0;
+		m_UsedSlots.clear();
+
+		size_t size = 16;
+		while( size < 2 * _ExpectedCount )
+			size <<= 1;
+
+		if( size > m_Entries.size() )
+		{
+			Entry empty = { 0, 0 };
+			m_Entries.assign( size, empty );
+		}
+	}
+
+	size_t Find( JsonNode * const * _ppChildren, unsigned long long _Hash, const char * _pName, size_t _NameLength ) const
+	{
+		size_t mask = m_Entries.size() - 1;
+		for( size_t slot = (size_t) _Hash & mask; m_Entries[slot].Index; slot = (slot + 1) & mask )
+		{
+			if( m_Entries[slot].Hash != _Hash )
+				continue;
+
+			const JsonNode * pChild = _ppChildren[m_Entries[slot].Index - 1];
+			if( pChild->GetNameLength() == _NameLength && !memcmp( pChild->GetName(), _pName, _NameLength ) )
+				return m_Entries[slot].Index - 1;
+		}
+
+		return NotFound;
+	}
+
+	void Insert( unsigned long long _Hash, size_t _Index )
+	{
+		if( 2 * (m_UsedSlots.size() + 1) > m_Entries.size() )
+		{
+			std::vector<Entry> old;
+			for( size_t u=0; u<m_UsedSlots.size(); ++u )
+				old.push_back( m_Entries[m_UsedSlots[u]] );
+
+			Clear( m_Entries.size() );
+			for( size_t e=0; e<old.size(); ++e )
+				Insert( old[e].Hash, old[e].Index - 1 );
+		}
+
+		size_t mask = m_Entries.size() - 1;
+		size_t slot = (size_t) _Hash & mask;
+		while( m_Entries[slot].Index )
+			slot = (slot + 1) & mask;
+
+		m_Entries[slot].Index = _Index + 1;
+		m_Entries[slot].Hash = _Hash;
+		m_UsedSlots.push_back( slot );
+	}
+};
+
+// the names and child counts of a parsed tree, in node creation order, with the names interned
+class JsonShape
+{
+public:
+	enum
+	{
+		MaxEntries = 1 << 16,	// larger trees only have their beginning predicted, and never match
+	};
+
+	struct Entry
+	{
+		const char * pName;			// NULL for array items
+		size_t NameLength;
+		size_t NbChildren;
+	};
+
+protected:
+	std::vector<Entry> m_Entries;	// the root first
+	std::vector<char> m_Names;
+	std::vector<char> m_RetiredNames;	// the names the current tree may still borrow, until the next Rewind
+	size_t m_Cursor;
+	bool m_bMatching;
+	bool m_bTruncated;
+
+public:
+	JsonShape() : m_Cursor( 0 ), m_bMatching( false ), m_bTruncated( false ) {}
+
+	void Record( const JsonNode & _Root )
+	{
+		m_Entries.clear();
+		m_bTruncated = false;
+		m_bMatching = false;
+
+		Entry root = { NULL, 0, _Root.GetNbChildren() };
+		m_Entries.push_back( root );
+		size_t nameBytes = 0;
+		Collect( _Root, nameBytes );
+
+		// the names being recorded may be borrowed from the current storage, so it is replaced only once copied
+		std::vector<char> names( nameBytes );
+		char * pName = names.empty() ? NULL : &names[0];
+		for( size_t e=1; e<m_Entries.size(); ++e )
+		{
+			if( m_Entries[e].pName == NULL )
+				continue;
+
+			memcpy( pName, m_Entries[e].pName, m_Entries[e].NameLength );
+			pName[m_Entries[e].NameLength] = 0;
+			m_Entries[e].pName = pName;
+			pName += m_Entries[e].NameLength + 1;
+		}
+		m_RetiredNames.swap( m_Names );
+		m_Names.swap( names );
+	}
+
+	void Rewind()
+	{
+		m_RetiredNames.clear();
+		m_Cursor = 1;
+		m_bMatching = !m_Entries.empty();
+	}
+
+	// the entry predicted for the next node if it has that name, NULL once the parse has strayed
+	const Entry * Match( const char * _pName, size_t _NameLength )
+	{
+		if( !m_bMatching )
+			return NULL;
+
+		if( m_Cursor == m_Entries.size() )
+		{
+			m_bMatching = false;
+			return NULL;
+		}
+
+		const Entry & entry = m_Entries[m_Cursor];
+		if( entry.NameLength != _NameLength || (entry.pName == NULL) != (_pName == NULL) || (_pName && memcmp( entry.pName, _pName, _NameLength )) )
+		{
+			m_bMatching = false;
+			return NULL;
+		}
+
+		++m_Cursor;
+		return &entry;
+	}
+
+	bool IsMatched() const				{ return m_bMatching && m_Cursor == m_Entries.size() && !m_bTruncated; }
+	size_t GetNbRootChildren() const	{ return m_Entries.empty() ? 0 : m_Entries[0].NbChildren; }
+
+protected:
+	void Collect( const JsonNode & _Node, size_t & _NameBytes )
+	{
+		// packed numbers are no nodes: the parse doesn't match them
+		if( _Node.IsPacked() )
+			return;
+
+		for( JsonNode::const_iterator iter = _Node.begin(); iter != _Node.end(); ++iter )
+		{
+			if( m_Entries.size() == MaxEntries )
+			{
+				m_bTruncated = true;
+				return;
+			}
+
+			const JsonNode & child = **iter;
+			bool bContainer = child.GetType() == JsonNodeType_Object || child.GetType() == JsonNodeType_Array;
+			Entry entry = { _Node.GetType() == JsonNodeType_Object ? child.GetName() : NULL, child.GetNameLength(), bContainer ? child.GetNbChildren() : 0 };
+			m_Entries.push_back( entry );
+			if( entry.pName )
+				_NameBytes += entry.NameLength + 1;
+
+			if( bContainer )
+				Collect( child, _NameBytes );
+		}
+	}
+};
+
+JsonDocument::JsonDocument( JsonParseMode _Mode )
+	: m_CurrNodeBlock( 0 )
+	, m_CurrNodeOffset( 0 )
+	, m_CurrStringBlock( 0 )
+	, m_CurrStringOffset( 0 )
+	, m_RefCount( 0 )
+	, m_bFrozen( false )
+	, m_Mode( _Mode )
+	, m_pParseRoot( NULL )
+	, m_pCurrPair( NULL )
+	, m_pCurrObject( NULL )
+	, m_pCurrName( NULL )
+	, m_CurrNameLength( 0 )
+	, m_bUseNextStringAsKey( true )
+	, m_pKeySet( NULL )
+	, m_pKeySetOwner( NULL )
+	, m_NbKeySetChildren( 0 )
+	, m_bRejected( false )
+	, m_pShape( NULL )
+	, m_MaxBytes( (size_t) -1 )
+	, m_MaxNodes( (size_t) -1 )
+	, m_MaxStringLength( (size_t) -1 )
+	, m_MaxKeyLength( MaxNameLength )
+	, m_MaxMemory( (size_t) -1 )
+	, m_NbNodes( 0 )
+	, m_NbPackedNumbers( 0 )
+	, m_NbStorageBytes( 0 )
+{
+	m_Type = JsonNodeType_Object;
+	m_pParseRoot = this;
+}
+
+JsonDocument::~JsonDocument()
+{
+	for( size_t b=0; b<m_NodeBlocks.size(); ++b )
+		delete [] m_NodeBlocks[b].pNodes;
+
+	for( size_t b=0; b<m_StringBlocks.size(); ++b )
+		delete [] m_StringBlocks[b].pData;
+
+	delete m_pKeySet;
+	delete m_pShape;
+}
+
+JsonDocument * JsonDocument::Parse( const char * _pBuffer, JsonParseMode _Mode, unsigned int _Options, JsonParseError * _pError )
+{
+	JsonDocument * pDoc = new JsonDocument( _Mode );
+	pDoc->SetOptions( _Options );
+
+	bool bParsed = ParseInto( *pDoc, _pBuffer );
+	if( _pError )
+		*_pError = pDoc->m_Error;
+
+	if( bParsed )
+	{
+		return pDoc;
+	}
+	else
+	{
+		delete pDoc;
+		return NULL;
+	}
+}
+
+JsonDocument * JsonDocument::Parse( const char * _pBuffer, const JsonParseLimits & _Limits, JsonParseMode _Mode, unsigned int _Options, JsonParseError * _pError )
+{
+	JsonDocument * pDoc = new JsonDocument( _Mode );
+	pDoc->SetOptions( _Options );
+	pDoc->SetLimits( _Limits );
+
+	bool bParsed = ParseInto( *pDoc, _pBuffer );
+	if( _pError )
+		*_pError = pDoc->m_Error;
+
+	if( bParsed )
+		return pDoc;
+
+	delete pDoc;
+	return NULL;
+}
+
+bool JsonDocument::ParseInto( JsonDocument & _Doc, const char * _pBuffer )
+{
+	_Doc.Reset();
+	_Doc.m_Error = JsonParseError();
+	_Doc.SetInputBase( _pBuffer, 0 );
+
+	// memchr stops at the terminator, so an oversized input costs no more than the limit
+	if( _Doc.m_MaxBytes != (size_t) -1 && memchr( _pBuffer, 0, _Doc.m_MaxBytes + 1 ) == NULL )
+	{
+		_Doc.SetError( _pBuffer + _Doc.m_MaxBytes, JsonParseError_InputTooLarge, JsonValidateError_None, "Input too large" );
+		return false;
+	}
+
+	// the root is either an object or an array
+	const char * pParseEnd;
+	const char * pRoot = JsonTokenizer::SkipWhitespaces( _pBuffer );
+	JsonTokenizer::ParseResult result = (*pRoot == '[') ? ReadArray( _Doc, pRoot, &pParseEnd ) : ReadObject( _Doc, pRoot, &pParseEnd );
+	if( result == JsonTokenizer::ParseOK && !_Doc.m_bRejected )
+	{
+		_Doc.EndParse();
+		return true;
+	}
+
+	// don't leave a half built tree behind
+	_Doc.Reset();
+	return false;
+}
+
+// fails once its source gives more than a given number of bytes
+class JsonBoundedInputStream : public JsonInputStream
+{
+protected:
+	JsonInputStream & m_Source;
+	size_t m_Remaining;
+	bool m_bExceeded;
+
+public:
+	JsonBoundedInputStream( JsonInputStream & _Source, size_t _MaxBytes ) : m_Source( _Source ), m_Remaining( _MaxBytes ), m_bExceeded( false ) {}
+
+	bool IsExceeded() const					{ return m_bExceeded; }
+
+	virtual size_t Read( char * _pBuffer, size_t _Size )
+	{
+		if( m_Remaining == 0 )
+		{
+			// one more byte tells an input of exactly the limit from a larger one
+			char extra;
+			m_bExceeded = m_Source.Read( &extra, 1 ) > 0;
+			return 0;
+		}
+
+		size_t read = m_Source.Read( _pBuffer, _Size < m_Remaining ? _Size : m_Remaining );
+		m_Remaining -= read;
+		return read;
+	}
+
+	virtual bool HasFailed() const			{ return m_bExceeded || m_Source.HasFailed(); }
+
+private:
+	JsonBoundedInputStream & operator = ( const JsonBoundedInputStream & );
+};
+
+JsonDocument * JsonDocument::ParseStream( JsonInputStream & _Stream, unsigned int _Options, JsonParseError * _pError )
+{
+	return ParseStream( _Stream, JsonParseLimits(), _Options, _pError );
+}
+
+JsonDocument * JsonDocument::ParseStream( JsonInputStream & _Stream, const JsonParseLimits & _Limits, unsigned int _Options, JsonParseError * _pError )
+{
+	JsonDocument * pDoc = new JsonDocument( JsonParseMode_Copy );
+	pDoc->SetOptions( _Options );
+	pDoc->SetLimits( _Limits );
+
+	bool bParsed;
+	if( _Limits.MaxBytes )
+	{
+		JsonBoundedInputStream bounded( _Stream, _Limits.MaxBytes );
+		bParsed = JsonReadStream( *pDoc, bounded );
+
+		// the cut reads as a stream failure to the tokenizer
+		if( !bParsed && bounded.IsExceeded() )
+		{
+			pDoc->m_Error.Code = JsonParseError_InputTooLarge;
+			pDoc->m_Error.Offset = _Limits.MaxBytes;
+			pDoc->m_Error.pMessage = "Input too large";
+		}
+	}
+	else
+	{
+		bParsed = JsonReadStream( *pDoc, _Stream );
+	}
+
+	if( _pError )
+		*_pError = pDoc->m_Error;
+
+	if( bParsed && !pDoc->m_bRejected )
+		return pDoc;
+
+	delete pDoc;
+	return NULL;
+}
+
+JsonDocument * JsonDocument::ParseFile( const char * _pPath, unsigned int _Options, JsonParseError * _pError )
+{
+	FILE * pFile = fopen( _pPath, "rb" );
+	if( pFile == NULL )
+	{
+		if( _pError )
+		{
+			*_pError = JsonParseError();
+			_pError->Code = JsonParseError_ReadError;
+			_pError->pMessage = "Cannot open the file";
+		}
+		return NULL;
+	}
+
+	JsonDocument * pDoc;
+	{
+		JsonFileInputStream file( pFile );
+#if MINJA_THREADS
+		JsonReadAheadStream stream( file );
+		pDoc = ParseStream( stream, _Options, _pError );
+#else
+		pDoc = ParseStream( file, _Options, _pError );
+#endif
+	}
+
+	fclose( pFile );
+	return pDoc;
+}
+
+JsonDocument * JsonDocument::Create( JsonParseMode _Mode, JsonNodeType _RootType )
+{
+	ASSERT( _RootType == JsonNodeType_Object || _RootType == JsonNodeType_Array, "A document is either an Object or an Array" );
+
+	JsonDocument * pDoc = new JsonDocument( _Mode );
+	pDoc->m_Type = _RootType;
+
+	return pDoc;
+}
+
+void JsonDocument::Reset()
+{
+	ASSERT( !m_bFrozen, "Cannot modify a frozen document" );
+
+	if( m_pShape )
+		m_pShape->Rewind();
+
+	// rewind all the storage, keeping every block and vector capacity for the next use
+	m_CurrNodeBlock = 0;
+	m_CurrNodeOffset = 0;
+	m_CurrStringBlock = 0;
+	m_CurrStringOffset = 0;
+	m_FreeChildren.clear();
+	m_Value.Children = NULL;
+	m_Length = 0;
+	m_Flags &= ~Flag_PackedNumbers;
+
+	m_pCurrPair = NULL;
+	m_pCurrObject = NULL;
+	m_pCurrName = NULL;
+	m_CurrNameLength = 0;
+	m_bUseNextStringAsKey = true;
+	m_pKeySetOwner = NULL;
+	m_bRejected = false;
+	m_bStopped = false;
+	m_Depth = 0;
+	m_NbNodes = 0;
+	m_NbPackedNumbers = 0;
+	m_NbStorageBytes = 0;
+}
+
+// 0 means unlimited in JsonParseLimits, which is stored as the largest value to keep the checks to one compare
+static size_t GetLimit( size_t _Limit, size_t _Max )
+{
+	return (_Limit == 0 || _Limit > _Max) ? _Max : _Limit;
+}
+
+void JsonDocument::SetLimits( const JsonParseLimits & _Limits )
+{
+	m_MaxBytes = GetLimit( _Limits.MaxBytes, (size_t) -1 );
+	m_MaxNodes = GetLimit( _Limits.MaxNodes, (size_t) -1 );
+	m_MaxStringLength = GetLimit( _Limits.MaxStringLength, (size_t) -1 );
+	m_MaxKeyLength = GetLimit( _Limits.MaxKeyLength, MaxNameLength );
+	m_MaxMemory = GetLimit( _Limits.MaxMemory, (size_t) -1 );
+	SetMaxDepth( GetLimit( _Limits.MaxDepth, (size_t) -1 ) );
+}
+
+void JsonDocument::EndParse()
+{
+	if( !(m_Options & JsonTokenizer::Option_LearnShape) )
+		return;
+
+	if( m_pShape == NULL )
+		m_pShape = new JsonShape;
+
+	if( !m_pShape->IsMatched() )
+		m_pShape->Record( *this );
+}
+
+bool JsonDocument::HasMatchedShape() const
+{
+	return m_pShape && m_pShape->IsMatched();
+}
+
+void JsonDocument::Reserve( size_t _NbNodes, size_t _NbStorageBytes )
+{
+	// a block is inserted right after the current one when it can't take the whole request
+	if( _NbNodes > 0 && (m_CurrNodeBlock == m_NodeBlocks.size() || m_CurrNodeOffset + _NbNodes > m_NodeBlocks[m_CurrNodeBlock].Size) )
+	{
+		NodeBlock block;
+		block.Size = _NbNodes;
+		block.pNodes = new JsonNode [block.Size];
+
+		if( m_CurrNodeBlock < m_NodeBlocks.size() && m_CurrNodeOffset > 0 )
+			++m_CurrNodeBlock;
+		m_NodeBlocks.insert( m_NodeBlocks.begin() + m_CurrNodeBlock, block );
+		m_CurrNodeOffset = 0;
+	}
+
+	if( _NbStorageBytes > 0 && (m_CurrStringBlock == m_StringBlocks.size() || m_CurrStringOffset + _NbStorageBytes > m_StringBlocks[m_CurrStringBlock].Size) )
+	{
+		StringBlock block;
+		block.Size = _NbStorageBytes;
+		block.pData = new char [block.Size];
+
+		if( m_CurrStringBlock < m_StringBlocks.size() && m_CurrStringOffset > 0 )
+			++m_CurrStringBlock;
+		m_StringBlocks.insert( m_StringBlocks.begin() + m_CurrStringBlock, block );
+		m_CurrStringOffset = 0;
+	}
+}
+
+void JsonDocument::Freeze()
+{
+	// lazy unpacking would create nodes under concurrent readers
+	if( m_NbPackedNumbers && !m_bFrozen )
+		UnpackSubtree();
+
+	m_bFrozen = true;
+}
+
+bool JsonDocument::IsFrozen() const
+{
+	return m_bFrozen;
+}
+
+// JSON Pointer tokens escape '~' as ~0 and '/' as ~1. Tokens without a '~' are used in place.
+static const char * UnescapePointerToken( const char * _pToken, size_t & _Len, std::vector<char> & _Scratch )
+{
+	if( !memchr( _pToken, '~', _Len ) )
+		return _pToken;
+
+	_Scratch.clear();
+	for( size_t c=0; c<_Len; ++c )
+	{
+		if( _pToken[c] == '~' && c + 1 < _Len && (_pToken[c+1] == '0' || _pToken[c+1] == '1') )
+			_Scratch.push_back( _pToken[++c] == '0' ? '~' : '/' );
+		else
+			_Scratch.push_back( _pToken[c] );
+	}
+
+	_Len = _Scratch.size();
+	return &_Scratch[0];
+}
+
+JsonNode * JsonDocument::FindPointer( const char * _pPointer, size_t _Len, JsonNode ** _ppParent, const char ** _ppLastToken, size_t * _pLastTokenLength )
+{
+	// RFC 6901 JSON Pointer: "" is the whole document, then each "/token" goes one level down
+	std::vector<char> scratch;
+	JsonNode * pParent = NULL;
+	JsonNode * pNode = this;
+	const char * pEnd = _pPointer + _Len;
+
+	*_ppLastToken = NULL;
+	*_pLastTokenLength = 0;
+
+	while( _pPointer < pEnd )
+	{
+		if( *_pPointer != '/' || pNode == NULL )
+			return NULL;
+
+		const char * pTokenEnd = ++_pPointer;
+		while( pTokenEnd < pEnd && *pTokenEnd != '/' )
+			++pTokenEnd;
+
+		size_t len = pTokenEnd - _pPointer;
+		const char * token = UnescapePointerToken( _pPointer, len, scratch );
+
+		pParent = pNode;
+		*_ppLastToken = _pPointer;
+		*_pLastTokenLength = pTokenEnd - _pPointer;
+
+		if( pNode->m_Type == JsonNodeType_Object )
+		{
+			pNode = const_cast<JsonNode *>( pNode->GetChild( token, len ) );
+		}
+		else if( pNode->m_Type == JsonNodeType_Array )
+		{
+			size_t index = 0;
+			bool bIsIndex = len > 0 && (len == 1 || token[0] != '0');
+			for( size_t t=0; t<len && bIsIndex; ++t )
+			{
+				bIsIndex = token[t] >= '0' && token[t] <= '9';
+				index = index * 10 + (token[t] - '0');
+			}
+
+			pNode = (bIsIndex && index < pNode->m_Length) ? pNode->GetChild( index ) : NULL;
+		}
+		else
+		{
+			return NULL;
+		}
+
+		_pPointer = pTokenEnd;
+	}
+
+	*_ppParent = pParent;
+	return pNode;
+}
+
+bool JsonDocument::AddAtPointer( const char * _pPointer, size_t _Len, const JsonNode & _Value )
+{
+	JsonNode * pParent = NULL;
+	const char * pToken;
+	size_t tokenLen;
+	JsonNode * pTarget = FindPointer( _pPointer, _Len, &pParent, &pToken, &tokenLen );
+
+	// the whole document gets replaced by a container of the same kind
+	if( _Len == 0 )
+	{
+		if( _Value.m_Type != JsonNodeType_Object && _Value.m_Type != JsonNodeType_Array )
+			return false;
+
+		if( &_Value == this )
+			return true;
+
+		m_Length = 0;
+		m_Type = _Value.m_Type;
+		CloneChildren( *this, _Value );
+		return true;
+	}
+
+	if( pParent == NULL )
+	{
+		// the parent may exist even though the last token doesn't resolve
+		const char * pSlash = _pPointer + _Len;
+		while( pSlash > _pPointer && *(pSlash-1) != '/' )
+			--pSlash;
+
+		if( pSlash == _pPointer )
+			return false;
+
+		const char * pDummy;
+		size_t dummyLen;
+		JsonNode * pGrandParent;
+		pParent = FindPointer( _pPointer, pSlash - 1 - _pPointer, &pGrandParent, &pDummy, &dummyLen );
+		pToken = pSlash;
+		tokenLen = _pPointer + _Len - pSlash;
+
+		if( pParent == NULL )
+			return false;
+	}
+
+	if( pParent->m_Type == JsonNodeType_Object )
+	{
+		std::vector<char> scratch;
+		size_t nameLen = tokenLen;
+		const char * pName = UnescapePointerToken( pToken, nameLen, scratch );
+
+		// adding an existing key replaces its value in place
+		if( pTarget )
+			pParent->ReplaceChild( pParent->FindChildIndex( pTarget ), _Value );
+		else
+			pParent->CopyNode( *this, pName, nameLen, _Value );
+
+		return true;
+	}
+
+	if( pParent->m_Type == JsonNodeType_Array )
+	{
+		size_t index = pParent->m_Length;
+		if( tokenLen != 1 || *pToken != '-' )
+		{
+			index = 0;
+			for( size_t t=0; t<tokenLen; ++t )
+			{
+				if( pToken[t] < '0' || pToken[t] > '9' )
+					return false;
+				index = index * 10 + (pToken[t] - '0');
+			}
+
+			if( index > pParent->m_Length )
+				return false;
+		}
+
+		// the copy is appended, then rotated into place
+		pParent->CopyNode( *this, NULL, 0, _Value );
+		pParent->MoveLastChildTo( index );
+		return true;
+	}
+
+	return false;
+}
+
+bool JsonDocument::RemoveAtPointer( const char * _pPointer, size_t _Len, JsonNode ** _ppRemoved )
+{
+	JsonNode * pParent = NULL;
+	const char * pToken;
+	size_t tokenLen;
+	JsonNode * pTarget = FindPointer( _pPointer, _Len, &pParent, &pToken, &tokenLen );
+
+	if( pTarget == NULL || pParent == NULL )
+		return false;
+
+	// the node itself stays valid in the document storage until the next Reset
+	pParent->RemoveChild( pParent->FindChildIndex( pTarget ) );
+
+	if( _ppRemoved )
+		*_ppRemoved = pTarget;
+
+	return true;
+}
+
+bool JsonNode::IsEqual( const JsonNode & _Other ) const
+{
+	if( GetType() != _Other.GetType() )
+		return false;
+
+	switch( GetType() )
+	{
+	case JsonNodeType_Bool:		return GetBool() == _Other.GetBool();
+	case JsonNodeType_Number:	return GetNumber() == _Other.GetNumber();
+	case JsonNodeType_String:	return GetStringLength() == _Other.GetStringLength() && !memcmp( GetString(), _Other.GetString(), GetStringLength() );
+	case JsonNodeType_Array:
+	case JsonNodeType_Object:
+		{
+			if( GetNbChildren() != _Other.GetNbChildren() )
+				return false;
+
+			if( IsPacked() && _Other.IsPacked() )
+			{
+				for( size_t n=0; n<m_Length; ++n )
+					if( GetNumbers()[n] != _Other.GetNumbers()[n] )
+						return false;
+				return true;
+			}
+
+			const_iterator iter = begin();
+			const_iterator iterOther = _Other.begin();
+			for( ; iter != end(); ++iter, ++iterOther )
+			{
+				// keys usually come in the same order: the lookup by name is only needed when they don't
+				const JsonNode * pOther = *iterOther;
+				if( GetType() == JsonNodeType_Object && ((*iter)->GetNameLength() != pOther->GetNameLength() || memcmp( (*iter)->GetName(), pOther->GetName(), pOther->GetNameLength() )) )
+					pOther = _Other.GetChild( (*iter)->GetName(), (*iter)->GetNameLength() );
+
+				if( !pOther || !(*iter)->IsEqual( *pOther ) )
+					return false;
+			}
+			return true;
+		}
+	default:					return true;
+	}
+}
+
+bool JsonDocument::ApplyPatch( const JsonNode & _Patch )
+{
+	ASSERT( !m_bFrozen, "Cannot modify a frozen document" );
+	ASSERT( _Patch.GetType() == JsonNodeType_Array, "A patch is an array of operations" );
+
+	for( const_iterator iter = _Patch.begin(); iter != _Patch.end(); ++iter )
+	{
+		const JsonNode & operation = **iter;
+		if( operation.GetType() != JsonNodeType_Object )
+			return false;
+
+		const JsonNode * pOp = operation.GetChild( "op", 2 );
+		const JsonNode * pPath = operation.GetChild( "path", 4 );
+		const JsonNode * pValue = operation.GetChild( "value", 5 );
+		const JsonNode * pFrom = operation.GetChild( "from", 4 );
+		if( !pOp || !pPath || pOp->GetType() != JsonNodeType_String || pPath->GetType() != JsonNodeType_String )
+			return false;
+
+		const char * pOpName = pOp->GetString();
+		size_t opLen = pOp->GetStringLength();
+		const char * pPointer = pPath->GetString();
+		size_t pointerLen = pPath->GetStringLength();
+
+		bool bOK;
+		if( opLen == 3 && !memcmp( pOpName, "add", 3 ) )
+		{
+			bOK = pValue && AddAtPointer( pPointer, pointerLen, *pValue );
+		}
+		else if( opLen == 6 && !memcmp( pOpName, "remove", 6 ) )
+		{
+			bOK = RemoveAtPointer( pPointer, pointerLen, NULL );
+		}
+		else if( opLen == 7 && !memcmp( pOpName, "replace", 7 ) )
+		{
+			// adding to an existing key already replaces in place, array items are removed first
+			JsonNode * pParent = NULL;
+			const char * pToken;
+			size_t tokenLen;
+			bOK = pValue && FindPointer( pPointer, pointerLen, &pParent, &pToken, &tokenLen ) != NULL;
+
+			if( bOK && pParent && pParent->m_Type == JsonNodeType_Array )
+				bOK = RemoveAtPointer( pPointer, pointerLen, NULL );
+
+			bOK = bOK && AddAtPointer( pPointer, pointerLen, *pValue );
+		}
+		else if( opLen == 4 && (!memcmp( pOpName, "move", 4 ) || !memcmp( pOpName, "copy", 4 )) )
+		{
+			JsonNode * pParent;
+			const char * pToken;
+			size_t tokenLen;
+			JsonNode * pSource = NULL;
+
+			if( !pFrom || pFrom->GetType() != JsonNodeType_String )
+				bOK = false;
+			else if( pOpName[0] == 'm' )
+				bOK = RemoveAtPointer( pFrom->GetString(), pFrom->GetStringLength(), &pSource );
+			else
+				bOK = (pSource = FindPointer( pFrom->GetString(), pFrom->GetStringLength(), &pParent, &pToken, &tokenLen )) != NULL;
+
+			bOK = bOK && AddAtPointer( pPointer, pointerLen, *pSource );
+		}
+		else if( opLen == 4 && !memcmp( pOpName, "test", 4 ) )
+		{
+			JsonNode * pParent;
+			const char * pToken;
+			size_t tokenLen;
+			JsonNode * pTarget = FindPointer( pPointer, pointerLen, &pParent, &pToken, &tokenLen );
+
+			bOK = pValue && pTarget && pTarget->IsEqual( *pValue );
+		}
+		else
+		{
+			bOK = false;
+		}
+
+		if( !bOK )
+			return false;
+	}
+
+	return true;
+}
+
+JsonNode * JsonDocument::AllocateNode()
+{
+	// move on to the next block with room left, creating one if needed
+	while( m_CurrNodeBlock < m_NodeBlocks.size() && m_CurrNodeOffset == m_NodeBlocks[m_CurrNodeBlock].Size )
+	{
+		++m_CurrNodeBlock;
+		m_CurrNodeOffset = 0;
+	}
+
+	if( m_CurrNodeBlock == m_NodeBlocks.size() )
+	{
+		NodeBlock block;
+		block.Size = NodeBlockSize;
+		block.pNodes = new JsonNode [block.Size];
+		m_NodeBlocks.push_back( block );
+	}
+
+	++m_NbNodes;
+	return &m_NodeBlocks[m_CurrNodeBlock].pNodes[ m_CurrNodeOffset++ ];
+}
+
+// the smallest power of two capacity class holding _Capacity
+static size_t GetChildCapacityClass( size_t _Capacity )
+{
+	size_t capacityClass = 0;
+	while( ((size_t) 1 << capacityClass) < _Capacity )
+		++capacityClass;
+
+	return capacityClass;
+}
+
+JsonNode ** JsonDocument::AllocateChildren( size_t _Capacity )
+{
+	// an outgrown array of the class is reused first: its capacity is at least the class size
+	size_t capacityClass = GetChildCapacityClass( _Capacity );
+	if( capacityClass < m_FreeChildren.size() && m_FreeChildren[capacityClass] )
+	{
+		JsonNode ** ppChildren = m_FreeChildren[capacityClass];
+		m_FreeChildren[capacityClass] = reinterpret_cast<JsonNode **>( ppChildren[0] );
+		return ppChildren;
+	}
+
+	size_t * pArray = reinterpret_cast<size_t *>( AllocateStorage( (_Capacity + 1) * sizeof(JsonNode *), sizeof(JsonNode *) ) );
+	pArray[0] = _Capacity;
+
+	return reinterpret_cast<JsonNode **>( pArray + 1 );
+}
+
+void JsonDocument::ReleaseChildren( JsonNode ** _ppChildren )
+{
+	// arrays are filed under the largest class they can serve
+	size_t capacity = reinterpret_cast<const size_t *>( _ppChildren )[-1];
+	size_t capacityClass = GetChildCapacityClass( capacity );
+	if( ((size_t) 1 << capacityClass) > capacity )
+		--capacityClass;
+
+	if( capacityClass >= m_FreeChildren.size() )
+		m_FreeChildren.resize( capacityClass + 1, NULL );
+
+	_ppChildren[0] = reinterpret_cast<JsonNode *>( m_FreeChildren[capacityClass] );
+	m_FreeChildren[capacityClass] = _ppChildren;
+}
+
+char * JsonDocument::AllocateStorage( size_t _Size, size_t _Alignment )
+{
+	// move on to the next block big enough, creating one if needed
+	size_t offset = (m_CurrStringOffset + _Alignment - 1) & ~(_Alignment - 1);
+	while( m_CurrStringBlock < m_StringBlocks.size() && offset + _Size > m_StringBlocks[m_CurrStringBlock].Size )
+	{
+		++m_CurrStringBlock;
+		offset = 0;
+	}
+
+	if( m_CurrStringBlock == m_StringBlocks.size() )
+	{
+		StringBlock block;
+		block.Size = _Size > (size_t) StringBlockSize ? _Size : (size_t) StringBlockSize;
+		block.pData = new char [block.Size];
+		m_StringBlocks.push_back( block );
+		offset = 0;
+	}
+
+	char * pData = m_StringBlocks[m_CurrStringBlock].pData + offset;
+	m_CurrStringOffset = offset + _Size;
+	m_NbStorageBytes += _Size;
+
+	return pData;
+}
+
+void JsonDocument::AdoptStorage( JsonDocument & _Source )
+{
+	// the blocks the source has used go before the current ones, where they count as allocated
+	// until the next Reset; its spare blocks go last, as room for the next allocations
+	size_t nbUsedNodeBlocks = _Source.m_CurrNodeBlock + ((_Source.m_CurrNodeBlock < _Source.m_NodeBlocks.size() && _Source.m_CurrNodeOffset > 0) ? 1 : 0);
+	m_NodeBlocks.insert( m_NodeBlocks.begin() + m_CurrNodeBlock, _Source.m_NodeBlocks.begin(), _Source.m_NodeBlocks.begin() + nbUsedNodeBlocks );
+	m_CurrNodeBlock += nbUsedNodeBlocks;
+	m_NodeBlocks.insert( m_NodeBlocks.end(), _Source.m_NodeBlocks.begin() + nbUsedNodeBlocks, _Source.m_NodeBlocks.end() );
+
+	size_t nbUsedStringBlocks = _Source.m_CurrStringBlock + ((_Source.m_CurrStringBlock < _Source.m_StringBlocks.size() && _Source.m_CurrStringOffset > 0) ? 1 : 0);
+	m_StringBlocks.insert( m_StringBlocks.begin() + m_CurrStringBlock, _Source.m_StringBlocks.begin(), _Source.m_StringBlocks.begin() + nbUsedStringBlocks );
+	m_CurrStringBlock += nbUsedStringBlocks;
+	m_StringBlocks.insert( m_StringBlocks.end(), _Source.m_StringBlocks.begin() + nbUsedStringBlocks, _Source.m_StringBlocks.end() );
+
+	m_NbNodes += _Source.m_NbNodes;
+	m_NbPackedNumbers += _Source.m_NbPackedNumbers;
+	m_NbStorageBytes += _Source.m_NbStorageBytes;
+
+	// the source is left empty, with nothing to free
+	_Source.m_NodeBlocks.clear();
+	_Source.m_StringBlocks.clear();
+	_Source.m_FreeChildren.clear();
+	_Source.m_Value.Children = NULL;
+	_Source.m_Length = 0;
+	_Source.m_Flags &= ~Flag_PackedNumbers;
+}
+
+JsonTokenizer::ParseResult JsonDocument::ParseContainer( JsonNode & _Container, const char * _pBegin, const char ** _ppEnd, size_t * _pNbDroppedNodes )
+{
+	ASSERT( !m_bFrozen, "Cannot modify a frozen document" );
+	ASSERT( (_Container.m_Type == JsonNodeType_Object && *_pBegin == '{') || (_Container.m_Type == JsonNodeType_Array && *_pBegin == '['), "A container is parsed again with its own type" );
+
+	// the dropped nodes no longer count toward the limits, even though their storage isn't reused
+	size_t nbNodes = 0;
+	size_t nbPackedNumbers = 0;
+	size_t nbStorageBytes = 0;
+	_Container.MeasureSubtree( nbNodes, nbPackedNumbers, nbStorageBytes );
+	m_NbNodes -= nbNodes;
+	m_NbPackedNumbers -= nbPackedNumbers;
+	m_NbStorageBytes -= (nbStorageBytes < m_NbStorageBytes) ? nbStorageBytes : m_NbStorageBytes;
+	*_pNbDroppedNodes = nbNodes;
+
+	// the child array is kept for the new children
+	_Container.m_Length = 0;
+	_Container.m_Flags &= ~Flag_PackedNumbers;
+
+	m_pCurrPair = NULL;
+	m_pCurrObject = NULL;
+	m_pCurrName = NULL;
+	m_CurrNameLength = 0;
+	m_bUseNextStringAsKey = true;
+	m_pKeySetOwner = NULL;
+	m_bRejected = false;
+	m_bStopped = false;
+	m_Error = JsonParseError();
+
+	// the depth limit still counts from the root of the document
+	m_Depth = 0;
+	for( const JsonNode * pParent = _Container.m_pParent; pParent; pParent = pParent->m_pParent )
+		++m_Depth;
+
+	// the learned shape describes whole documents only
+	unsigned int options = m_Options;
+	m_Options &= ~JsonTokenizer::Option_LearnShape;
+	m_pParseRoot = &_Container;
+
+	JsonTokenizer::ParseResult result = (*_pBegin == '[') ? ReadArray( *this, _pBegin, _ppEnd ) : ReadObject( *this, _pBegin, _ppEnd );
+
+	m_pParseRoot = this;
+	m_Options = options;
+	m_Depth = 0;
+
+	return m_bRejected ? JsonTokenizer::ParseError : result;
+}
+
+char * JsonDocument::AllocateString( const char * _pBegin, size_t _Len )
+{
+	char * pString = AllocateStorage( _Len + 1, 1 );
+
+	memcpy( pString, _pBegin, _Len );
+	pString[_Len] = 0;
+
+	return pString;
+}
+
+JsonParseMode JsonDocument::GetMode() const
+{
+	return m_Mode;
+}
+
+JsonNode * JsonDocument::AddParsedNode( JsonNodeType _Type, const char * _pParam1 )
+{
+	ASSERT( (m_pCurrName && m_pCurrObject->m_Type == JsonNodeType_Object) || (!m_pCurrName && m_pCurrObject->m_Type == JsonNodeType_Array), "Wrong node type/name combination" );
+
+	// in borrow mode, the key name is a view straight into the source buffer
+	const char * pName = m_pCurrName;
+	bool bBorrowName = m_Mode == JsonParseMode_BorrowBuffer;
+
+	// a key predicted by the shape is borrowed from it instead of being copied
+	const JsonShape::Entry * pPredicted = NULL;
+	if( m_pShape && (m_Options & JsonTokenizer::Option_LearnShape) )
+	{
+		pPredicted = m_pShape->Match( m_pCurrName, m_CurrNameLength );
+		if( pPredicted && pPredicted->pName )
+		{
+			pName = pPredicted->pName;
+			bBorrowName = true;
+		}
+	}
+
+	JsonNode * pNode = m_pCurrObject->CreateNode( *this, pName, m_CurrNameLength, bBorrowName, _Type );
+	if( pPredicted && pPredicted->NbChildren )
+		pNode->ReserveChildren( *this, pPredicted->NbChildren );
+
+	// the node is kept so the tree stays consistent until the tokenizer stops
+	if( IsOverLimits() )
+		RejectOverLimits( _pParam1 );
+
+	return pNode;
+}
+
+void JsonDocument::Reject( const char * _pLocation, JsonParseErrorCode _Code, const char * _pMessage )
+{
+	if( !m_bRejected )
+		SetError( _pLocation, _Code, JsonValidateError_None, _pMessage );
+
+	m_bRejected = true;
+	Stop();
+}
+
+void JsonDocument::RejectOverLimits( const char * _pLocation )
+{
+	if( m_NbNodes + m_NbPackedNumbers > m_MaxNodes )
+		Reject( _pLocation, JsonParseError_TooManyNodes, "Too many nodes" );
+	else
+		Reject( _pLocation, JsonParseError_MemoryLimit, "Memory limit exceeded" );
+}
+
+void JsonDocument::SetError( const char * _pLocation, JsonParseErrorCode _Code, JsonValidateError _Syntax, const char * _pMessage )
+{
+	// what follows the first error is usually a consequence of it
+	if( m_Error.Code != JsonParseError_None )
+		return;
+
+	m_Error.Code = _Code;
+	m_Error.Syntax = _Syntax;
+	m_Error.Offset = GetInputOffset( _pLocation );
+	m_Error.Depth = GetDepth();
+	m_Error.pMessage = _pMessage;
+}
+
+bool JsonDocument::IsOverLimits() const
+{
+	return m_NbNodes + m_NbPackedNumbers > m_MaxNodes || m_NbNodes * sizeof(JsonNode) + m_NbStorageBytes > m_MaxMemory;
+}
+
+void JsonDocument::OnBeginObject( const char * _pParam1 )
+{
+	if( m_pCurrObject == NULL )
+	{
+		m_pCurrObject = m_pParseRoot;
+		m_pCurrPair = NULL;
+		m_pCurrObject->m_Type = JsonNodeType_Object;
+
+		if( m_pShape && (m_Options & JsonTokenizer::Option_LearnShape) )
+			ReserveChildren( *this, m_pShape->GetNbRootChildren() );
+	}
+	else
+	{
+		m_pCurrObject = AddParsedNode( JsonNodeType_Object, _pParam1 );
+	}
+}
+
+void JsonDocument::OnEndObject( const char * _pParam1 )
+{
+	if( (m_Options & JsonTokenizer::Option_DuplicateKeyPolicy) && !ApplyKeyPolicy( *m_pCurrObject ) && !m_bRejected )
+	{
+		Reject( _pParam1, JsonParseError_DuplicateKey, "Duplicate key in object" );
+	}
+
+	m_pCurrObject = m_pCurrObject->GetParent();
+}
+
+void JsonDocument::OnBeginArray( const char * _pParam1 )
+{
+	if( m_pCurrObject == NULL )
+	{
+		m_pCurrObject = m_pParseRoot;
+		m_pCurrPair = NULL;
+		m_pCurrObject->m_Type = JsonNodeType_Array;
+
+		if( m_pShape && (m_Options & JsonTokenizer::Option_LearnShape) )
+			ReserveChildren( *this, m_pShape->GetNbRootChildren() );
+	}
+	else
+	{
+		m_pCurrPair = AddParsedNode( JsonNodeType_Array, _pParam1 );
+		m_pCurrObject = m_pCurrPair;
+	}
+}
+
+void JsonDocument::OnEndArray( const char * _pParam1 )
+{
+	m_pCurrObject = m_pCurrObject->GetParent();
+}
+
+void JsonDocument::OnNewArrayItem( const char * _pParam1 )
+{
+	m_bUseNextStringAsKey = false;
+	m_pCurrName = NULL;
+	m_CurrNameLength = 0;
+}
+
+void JsonDocument::OnBeginPair( const char * _pParam1 )
+{
+	m_bUseNextStringAsKey = true;
+	m_pCurrName = NULL;
+	m_CurrNameLength = 0;
+}
+
+void JsonDocument::OnEndPair( const char * _pParam1 )
+{
+}
+
+void JsonDocument::OnString( const char * _pParam1, const char * _pParam2 )
+{
+	size_t len = _pParam2 - _pParam1 - 2;
+
+	if( m_bUseNextStringAsKey )
+	{
+		// the key stays in the source buffer until its value is read; it only gets copied by CreateNode
+		m_pCurrName = _pParam1 + 1;
+		m_CurrNameLength = len;
+		m_bUseNextStringAsKey = false;
+
+		if( len > m_MaxKeyLength )
+		{
+			Reject( _pParam1, JsonParseError_KeyTooLong, "Key name too long" );
+			m_CurrNameLength = m_MaxKeyLength;
+		}
+	}
+	else if( len > m_MaxStringLength )
+	{
+		// refused before anything gets copied
+		Reject( _pParam1, JsonParseError_StringTooLong, "String too long" );
+	}
+	else
+	{
+		// escape sequences are kept verbatim, so even escaped strings can be borrowed as is
+		m_pCurrPair = AddParsedNode( JsonNodeType_String, _pParam1 );
+		m_pCurrPair->SetStringValue( *this, _pParam1 + 1, len, m_Mode == JsonParseMode_BorrowBuffer );
+
+		if( IsOverLimits() )
+			Reject( _pParam1, JsonParseError_MemoryLimit, "Memory limit exceeded" );
+	}
+}
+
+void JsonDocument::OnNumber( const char * _pParam1, const char * _pParam2 )
+{
+	size_t size = _pParam2 - _pParam1;
+	if( size > m_MaxStringLength )
+	{
+		// the tokenizer doesn't bound the digits
+		Reject( _pParam1, JsonParseError_NumberTooLong, "Number too long" );
+		return;
+	}
+
+	// the number is copied to be terminated, on the stack unless it is unusually long
+	char shortText[64];
+	std::string longText;
+	const char * text = shortText;
+	if( size < sizeof(shortText) )
+	{
+		memcpy( shortText, _pParam1, size );
+		shortText[size] = 0;
+	}
+	else
+	{
+		longText.assign( _pParam1, size );
+		text = longText.c_str();
+	}
+
+	// numbers opening an array stay packed until something else comes in
+	JsonNode & parent = *m_pCurrObject;
+	if( (m_Options & JsonTokenizer::Option_PackNumbers) && parent.m_Type == JsonNodeType_Array && (parent.m_Length == 0 || (parent.m_Flags & Flag_PackedNumbers)) )
+	{
+		parent.PushNumber( *this, (float) atof(text) );
+		++m_NbPackedNumbers;
+
+		if( IsOverLimits() )
+			RejectOverLimits( _pParam1 );
+		return;
+	}
+
+	m_pCurrPair = AddParsedNode( JsonNodeType_Number, _pParam1 );
+	m_pCurrPair->m_Value.Number = (float) atof(text);
+}
+
+void JsonDocument::OnNull( const char * _pParam1, const char * _pParam2 )
+{
+	m_pCurrPair = AddParsedNode( JsonNodeType_Null, _pParam1 );
+	m_pCurrPair->m_Value.String = NULL;
+}
+
+void JsonDocument::OnTrue( const char * _pParam1, const char * _pParam2 )
+{
+	m_pCurrPair = AddParsedNode( JsonNodeType_Bool, _pParam1 );
+	m_pCurrPair->m_Value.Bool = true;
+}
+
+void JsonDocument::OnFalse( const char * _pParam1, const char * _pParam2 )
+{
+	m_pCurrPair = AddParsedNode( JsonNodeType_Bool, _pParam1 );
+	m_pCurrPair->m_Value.Bool = false;
+}
+
+void JsonDocument::OnError( const char * _pParam1, const char * _pParam2, const char * _pParam3 )
+{
+	// the tokenizer reports its grammar errors through OnSyntaxError: what is left are stream failures
+	SetError( _pParam2, JsonParseError_ReadError, JsonValidateError_None, _pParam3 );
+}
+
+void JsonDocument::OnSyntaxError( const char * _pParam1, const char * _pParam2, const char * _pParam3, JsonValidateError _Error )
+{
+	SetError( _pParam2, _Error == JsonValidateError_TooDeep ? JsonParseError_TooDeep : JsonParseError_Syntax, _Error, _pParam3 );
+}
+
+const JsonParseError & JsonDocument::GetError() const
+{
+	return m_Error;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+// murmur3 finalizer: every input bit affects every output bit
+static unsigned long long MixHash( unsigned long long _Hash )
+{
+	_Hash ^= _Hash >> 33;
+	_Hash *= 0xFF51AFD7ED558CCDULL;
+	_Hash ^= _Hash >> 33;
+	_Hash *= 0xC4CEB9FE1A85EC53ULL;
+	_Hash ^= _Hash >> 33;
+	return _Hash;
+}
+
+static unsigned long long HashBytes( const char * _pData, size_t _Len, unsigned long long _Seed )
+{
+	unsigned long long hash = _Seed ^ (_Len * 0x9E3779B97F4A7C15ULL);
+
+	for( ; _Len >= 8; _Len -= 8, _pData += 8 )
+	{
+		unsigned long long word;
+		memcpy( &word, _pData, 8 );
+		hash = MixHash( hash ^ word );
+	}
+
+	unsigned long long tail = 0;
+	memcpy( &tail, _pData, _Len );
+	return MixHash( hash ^ tail );
+}
+
+// pointer -> subtree hash, open addressing
+class JsonNodeHashTable
+{
+	struct Entry
+	{
+		const JsonNode * pNode;
+		unsigned long long Hash;
+	};
+
+	std::vector<Entry> m_Entries;
+	size_t m_NbEntries;
+
+	static size_t Slot( const JsonNode * _pNode, size_t _Mask )	{ return (size_t) MixHash( (unsigned long long) (size_t) _pNode ) & _Mask; }
+
+public:
+	JsonNodeHashTable() : m_NbEntries( 0 ) {}
+
+	void Insert( const JsonNode * _pNode, unsigned long long _Hash )
+	{
+		if( 2 * (m_NbEntries + 1) > m_Entries.size() )
+		{
+			std::vector<Entry> old;
+			old.swap( m_Entries );
+
+			Entry empty = { NULL, 0 };
+			m_Entries.resize( old.empty() ? 64 : old.size() * 2, empty );
+			m_NbEntries = 0;
+
+			for( size_t e=0; e<old.size(); ++e )
+				if( old[e].pNode )
+					Insert( old[e].pNode, old[e].Hash );
+		}
+
+		size_t mask = m_Entries.size() - 1;
+		size_t slot = Slot( _pNode, mask );
+		while( m_Entries[slot].pNode )
+			slot = (slot + 1) & mask;
+
+		m_Entries[slot].pNode = _pNode;
+		m_Entries[slot].Hash = _Hash;
+		++m_NbEntries;
+	}
+
+	unsigned long long Find( const JsonNode * _pNode ) const
+	{
+		size_t mask = m_Entries.size() - 1;
+		size_t slot = Slot( _pNode, mask );
+		while( m_Entries[slot].pNode != _pNode )
+			slot = (slot + 1) & mask;
+
+		return m_Entries[slot].Hash;
+	}
+};
+
+JsonKeySet & JsonDocument::GetKeySet()
+{
+	if( m_pKeySet == NULL )
+		m_pKeySet = new JsonKeySet;
+
+	return *m_pKeySet;
+}
+
+bool JsonDocument::ApplyKeyPolicy( JsonNode & _Object )
+{
+	JsonNode ** children = _Object.m_Value.Children;
+	size_t nbChildren = _Object.m_Length;
+	if( nbChildren < 2 )
+		return true;
+
+	JsonKeySet & keys = GetKeySet();
+	keys.Clear( nbChildren );
+	m_pKeySetOwner = NULL;
+
+	// kept children are compacted at the front, in their original order
+	size_t nbKept = 0;
+	for( size_t c=0; c<nbChildren; ++c )
+	{
+		JsonNode * pChild = children[c];
+		unsigned long long hash = JsonKeySet::Hash( pChild->m_pName, pChild->m_NameLength );
+		size_t existing = keys.Find( children, hash, pChild->m_pName, pChild->m_NameLength );
+
+		if( existing == JsonKeySet::NotFound )
+		{
+			children[nbKept] = pChild;
+			keys.Insert( hash, nbKept++ );
+		}
+		else if( m_Options & JsonTokenizer::Option_RejectDuplicateKeys )
+			return false;
+		else if( m_Options & JsonTokenizer::Option_KeepLastKey )
+			children[existing] = pChild;
+	}
+
+	_Object.m_Length = (unsigned int) nbKept;
+	return true;
+}
+
+JsonNode * JsonDocument::CreateKeyedNode( JsonNode & _Object, const char * _pName, size_t _NameLength, bool _bBorrowName, JsonNodeType _Type )
+{
+	ASSERT( _Object.m_Type == JsonNodeType_Object, "Wrong node type. Not an Object" );
+
+	JsonKeySet & keys = GetKeySet();
+
+	// anything but appending through Add* since the last call means the set is stale
+	JsonNode ** children = _Object.m_Value.Children;
+	if( m_pKeySetOwner != &_Object || m_NbKeySetChildren != _Object.m_Length )
+	{
+		keys.Clear( _Object.m_Length );
+		for( size_t c=0; c<_Object.m_Length; ++c )
+		{
+			const JsonNode * pChild = children[c];
+			unsigned long long hash = JsonKeySet::Hash( pChild->m_pName, pChild->m_NameLength );
+			if( keys.Find( children, hash, pChild->m_pName, pChild->m_NameLength ) == JsonKeySet::NotFound )
+				keys.Insert( hash, c );
+		}
+		m_pKeySetOwner = &_Object;
+	}
+
+	unsigned long long hash = JsonKeySet::Hash( _pName, _NameLength );
+	size_t existing = _Object.m_Length == 0 ? (size_t) JsonKeySet::NotFound : keys.Find( children, hash, _pName, _NameLength );
+	if( existing != JsonKeySet::NotFound && (m_Options & JsonTokenizer::Option_RejectDuplicateKeys) )
+		return NULL;
+
+	// the child array may move while growing
+	JsonNode * pNode = _Object.CreateNode( *this, _pName, _NameLength, _bBorrowName, _Type );
+	children = _Object.m_Value.Children;
+
+	if( existing == JsonKeySet::NotFound )
+		keys.Insert( hash, _Object.m_Length - 1 );
+	else
+	{
+		// keep first: the node is left out of the object and its value simply goes nowhere
+		--_Object.m_Length;
+		if( m_Options & JsonTokenizer::Option_KeepLastKey )
+			children[existing] = pNode;
+	}
+
+	m_NbKeySetChildren = _Object.m_Length;
+	return pNode;
+}
+
+static unsigned long long HashNumber( float _Number )
+{
+	unsigned int bits;
+	memcpy( &bits, &_Number, sizeof(bits) );
+	return MixHash( MixHash( (unsigned long long) JsonNodeType_Number + 1 ) ^ bits );
+}
+
+static unsigned long long HashSubtree( const JsonNode & _Node, JsonNodeHashTable * _pTable )
+{
+	unsigned long long hash = MixHash( (unsigned long long) _Node.GetType() + 1 );
+
+	switch( _Node.GetType() )
+	{
+	case JsonNodeType_Bool:
+		hash = MixHash( hash ^ (_Node.GetBool() ? 1 : 2) );
+		break;
+
+	case JsonNodeType_Number:
+		hash = HashNumber( _Node.GetNumber() );
+		break;
+
+	case JsonNodeType_String:
+		hash = HashBytes( _Node.GetString(), _Node.GetStringLength(), hash );
+		break;
+
+	case JsonNodeType_Array:
+		// packed numbers hash as their nodes would, and have no node to enter in the table
+		if( _Node.IsPacked() )
+		{
+			const float * pNumbers = _Node.GetNumbers();
+			for( size_t n=0; n<_Node.GetNbChildren(); ++n )
+				hash = MixHash( hash ^ HashNumber( pNumbers[n] ) ) * 0x9E3779B97F4A7C15ULL;
+			break;
+		}
+
+		for( JsonNode::const_iterator iter = _Node.begin(); iter != _Node.end(); ++iter )
+			hash = MixHash( hash ^ HashSubtree( **iter, _pTable ) ) * 0x9E3779B97F4A7C15ULL;
+		break;
+
+	case JsonNodeType_Object:
+		{
+			// pairs are combined with a sum so that the key order doesn't matter
+			unsigned long long pairs = 0;
+			for( JsonNode::const_iterator iter = _Node.begin(); iter != _Node.end(); ++iter )
+				pairs += MixHash( HashBytes( (*iter)->GetName(), (*iter)->GetNameLength(), 0 ) ^ HashSubtree( **iter, _pTable ) );
+			hash = MixHash( hash ^ pairs );
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	if( _pTable )
+		_pTable->Insert( &_Node, hash );
+
+	return hash;
+}
+
+unsigned long long JsonNode::GetHash() const
+{
+	return HashSubtree( *this, NULL );
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+class JsonDiffer
+{
+	JsonNodeHashTable m_FromHashes;
+	JsonNodeHashTable m_ToHashes;
+	JsonDocument * m_pPatch;
+	std::vector<char> m_Path;
+
+	void PushToken( const char * _pToken, size_t _Len )
+	{
+		m_Path.push_back( '/' );
+		for( size_t c=0; c<_Len; ++c )
+		{
+			if( _pToken[c] == '~' )			{ m_Path.push_back( '~' ); m_Path.push_back( '0' ); }
+			else if( _pToken[c] == '/' )	{ m_Path.push_back( '~' ); m_Path.push_back( '1' ); }
+			else							{ m_Path.push_back( _pToken[c] ); }
+		}
+	}
+
+	void PushIndex( size_t _Index )
+	{
+		char text[32];
+		int len = sprintf( text, "%u", (unsigned int) _Index );
+		PushToken( text, len );
+	}
+
+	void PopToken( size_t _PathLength )
+	{
+		m_Path.resize( _PathLength );
+	}
+
+	// the numbers of a packed array are not in the tables: they hash as their nodes would
+	static unsigned long long GetChildHash( const JsonNodeHashTable & _Hashes, const JsonNode & _Array, size_t _Index )
+	{
+		return _Array.IsPacked() ? HashNumber( _Array.GetNumbers()[_Index] ) : _Hashes.Find( _Array.GetChild( _Index ) );
+	}
+
+	JsonNode * AddOperation( const char * _pOp, const JsonNode * _pValue )
+	{
+		JsonNode * pOperation = m_pPatch->AddObject( NULL );
+		pOperation->AddString( "op", _pOp );
+		pOperation->AddString( "path", m_Path.empty() ? "" : &m_Path[0], m_Path.size() );
+		if( _pValue )
+			pOperation->AddCopy( "value", *_pValue );
+		return pOperation;
+	}
+
+	// the numbers of a packed array have no node to copy
+	void AddChildOperation( const char * _pOp, const JsonNode & _Array, size_t _Index )
+	{
+		if( _Array.IsPacked() )
+			AddOperation( _pOp, NULL )->AddNumber( "value", _Array.GetNumbers()[_Index] );
+		else
+			AddOperation( _pOp, _Array.GetChild( _Index ) );
+	}
+
+	void DiffObjects( const JsonNode & _From, const JsonNode & _To )
+	{
+		// index the keys of _To in an open addressing table of child indices
+		size_t nbSlots = 16;
+		while( nbSlots < 2 * _To.GetNbChildren() )
+			nbSlots *= 2;
+
+		size_t mask = nbSlots - 1;
+		std::vector<size_t> slots( nbSlots, (size_t) -1 );
+		std::vector<bool> matched( _To.GetNbChildren(), false );
+
+		for( size_t c=0; c<_To.GetNbChildren(); ++c )
+		{
+			const JsonNode * pChild = _To.GetChild( c );
+			size_t slot = (size_t) HashBytes( pChild->GetName(), pChild->GetNameLength(), 0 ) & mask;
+			while( slots[slot] != (size_t) -1 )
+				slot = (slot + 1) & mask;
+			slots[slot] = c;
+		}
+
+		size_t pathLength = m_Path.size();
+
+		for( JsonNode::const_iterator iter = _From.begin(); iter != _From.end(); ++iter )
+		{
+			const JsonNode & from = **iter;
+			const JsonNode * pTo = NULL;
+
+			size_t slot = (size_t) HashBytes( from.GetName(), from.GetNameLength(), 0 ) & mask;
+			for( ; slots[slot] != (size_t) -1; slot = (slot + 1) & mask )
+			{
+				const JsonNode * pCandidate = _To.GetChild( slots[slot] );
+				if( pCandidate->GetNameLength() == from.GetNameLength() && !memcmp( pCandidate->GetName(), from.GetName(), from.GetNameLength() ) )
+				{
+					pTo = pCandidate;
+					matched[ slots[slot] ] = true;
+					break;
+				}
+			}
+
+			PushToken( from.GetName(), from.GetNameLength() );
+
+			if( pTo )
+				DiffNodes( from, *pTo );
+			else
+				AddOperation( "remove", NULL );
+
+			PopToken( pathLength );
+		}
+
+		for( size_t c=0; c<_To.GetNbChildren(); ++c )
+		{
+			if( !matched[c] )
+			{
+				const JsonNode * pChild = _To.GetChild( c );
+				PushToken( pChild->GetName(), pChild->GetNameLength() );
+				AddOperation( "add", pChild );
+				PopToken( pathLength );
+			}
+		}
+	}
+
+	void DiffArrays( const JsonNode & _From, const JsonNode & _To )
+	{
+		size_t nbFrom = _From.GetNbChildren();
+		size_t nbTo = _To.GetNbChildren();
+		size_t pathLength = m_Path.size();
+
+		// skip the common head and tail, so that a single insertion or removal anywhere costs one operation
+		size_t head = 0;
+		while( head < nbFrom && head < nbTo && GetChildHash( m_FromHashes, _From, head ) == GetChildHash( m_ToHashes, _To, head ) )
+			++head;
+
+		size_t tail = 0;
+		while( tail < nbFrom - head && tail < nbTo - head && GetChildHash( m_FromHashes, _From, nbFrom-1-tail ) == GetChildHash( m_ToHashes, _To, nbTo-1-tail ) )
+			++tail;
+
+		size_t middleFrom = nbFrom - head - tail;
+		size_t middleTo = nbTo - head - tail;
+		size_t common = middleFrom < middleTo ? middleFrom : middleTo;
+
+		for( size_t i=0; i<common; ++i )
+		{
+			PushIndex( head + i );
+			if( _From.IsPacked() || _To.IsPacked() )
+			{
+				if( GetChildHash( m_FromHashes, _From, head + i ) != GetChildHash( m_ToHashes, _To, head + i ) )
+					AddChildOperation( "replace", _To, head + i );
+			}
+			else
+				DiffNodes( *_From.GetChild( head + i ), *_To.GetChild( head + i ) );
+			PopToken( pathLength );
+		}
+
+		// removals go backwards so that indices stay valid while the patch is applied
+		for( size_t i=middleFrom; i>common; --i )
+		{
+			PushIndex( head + i - 1 );
+			AddOperation( "remove", NULL );
+			PopToken( pathLength );
+		}
+
+		for( size_t i=common; i<middleTo; ++i )
+		{
+			PushIndex( head + i );
+			AddChildOperation( "add", _To, head + i );
+			PopToken( pathLength );
+		}
+	}
+
+	void DiffNodes( const JsonNode & _From, const JsonNode & _To )
+	{
+		if( m_FromHashes.Find( &_From ) == m_ToHashes.Find( &_To ) )
+			return;
+
+		if( _From.GetType() == _To.GetType() && _From.GetType() == JsonNodeType_Object )
+			DiffObjects( _From, _To );
+		else if( _From.GetType() == _To.GetType() && _From.GetType() == JsonNodeType_Array )
+			DiffArrays( _From, _To );
+		else
+			AddOperation( "replace", &_To );
+	}
+
+public:
+	JsonDocument * Diff( const JsonNode & _From, const JsonNode & _To )
+	{
+		HashSubtree( _From, &m_FromHashes );
+		HashSubtree( _To, &m_ToHashes );
+
+		m_pPatch = JsonDocument::Create( JsonParseMode_Copy, JsonNodeType_Array );
+		DiffNodes( _From, _To );
+
+		return m_pPatch;
+	}
+};
+
+JsonDocument * JsonDiff( const JsonNode & _From, const JsonNode & _To )
+{
+	JsonDiffer differ;
+	return differ.Diff( _From, _To );
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+JsonDocumentRef::JsonDocumentRef()
+	: m_pDoc( NULL )
+{
+}
+
+JsonDocumentRef::JsonDocumentRef( JsonDocument * _pDoc )
+	: m_pDoc( _pDoc )
+{
+	if( m_pDoc )
+	{
+		m_pDoc->Freeze();
+		MINJA_ATOMIC_INCREMENT( m_pDoc->m_RefCount );
+	}
+}
+
+JsonDocumentRef::JsonDocumentRef( const JsonDocumentRef & _Other )
+	: m_pDoc( _Other.m_pDoc )
+{
+	if( m_pDoc )
+		MINJA_ATOMIC_INCREMENT( m_pDoc->m_RefCount );
+}
+
+JsonDocumentRef::~JsonDocumentRef()
+{
+	Release();
+}
+
+JsonDocumentRef & JsonDocumentRef::operator = ( const JsonDocumentRef & _Other )
+{
+	// take the new reference first, in case both handles point to the same document
+	if( _Other.m_pDoc )
+		MINJA_ATOMIC_INCREMENT( _Other.m_pDoc->m_RefCount );
+
+	Release();
+	m_pDoc = _Other.m_pDoc;
+
+	return *this;
+}
+
+void JsonDocumentRef::Release()
+{
+	if( m_pDoc && MINJA_ATOMIC_DECREMENT( m_pDoc->m_RefCount ) == 0 )
+		delete m_pDoc;
+
+	m_pDoc = NULL;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+static const unsigned long long HashPrime1 = 0x9E3779B185EBCA87ULL;
+static const unsigned long long HashPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const unsigned long long HashPrime3 = 0x165667B19E3779F9ULL;
+static const unsigned long long HashPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const unsigned long long HashPrime5 = 0x27D4EB2F165667C5ULL;
+
+static unsigned long long RotateLeft( unsigned long long _Value, int _Bits )
+{
+	return (_Value << _Bits) | (_Value >> (64 - _Bits));
+}
+
+static unsigned long long HashRound( unsigned long long _Acc, unsigned long long _Input )
+{
+	return RotateLeft( _Acc + _Input * HashPrime2, 31 ) * HashPrime1;
+}
+
+static unsigned long long HashMergeRound( unsigned long long _Acc, unsigned long long _Lane )
+{
+	return (_Acc ^ HashRound( 0, _Lane )) * HashPrime1 + HashPrime4;
+}
+
+// little endian reads, as the reference implementation
+static unsigned long long ReadHashWord( const char * _pData )
+{
+	unsigned long long word;
+	memcpy( &word, _pData, sizeof(word) );
+	return word;
+}
+
+unsigned long long JsonHashContent( const char * _pBuffer, size_t _Len )
+{
+	const char * pEnd = _pBuffer + _Len;
+	unsigned long long hash;
+
+	if( _Len >= 32 )
+	{
+		// four independent lanes keep the multipliers busy
+		unsigned long long lanes[4] = { HashPrime1 + HashPrime2, HashPrime2, 0, 0 - HashPrime1 };
+		for( ; pEnd - _pBuffer >= 32; _pBuffer += 32 )
+		{
+			lanes[0] = HashRound( lanes[0], ReadHashWord( _pBuffer ) );
+			lanes[1] = HashRound( lanes[1], ReadHashWord( _pBuffer + 8 ) );
+			lanes[2] = HashRound( lanes[2], ReadHashWord( _pBuffer + 16 ) );
+			lanes[3] = HashRound( lanes[3], ReadHashWord( _pBuffer + 24 ) );
+		}
+
+		hash = RotateLeft( lanes[0], 1 ) + RotateLeft( lanes[1], 7 ) + RotateLeft( lanes[2], 12 ) + RotateLeft( lanes[3], 18 );
+		for( int l=0; l<4; ++l )
+			hash = HashMergeRound( hash, lanes[l] );
+	}
+	else
+	{
+		hash = HashPrime5;
+	}
+
+	hash += _Len;
+
+	for( ; pEnd - _pBuffer >= 8; _pBuffer += 8 )
+		hash = RotateLeft( hash ^ HashRound( 0, ReadHashWord( _pBuffer ) ), 27 ) * HashPrime1 + HashPrime4;
+
+	if( pEnd - _pBuffer >= 4 )
+	{
+		unsigned int word;
+		memcpy( &word, _pBuffer, sizeof(word) );
+		hash = RotateLeft( hash ^ (word * HashPrime1), 23 ) * HashPrime2 + HashPrime3;
+		_pBuffer += 4;
+	}
+
+	for( ; _pBuffer < pEnd; ++_pBuffer )
+		hash = RotateLeft( hash ^ ((unsigned char) *_pBuffer * HashPrime5), 11 ) * HashPrime1;
+
+	hash ^= hash >> 33;
+	hash *= HashPrime2;
+	hash ^= hash >> 29;
+	hash *= HashPrime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+JsonParseCache::JsonParseCache( size_t _MaxEntries, unsigned int _Options, const JsonParseLimits & _Limits )
+	: m_MaxEntries( _MaxEntries > 0 ? _MaxEntries : 1 )
+	, m_Options( _Options )
+	, m_Limits( _Limits )
+	, m_NbHits( 0 )
+	, m_NbMisses( 0 )
+{
+}
+
+JsonDocumentRef JsonParseCache::Parse( const char * _pBuffer )
+{
+	return Parse( _pBuffer, strlen( _pBuffer ) );
+}
+
+JsonDocumentRef JsonParseCache::Parse( const char * _pBuffer, size_t _Len )
+{
+	ASSERT( _pBuffer[_Len] == 0, "The input must be null terminated" );
+
+	Key key( JsonHashContent( _pBuffer, _Len ), _Len );
+	{
+#if MINJA_THREADS
+		std::unique_lock<std::mutex> lock( m_Mutex );
+#endif
+		EntryList::iterator found = Find( key, _pBuffer, _Len );
+		if( found != m_Entries.end() )
+		{
+			++m_NbHits;
+			return found->Doc;
+		}
+
+		++m_NbMisses;
+	}
+
+	// other threads keep using the cache meanwhile
+	JsonDocument * pDoc = JsonDocument::Parse( _pBuffer, m_Limits, JsonParseMode_Copy, m_Options );
+	if( pDoc == NULL )
+		return JsonDocumentRef();
+
+	JsonDocumentRef doc( pDoc );
+	JsonDocumentRef evicted;
+	{
+#if MINJA_THREADS
+		std::unique_lock<std::mutex> lock( m_Mutex );
+#endif
+		// a concurrent miss on the same input may have won the race: share its document
+		EntryList::iterator found = Find( key, _pBuffer, _Len );
+		if( found != m_Entries.end() )
+			return found->Doc;
+
+		if( m_Entries.size() >= m_MaxEntries )
+		{
+			EntryList::iterator oldest = --m_Entries.end();
+			std::multimap<Key, EntryList::iterator>::iterator index = m_Index.lower_bound( oldest->HashKey );
+			while( index->second != oldest )
+				++index;
+			m_Index.erase( index );
+
+			// the document is deleted after unlocking, if this was its last handle
+			evicted = oldest->Doc;
+			m_Entries.erase( oldest );
+		}
+
+		m_Entries.push_front( Entry() );
+		Entry & entry = m_Entries.front();
+		entry.HashKey = key;
+		entry.Input.assign( _pBuffer, _Len );
+		entry.Doc = doc;
+		m_Index.insert( std::make_pair( key, m_Entries.begin() ) );
+	}
+
+	return doc;
+}
+
+JsonParseCache::EntryList::iterator JsonParseCache::Find( const Key & _Key, const char * _pBuffer, size_t _Len )
+{
+	// entries sharing a hash and a length are told apart by their input, and a hit becomes the most recent
+	std::multimap<Key, EntryList::iterator>::iterator index = m_Index.lower_bound( _Key );
+	for( ; index != m_Index.end() && index->first == _Key; ++index )
+	{
+		EntryList::iterator entry = index->second;
+		if( !memcmp( entry->Input.data(), _pBuffer, _Len ) )
+		{
+			m_Entries.splice( m_Entries.begin(), m_Entries, entry );
+			return entry;
+		}
+	}
+
+	return m_Entries.end();
+}
+
+void JsonParseCache::Clear()
+{
+#if MINJA_THREADS
+	std::unique_lock<std::mutex> lock( m_Mutex );
+#endif
+	m_Index.clear();
+	m_Entries.clear();
+}
+
+size_t JsonParseCache::GetNbEntries() const
+{
+#if MINJA_THREADS
+	std::unique_lock<std::mutex> lock( m_Mutex );
+#endif
+	return m_Entries.size();
+}
+
+size_t JsonParseCache::GetNbHits() const
+{
+#if MINJA_THREADS
+	std::unique_lock<std::mutex> lock( m_Mutex );
+#endif
+	return m_NbHits;
+}
+
+size_t JsonParseCache::GetNbMisses() const
+{
+#if MINJA_THREADS
+	std::unique_lock<std::mutex> lock( m_Mutex );
+#endif
+	return m_NbMisses;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+JsonElementReader::JsonElementReader( JsonInputStream & _Stream, const char * _pArrayPath, JsonParseMode _Mode, unsigned int _Options )
+	: m_pFramer( new JsonStreamFramer( _Stream ) )
+	, m_pDoc( JsonDocument::Create( _Mode, JsonNodeType_Array ) )
+	, m_NbElements( 0 )
+	, m_bStarted( false )
+	, m_bDone( false )
+	, m_bFailed( false )
+{
+	m_pDoc->SetOptions( _Options );
+
+	std::vector<char> scratch;
+	const char * pCurr = _pArrayPath;
+	while( *pCurr == '/' )
+	{
+		const char * pToken = ++pCurr;
+		while( *pCurr && *pCurr != '/' )
+			++pCurr;
+
+		size_t len = pCurr - pToken;
+		const char * pName = UnescapePointerToken( pToken, len, scratch );
+		m_Path.push_back( std::string( pName, len ) );
+	}
+}
+
+JsonElementReader::~JsonElementReader()
+{
+	delete m_pFramer;
+	delete m_pDoc;
+}
+
+bool JsonElementReader::Start()
+{
+	char container = m_pFramer->Begin();
+	for( size_t p=0; p<m_Path.size() && container == '{'; ++p )
+		container = m_pFramer->EnterKey( m_Path[p].data(), m_Path[p].size() );
+
+	return container == '[';
+}
+
+JsonNode * JsonElementReader::Next()
+{
+	if( m_bDone )
+		return NULL;
+
+	JsonDocument & doc = *m_pDoc;
+	doc.m_Error = JsonParseError();
+
+	if( !m_bStarted )
+	{
+		m_bStarted = true;
+		bool bStarted = Start();
+		m_pFramer->UpdateInputBase( doc );
+		if( !bStarted )
+		{
+			doc.SetError( m_pFramer->GetPosition(), JsonParseError_Syntax, JsonValidateError_BadRoot, "The path doesn't lead to an array" );
+			m_bDone = m_bFailed = true;
+			return NULL;
+		}
+	}
+
+	char * pBegin;
+	char * pEnd;
+	JsonStreamFramer::Result result = m_pFramer->Next( &pBegin, &pEnd );
+	m_pFramer->UpdateInputBase( doc );
+	if( result == JsonStreamFramer::Result_Error )
+	{
+		doc.SetError( m_pFramer->GetPosition(), JsonParseError_Syntax, JsonValidateError_ExpectedArrayEnd, "Unterminated array" );
+		m_bDone = m_bFailed = true;
+		return NULL;
+	}
+
+	// only the last element may be empty, as in ReadArray
+	const char * pElement = JsonTokenizer::SkipWhitespaces( pBegin );
+	if( pElement == pEnd )
+	{
+		m_bDone = true;
+		m_bFailed = (result != JsonStreamFramer::Result_LastChild);
+		if( m_bFailed )
+			doc.SetError( pElement, JsonParseError_Syntax, JsonValidateError_ExpectedValue, "Empty item before a ," );
+		return NULL;
+	}
+
+	// the previous element goes away with its storage, and the element becomes the only item of the root
+	doc.Reset();
+	doc.OnBeginArray( pElement );
+	doc.OnNewArrayItem( pElement );
+
+	const char * pElementEnd;
+	JsonTokenizer::ParseResult parsed = JsonTokenizer::ReadValue( doc, pElement, &pElementEnd );
+	if( parsed != JsonTokenizer::ParseOK || JsonTokenizer::SkipWhitespaces( pElementEnd ) != pEnd || doc.m_bRejected )
+	{
+		doc.SetError( JsonTokenizer::SkipWhitespaces( pElementEnd ), JsonParseError_Syntax, JsonValidateError_ExpectedArrayEnd, "Arrays must end with a ]" );
+		m_bDone = m_bFailed = true;
+		return NULL;
+	}
+
+	doc.EndParse();
+	m_bDone = (result == JsonStreamFramer::Result_LastChild);
+	++m_NbElements;
+	return doc.GetChild( (size_t) 0 );
+}
+
+const JsonParseError & JsonElementReader::GetError() const
+{
+	return m_pDoc->GetError();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+// records the offsets of the containers it builds, in the order of their opening bracket
+class JsonSpanDocument : public JsonDocument
+{
+protected:
+	std::vector<JsonIncrementalParser::Span> m_Spans;
+	std::vector<size_t> m_OpenSpans;
+
+public:
+	JsonSpanDocument() : JsonDocument( JsonParseMode_Copy ) {}
+
+	using JsonDocument::ParseContainer;
+
+	std::vector<JsonIncrementalParser::Span> & GetSpans()		{ return m_Spans; }
+	size_t GetNbNodes() const									{ return m_NbNodes; }
+
+	void BeginSpans()
+	{
+		m_Spans.clear();
+		m_OpenSpans.clear();
+	}
+
+protected:
+	void OpenSpan( const char * _pParam1 )
+	{
+		JsonIncrementalParser::Span span;
+		span.pNode = m_pCurrObject;
+		span.Begin = GetInputOffset( _pParam1 );
+		span.End = span.Begin;
+		span.Parent = m_OpenSpans.empty() ? JsonIncrementalParser::NoSpan : m_OpenSpans.back();
+
+		m_OpenSpans.push_back( m_Spans.size() );
+		m_Spans.push_back( span );
+	}
+
+	// the tokenizer signals the end of a container right after its closing bracket
+	void CloseSpan( const char * _pParam1 )
+	{
+		m_Spans[m_OpenSpans.back()].End = GetInputOffset( _pParam1 ) - 1;
+		m_OpenSpans.pop_back();
+	}
+
+	virtual void OnBeginObject( const char * _pParam1 )		{ JsonDocument::OnBeginObject( _pParam1 ); OpenSpan( _pParam1 ); }
+	virtual void OnEndObject( const char * _pParam1 )		{ CloseSpan( _pParam1 ); JsonDocument::OnEndObject( _pParam1 ); }
+	virtual void OnBeginArray( const char * _pParam1 )		{ JsonDocument::OnBeginArray( _pParam1 ); OpenSpan( _pParam1 ); }
+	virtual void OnEndArray( const char * _pParam1 )		{ CloseSpan( _pParam1 ); JsonDocument::OnEndArray( _pParam1 ); }
+};
+
+const size_t JsonIncrementalParser::NoSpan;
+
+JsonIncrementalParser::JsonIncrementalParser( unsigned int _Options, const JsonParseLimits & _Limits )
+	: m_pDoc( new JsonSpanDocument )
+	, m_MaxBytes( _Limits.MaxBytes ? _Limits.MaxBytes : (size_t) -1 )
+	, m_NbDroppedNodes( 0 )
+	, m_LastParsedLength( 0 )
+	, m_bValid( false )
+{
+	m_pDoc->SetOptions( _Options );
+	m_pDoc->SetLimits( _Limits );
+}
+
+JsonIncrementalParser::~JsonIncrementalParser()
+{
+	delete m_pDoc;
+}
+
+bool JsonIncrementalParser::SetText( const char * _pText, size_t _Len )
+{
+	m_Text.assign( _pText, _Len );
+	return ParseAll();
+}
+
+bool JsonIncrementalParser::Edit( size_t _Offset, size_t _Length, const char * _pText, size_t _TextLength )
+{
+	ASSERT( _Offset <= m_Text.size() && _Length <= m_Text.size() - _Offset, "The edit is out of the text" );
+
+	m_Text.replace( _Offset, _Length, _pText, _TextLength );
+
+	size_t span = m_bValid ? FindSpan( _Offset, _Length ) : NoSpan;
+	if( span == NoSpan || span == 0 || m_NbDroppedNodes > m_pDoc->GetNbNodes() || m_Text.size() > m_MaxBytes )
+		return ParseAll();
+
+	// the closing bracket moves with the edit; offsets wrap around like the text
+	size_t newEnd = m_Spans[span].End + _TextLength - _Length;
+	return ParseSpan( span, newEnd ) || ParseAll();
+}
+
+const JsonDocument * JsonIncrementalParser::GetDocument() const
+{
+	return m_bValid ? m_pDoc : NULL;
+}
+
+const JsonParseError & JsonIncrementalParser::GetError() const
+{
+	return m_pDoc->GetError();
+}
+
+bool JsonIncrementalParser::GetSpan( const JsonNode * _pContainer, size_t * _pBegin, size_t * _pEnd ) const
+{
+	for( size_t s=0; s<m_Spans.size(); ++s )
+	{
+		if( m_Spans[s].pNode == _pContainer )
+		{
+			*_pBegin = m_Spans[s].Begin;
+			*_pEnd = m_Spans[s].End;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool JsonIncrementalParser::ParseAll()
+{
+	m_pDoc->BeginSpans();
+	m_bValid = JsonDocument::ParseInto( *m_pDoc, m_Text.c_str() );
+	m_LastParsedLength = m_Text.size();
+	m_NbDroppedNodes = 0;
+
+	m_Spans.clear();
+	if( m_bValid )
+		m_Spans.swap( m_pDoc->GetSpans() );
+
+	return m_bValid;
+}
+
+bool JsonIncrementalParser::ParseSpan( size_t _Span, size_t _NewEnd )
+{
+	Span & span = m_Spans[_Span];
+
+	// the spans of the container's descendants follow it, up to its old closing bracket
+	size_t last = _Span + 1;
+	while( last < m_Spans.size() && m_Spans[last].Begin < span.End )
+		++last;
+
+	const char * pText = m_Text.c_str();
+	const char * pEnd = pText + span.Begin;
+	size_t nbDropped;
+	m_pDoc->BeginSpans();
+	m_pDoc->SetInputBase( pText, 0 );
+	JsonTokenizer::ParseResult result = m_pDoc->ParseContainer( *span.pNode, pText + span.Begin, &pEnd, &nbDropped );
+	m_LastParsedLength = pEnd - (pText + span.Begin);
+	m_NbDroppedNodes += nbDropped;
+
+	// the container must close on the bracket that closed it before, or the text around it reads differently
+	if( result != JsonTokenizer::ParseOK || pEnd != pText + _NewEnd + 1 )
+		return false;
+
+	std::vector<Span> & spans = m_pDoc->GetSpans();
+	size_t nbOld = last - _Span;
+	size_t nbNew = spans.size();
+	size_t delta = _NewEnd - span.End;
+
+	spans[0].Parent = span.Parent;
+	for( size_t s=1; s<nbNew; ++s )
+		spans[s].Parent += _Span;
+
+	for( size_t a=span.Parent; a!=NoSpan; a=m_Spans[a].Parent )
+		m_Spans[a].End += delta;
+
+	for( size_t s=last; s<m_Spans.size(); ++s )
+	{
+		m_Spans[s].Begin += delta;
+		m_Spans[s].End += delta;
+		if( m_Spans[s].Parent != NoSpan && m_Spans[s].Parent >= last )
+			m_Spans[s].Parent = m_Spans[s].Parent + nbNew - nbOld;
+	}
+
+	m_Spans.erase( m_Spans.begin() + _Span, m_Spans.begin() + last );
+	m_Spans.insert( m_Spans.begin() + _Span, spans.begin(), spans.end() );
+	return true;
+}
+
+size_t JsonIncrementalParser::FindSpan( size_t _Offset, size_t _Length ) const
+{
+	// the last container opened before the edit, then up its ancestors to the first one that
+	// encloses the edit without touching its brackets
+	size_t low = 0;
+	size_t high = m_Spans.size();
+	while( low < high )
+	{
+		size_t mid = (low + high) / 2;
+		if( m_Spans[mid].Begin < _Offset )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if( low == 0 )
+		return NoSpan;
+
+	size_t span = low - 1;
+	while( span != NoSpan && _Offset + _Length > m_Spans[span].End )
+		span = m_Spans[span].Parent;
+
+	return span;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+// close to the written size, and stopped as soon as it goes over _Limit
+static size_t MeasureValue( const JsonNode & _Node, size_t _Limit )
+{
+	switch( _Node.GetType() )
+	{
+	case JsonNodeType_Null:		return 4;
+	case JsonNodeType_Bool:		return 5;
+	case JsonNodeType_Number:	return 16;
+	case JsonNodeType_String:	return _Node.GetStringLength() + 2;
+	case JsonNodeType_Object:
+	case JsonNodeType_Array:
+		break;
+	default:
+		return 0;
+	}
+
+	size_t nbChildren = _Node.GetNbChildren();
+	if( _Node.IsPacked() )
+		return 2 + nbChildren * 17;
+
+	size_t size = 2;
+	for( size_t c=0; c<nbChildren && size <= _Limit; ++c )
+	{
+		const JsonNode & child = *_Node.GetChild( c );
+		if( child.GetName() )
+			size += child.GetNameLength() + 3;
+		size += MeasureValue( child, _Limit ) + 1;
+	}
+
+	return size;
+}
+
+static bool IsHexDigit( char _Char )
+{
+	return (_Char >= '0' && _Char <= '9') || ((_Char | 0x20) >= 'a' && (_Char | 0x20) <= 'f');
+}
+
+// the length of the escape sequence starting at _pString, or 0 when the backslash doesn't open one
+static size_t GetEscapeLength( const char * _pString, size_t _Len )
+{
+	if( _Len < 2 )
+		return 0;
+
+	switch( _pString[1] )
+	{
+	case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+		return 2;
+
+	case 'u':
+		return (_Len >= 6 && IsHexDigit( _pString[2] ) && IsHexDigit( _pString[3] ) && IsHexDigit( _pString[4] ) && IsHexDigit( _pString[5] )) ? 6 : 0;
+
+	default:
+		return 0;
+	}
+}
+
+// strings are stored as written in JSON text: valid escape sequences are kept as they are, while
+// quotes, other backslashes and control characters get escaped, wherever the string comes from
+static void WriteString( const char * _pString, size_t _Len, std::string & _Out )
+{
+	_Out += '"';
+
+	size_t run = 0;
+	for( size_t i=0; i<_Len; ++i )
+	{
+		unsigned char c = (unsigned char) _pString[i];
+		if( c != '"' && c != '\\' && c >= 0x20 )
+			continue;
+
+		size_t escapeLength = c == '\\' ? GetEscapeLength( _pString + i, _Len - i ) : 0;
+		if( escapeLength )
+		{
+			i += escapeLength - 1;
+			continue;
+		}
+
+		_Out.append( _pString + run, i - run );
+		switch( c )
+		{
+		case '"':	_Out += "\\\""; break;
+		case '\\':	_Out += "\\\\"; break;
+		case '\b':	_Out += "\\b"; break;
+		case '\f':	_Out += "\\f"; break;
+		case '\n':	_Out += "\\n"; break;
+		case '\r':	_Out += "\\r"; break;
+		case '\t':	_Out += "\\t"; break;
+		default:
+			{
+				char text[8];
+				_Out.append( text, sprintf( text, "\\u%04x", c ) );
+			}
+			break;
+		}
+		run = i + 1;
+	}
+	_Out.append( _pString + run, _Len - run );
+
+	_Out += '"';
+}
+
+// enough significant digits to read back the same float or double
+static void WriteNumber( double _Value, int _NbDigits, std::string & _Out )
+{
+	// NaN and infinities have no JSON form
+	if( _Value != _Value || _Value - _Value != 0.0 )
+	{
+		_Out += "null";
+		return;
+	}
+
+	char text[32];
+	_Out.append( text, sprintf( text, "%.*g", _NbDigits, _Value ) );
+}
+
+static void WriteNumber( float _Value, std::string & _Out )
+{
+	WriteNumber( _Value, 9, _Out );
+}
+
+static void WriteChildren( const JsonNode & _Container, size_t _First, size_t _Last, std::string & _Out );
+
+static void WriteValue( const JsonNode & _Node, std::string & _Out )
+{
+	switch( _Node.GetType() )
+	{
+	case JsonNodeType_Null:
+		_Out += "null";
+		break;
+
+	case JsonNodeType_Bool:
+		_Out += _Node.GetBool() ? "true" : "false";
+		break;
+
+	case JsonNodeType_Number:
+		WriteNumber( _Node.GetNumber(), _Out );
+		break;
+
+	case JsonNodeType_String:
+		WriteString( _Node.GetString(), _Node.GetStringLength(), _Out );
+		break;
+
+	case JsonNodeType_Object:
+		_Out += '{';
+		WriteChildren( _Node, 0, _Node.GetNbChildren(), _Out );
+		_Out += '}';
+		break;
+
+	case JsonNodeType_Array:
+		_Out += '[';
+		WriteChildren( _Node, 0, _Node.GetNbChildren(), _Out );
+		_Out += ']';
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void WriteChildren( const JsonNode & _Container, size_t _First, size_t _Last, std::string & _Out )
+{
+	// packed arrays are read in place: unpacking them would modify a tree other writers may be reading
+	const float * pNumbers = _Container.GetNumbers();
+	for( size_t c=_First; c<_Last; ++c )
+	{
+		if( c > _First )
+			_Out += ',';
+
+		if( pNumbers )
+		{
+			WriteNumber( pNumbers[c], _Out );
+			continue;
+		}
+
+		const JsonNode & child = *_Container.GetChild( c );
+		if( child.GetName() )
+		{
+			WriteString( child.GetName(), child.GetNameLength(), _Out );
+			_Out += ':';
+		}
+		WriteValue( child, _Out );
+	}
+}
+
+void JsonWriteNode( const JsonNode & _Node, std::string & _Out )
+{
+	_Out.reserve( _Out.size() + MeasureValue( _Node, (size_t) -1 ) );
+	WriteValue( _Node, _Out );
+}
+
+JsonParallelWriter::JsonParallelWriter( size_t _NbThreads, size_t _MinPartSize )
+	: m_NbThreads( _NbThreads ? _NbThreads : 1 )
+	, m_MinPartSize( _MinPartSize ? _MinPartSize : 1 )
+{
+}
+
+void JsonParallelWriter::Write( const JsonNode & _Node, std::string & _Out )
+{
+	const std::vector<Chunk> & chunks = WriteChunks( _Node );
+
+	size_t size = 0;
+	for( size_t c=0; c<chunks.size(); ++c )
+		size += chunks[c].Length;
+
+	_Out.reserve( _Out.size() + size );
+	for( size_t c=0; c<chunks.size(); ++c )
+		_Out.append( chunks[c].pData, chunks[c].Length );
+}
+
+const std::vector<JsonParallelWriter::Chunk> & JsonParallelWriter::WriteChunks( const JsonNode & _Node )
+{
+	Plan( _Node );
+
+#if MINJA_THREADS
+	if( m_NbThreads > 1 && m_Parts.size() > 1 )
+	{
+		// the calling thread takes its share of the parts too
+		volatile long nextPart = 0;
+		std::vector<std::thread> threads;
+		size_t nbThreads = m_NbThreads < m_Parts.size() ? m_NbThreads : m_Parts.size();
+		for( size_t t=1; t<nbThreads; ++t )
+			threads.push_back( std::thread( WriteParts, &m_Parts[0], m_Parts.size(), &nextPart ) );
+
+		WriteParts( &m_Parts[0], m_Parts.size(), &nextPart );
+
+		for( size_t t=0; t<threads.size(); ++t )
+			threads[t].join();
+	}
+	else
+#endif
+	{
+		volatile long nextPart = 0;
+		if( !m_Parts.empty() )
+			WriteParts( &m_Parts[0], m_Parts.size(), &nextPart );
+	}
+
+	m_Chunks.clear();
+	for( size_t p=0; p<m_Parts.size(); ++p )
+	{
+		if( m_Parts[p].Text.empty() )
+			continue;
+
+		Chunk chunk;
+		chunk.pData = m_Parts[p].Text.data();
+		chunk.Length = m_Parts[p].Text.size();
+		m_Chunks.push_back( chunk );
+	}
+
+	return m_Chunks;
+}
+
+void JsonParallelWriter::Plan( const JsonNode & _Node )
+{
+	m_Parts.clear();
+
+	// a tree that fits in a few parts isn't worth the threads
+	bool bContainer = _Node.GetType() == JsonNodeType_Object || _Node.GetType() == JsonNodeType_Array;
+	if( !bContainer || m_NbThreads == 1 || MeasureValue( _Node, 2 * m_MinPartSize ) <= 2 * m_MinPartSize )
+	{
+		std::string text;
+		JsonWriteNode( _Node, text );
+		AddText( text );
+		return;
+	}
+
+	PlanContainer( _Node, std::string() );
+}
+
+void JsonParallelWriter::PlanContainer( const JsonNode & _Container, const std::string & _Prefix )
+{
+	bool bObject = _Container.GetType() == JsonNodeType_Object;
+	AddText( _Prefix + (bObject ? '{' : '[') );
+
+	size_t nbChildren = _Container.GetNbChildren();
+	size_t nbRuns = m_NbThreads * 4;
+	if( nbChildren >= nbRuns || _Container.IsPacked() )
+	{
+		// many children are cut by count, in runs no smaller than the part size as measured on the first child
+		size_t childSize = _Container.IsPacked() ? 17 : MeasureValue( *_Container.GetChild( (size_t) 0 ), m_MinPartSize ) + 1;
+		size_t runLength = (nbChildren + nbRuns - 1) / nbRuns;
+		if( runLength * childSize < m_MinPartSize )
+			runLength = m_MinPartSize / childSize + 1;
+
+		for( size_t first=0; first<nbChildren; first+=runLength )
+			AddRun( _Container, first, first + runLength < nbChildren ? first + runLength : nbChildren );
+	}
+	else
+	{
+		// few children: the big ones are cut in turn, the others are gathered in runs
+		size_t runFirst = 0;
+		size_t runSize = 0;
+		for( size_t c=0; c<nbChildren; ++c )
+		{
+			const JsonNode & child = *_Container.GetChild( c );
+			size_t size = MeasureValue( child, m_MinPartSize );
+			if( size > m_MinPartSize && (child.GetType() == JsonNodeType_Object || child.GetType() == JsonNodeType_Array) )
+			{
+				AddRun( _Container, runFirst, c );
+
+				std::string prefix( c > 0 ? "," : "" );
+				if( child.GetName() )
+				{
+					WriteString( child.GetName(), child.GetNameLength(), prefix );
+					prefix += ':';
+				}
+				PlanContainer( child, prefix );
+
+				runFirst = c + 1;
+				runSize = 0;
+			}
+			else if( (runSize += size) >= m_MinPartSize )
+			{
+				AddRun( _Container, runFirst, c + 1 );
+				runFirst = c + 1;
+				runSize = 0;
+			}
+		}
+		AddRun( _Container, runFirst, nbChildren );
+	}
+
+	AddText( bObject ? "}" : "]" );
+}
+
+void JsonParallelWriter::AddText( const std::string & _Text )
+{
+	// consecutive texts go in the same part
+	if( m_Parts.empty() || m_Parts.back().pNode )
+	{
+		m_Parts.push_back( Part() );
+		m_Parts.back().pNode = NULL;
+	}
+
+	m_Parts.back().Text += _Text;
+}
+
+void JsonParallelWriter::AddRun( const JsonNode & _Container, size_t _First, size_t _Last )
+{
+	if( _First == _Last )
+		return;
+
+	// the comma before the run is written with it
+	if( _First > 0 )
+		AddText( "," );
+
+	m_Parts.push_back( Part() );
+	Part & part = m_Parts.back();
+	part.pNode = &_Container;
+	part.First = _First;
+	part.Last = _Last;
+}
+
+void JsonParallelWriter::WriteParts( Part * _pParts, size_t _NbParts, volatile long * _pNextPart )
+{
+	for( ;; )
+	{
+		size_t p = (size_t) MINJA_ATOMIC_INCREMENT( *_pNextPart ) - 1;
+		if( p >= _NbParts )
+			break;
+
+		Part & part = _pParts[p];
+		if( part.pNode == NULL )
+			continue;
+
+		// measured first, so the buffer is allocated once
+		const JsonNode & container = *part.pNode;
+		const float * pNumbers = container.GetNumbers();
+		size_t size = 0;
+		for( size_t c=part.First; c<part.Last; ++c )
+		{
+			if( pNumbers )
+			{
+				size += 17;
+				continue;
+			}
+
+			const JsonNode & child = *container.GetChild( c );
+			if( child.GetName() )
+				size += child.GetNameLength() + 3;
+			size += MeasureValue( child, (size_t) -1 ) + 1;
+		}
+
+		part.Text.clear();
+		part.Text.reserve( size );
+		WriteChildren( container, part.First, part.Last, part.Text );
+	}
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+JsonStructBinding::JsonStructBinding( const JsonFieldDesc * _pFields, size_t _NbFields )
+	: m_pFields( _pFields )
+	, m_NbFields( _NbFields )
+	, m_Seed( 0 )
+	, m_Mask( 0 )
+{
+	ASSERT( _NbFields < 0xffff, "Too many fields in a struct binding" );
+
+	// a table twice as big as the field count usually finds a collision free seed quickly;
+	// if not, grow the table and start over
+	size_t size = 4;
+	while( size < _NbFields * 2 )
+		size <<= 1;
+
+	for( ;; size <<= 1 )
+	{
+		m_Mask = size - 1;
+		for( unsigned int seed=1; seed<=256; ++seed )
+			if( TrySeed( seed ) )
+				return;
+	}
+}
+
+unsigned int JsonStructBinding::HashName( const char * _pName, size_t _NameLength, unsigned int _Seed )
+{
+	// FNV-1a, seeded
+	unsigned int hash = 2166136261u ^ (_Seed * 0x9e3779b9u);
+	for( size_t i=0; i<_NameLength; ++i )
+		hash = (hash ^ (unsigned char) _pName[i]) * 16777619u;
+
+	return hash ^ (hash >> 15);
+}
+
+bool JsonStructBinding::TrySeed( unsigned int _Seed )
+{
+	m_Slots.assign( m_Mask + 1, 0 );
+
+	for( size_t f=0; f<m_NbFields; ++f )
+	{
+		size_t slot = HashName( m_pFields[f].pName, m_pFields[f].NameLength, _Seed ) & m_Mask;
+		if( m_Slots[slot] )
+			return false;
+
+		m_Slots[slot] = (unsigned short) (f + 1);
+	}
+
+	m_Seed = _Seed;
+	return true;
+}
+
+const JsonFieldDesc * JsonStructBinding::FindField( const char * _pName, size_t _NameLength ) const
+{
+	unsigned short slot = m_Slots[HashName( _pName, _NameLength, m_Seed ) & m_Mask];
+	if( slot == 0 )
+		return NULL;
+
+	const JsonFieldDesc * pField = m_pFields + slot - 1;
+	if( pField->NameLength != _NameLength || memcmp( pField->pName, _pName, _NameLength ) )
+		return NULL;
+
+	return pField;
+}
+
+
+class JsonStructReader : public JsonTokenizer::TokenProcessor
+{
+protected:
+	struct Frame
+	{
+		const JsonStructBinding * pBinding;
+		char * pBase;
+	};
+
+	std::vector<Frame> m_Stack;
+	const JsonFieldDesc * m_pField;		// field receiving the next value, NULL when it is ignored
+	size_t m_SkipDepth;					// > 0 while inside a container nobody asked for
+	bool m_bUseNextStringAsKey;
+	bool m_bStarted;
+	bool m_bOK;
+
+public:
+	JsonStructReader( const JsonStructBinding & _Binding, void * _pStruct, unsigned int _Options )
+		: m_pField( NULL )
+		, m_SkipDepth( 0 )
+		, m_bUseNextStringAsKey( false )
+		, m_bStarted( false )
+		, m_bOK( true )
+	{
+		SetOptions( _Options );
+
+		Frame root = { &_Binding, static_cast<char *>( _pStruct ) };
+		m_Stack.reserve( 8 );
+		m_Stack.push_back( root );
+	}
+
+	bool IsOK() const				{ return m_bOK; }
+
+	virtual void OnBeginObject( const char * _pParam1 )
+	{
+		if( m_SkipDepth == 0 )
+		{
+			// the root object maps onto the struct itself, whose frame is already there
+			if( !m_bStarted )
+			{
+				m_bStarted = true;
+				return;
+			}
+
+			if( m_pField && m_pField->Type == JsonFieldType_Object )
+			{
+				Frame frame = { &m_pField->pGetNested(), CurrentMember() };
+				m_Stack.push_back( frame );
+				m_pField = NULL;
+				return;
+			}
+
+			SkipValue();
+		}
+		++m_SkipDepth;
+	}
+
+	virtual void OnEndObject( const char * _pParam1 )
+	{
+		if( m_SkipDepth )
+			--m_SkipDepth;
+		else
+			m_Stack.pop_back();
+	}
+
+	virtual void OnBeginArray( const char * _pParam1 )
+	{
+		if( m_SkipDepth == 0 )
+			SkipValue();
+		++m_SkipDepth;
+	}
+
+	virtual void OnEndArray( const char * _pParam1 )
+	{
+		--m_SkipDepth;
+	}
+
+	virtual void OnBeginPair( const char * _pParam1 )
+	{
+		if( m_SkipDepth == 0 )
+		{
+			m_bUseNextStringAsKey = true;
+			m_pField = NULL;
+		}
+	}
+
+	virtual void OnString( const char * _pParam1, const char * _pParam2 )
+	{
+		if( m_SkipDepth )
+			return;
+
+		size_t len = _pParam2 - _pParam1 - 2;
+		if( m_bUseNextStringAsKey )
+		{
+			m_pField = m_Stack.back().pBinding->FindField( _pParam1 + 1, len );
+			m_bUseNextStringAsKey = false;
+		}
+		else if( Expect( JsonFieldType_String ) )
+		{
+			reinterpret_cast<std::string *>( CurrentMember() )->assign( _pParam1 + 1, len );
+			m_pField = NULL;
+		}
+	}
+
+	virtual void OnNumber( const char * _pParam1, const char * _pParam2 )
+	{
+		if( m_SkipDepth || m_pField == NULL )
+			return;
+
+		// the number is always followed by a delimiter, strtod stops there on its own
+		double value = strtod( _pParam1, NULL );
+		switch( m_pField->Type )
+		{
+		case JsonFieldType_Int:
+			// truncated when it fits, the read fails otherwise
+			if( value > -2147483649.0 && value < 2147483648.0 )
+				*reinterpret_cast<int *>( CurrentMember() ) = (int) value;
+			else
+				m_bOK = false;
+			break;
+		case JsonFieldType_Float:	*reinterpret_cast<float *>( CurrentMember() ) = (float) value; break;
+		case JsonFieldType_Double:	*reinterpret_cast<double *>( CurrentMember() ) = value; break;
+		default:					m_bOK = false; break;
+		}
+		m_pField = NULL;
+	}
+
+	virtual void OnNull( const char * _pParam1, const char * _pParam2 )
+	{
+		if( m_SkipDepth == 0 )
+			m_pField = NULL;
+	}
+
+	virtual void OnTrue( const char * _pParam1, const char * _pParam2 )
+	{
+		if( m_SkipDepth == 0 && Expect( JsonFieldType_Bool ) )
+		{
+			*reinterpret_cast<bool *>( CurrentMember() ) = true;
+			m_pField = NULL;
+		}
+	}
+
+	virtual void OnFalse( const char * _pParam1, const char * _pParam2 )
+	{
+		if( m_SkipDepth == 0 && Expect( JsonFieldType_Bool ) )
+		{
+			*reinterpret_cast<bool *>( CurrentMember() ) = false;
+			m_pField = NULL;
+		}
+	}
+
+	virtual void OnError( const char * _pParam1, const char * _pParam2, const char * _pParam3 )
+	{
+		m_bOK = false;
+	}
+
+protected:
+	char * CurrentMember() const
+	{
+		return m_Stack.back().pBase + m_pField->Offset;
+	}
+
+	bool Expect( JsonFieldType _Type )
+	{
+		if( m_pField == NULL )
+			return false;
+
+		// a value of the wrong kind for a bound member is an error, not something to skip
+		if( m_pField->Type != _Type )
+		{
+			m_bOK = false;
+			m_pField = NULL;
+			return false;
+		}
+
+		return true;
+	}
+
+	void SkipValue()
+	{
+		if( m_pField )
+			m_bOK = false;
+		m_pField = NULL;
+	}
+};
+
+bool JsonReadStruct( const JsonStructBinding & _Binding, void * _pStruct, const char * _pBuffer, unsigned int _Options )
+{
+	JsonStructReader reader( _Binding, _pStruct, _Options );
+
+	const char * pEnd;
+	return JsonTokenizer::ReadObject( reader, _pBuffer, &pEnd ) == JsonTokenizer::ParseOK && reader.IsOK();
+}
+
+void JsonWriteStruct( const JsonStructBinding & _Binding, const void * _pStruct, std::string & _Out )
+{
+	const char * pBase = static_cast<const char *>( _pStruct );
+	char text[32];
+
+	// the same escapes and number forms as JsonWriteNode
+	_Out += '{';
+	for( size_t f=0; f<_Binding.GetNbFields(); ++f )
+	{
+		const JsonFieldDesc & field = _Binding.GetField( f );
+		const void * pMember = pBase + field.Offset;
+
+		if( f )
+			_Out += ',';
+		WriteString( field.pName, field.NameLength, _Out );
+		_Out += ':';
+
+		switch( field.Type )
+		{
+		case JsonFieldType_Bool:
+			_Out += *static_cast<const bool *>( pMember ) ? "true" : "false";
+			break;
+
+		case JsonFieldType_Int:
+			_Out.append( text, sprintf( text, "%d", *static_cast<const int *>( pMember ) ) );
+			break;
+
+		case JsonFieldType_Float:
+			WriteNumber( *static_cast<const float *>( pMember ), _Out );
+			break;
+
+		case JsonFieldType_Double:
+			WriteNumber( *static_cast<const double *>( pMember ), 17, _Out );
+			break;
+
+		case JsonFieldType_String:
+			{
+				const std::string & value = *static_cast<const std::string *>( pMember );
+				WriteString( value.data(), value.size(), _Out );
+			}
+			break;
+
+		case JsonFieldType_Object:
+			JsonWriteStruct( field.pGetNested(), pMember, _Out );
+			break;
+		}
+	}
+	_Out += '}';
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+JsonColumn::JsonColumn( const char * _pName, JsonColumnType _Type )
+	: m_Name( _pName )
+	, m_Type( _Type )
+	, m_NbRows( 0 )
+{
+	Clear();
+}
+
+const char * JsonColumn::GetString( size_t _Row, size_t & _Len ) const
+{
+	ASSERT( m_Type == JsonColumnType_String, "Wrong column type. Not a string" );
+
+	_Len = m_StringOffsets[_Row+1] - m_StringOffsets[_Row];
+	return GetStringData() + m_StringOffsets[_Row];
+}
+
+void JsonColumn::Clear()
+{
+	m_Doubles.clear();
+	m_Int64s.clear();
+	m_StringOffsets.assign( 1, 0 );
+	m_StringData.clear();
+	m_Validity.clear();
+	m_NbRows = 0;
+}
+
+void JsonColumn::AddRow()
+{
+	// every row starts null; only the array of the column's type grows
+	if( (m_NbRows & 7) == 0 )
+		m_Validity.push_back( 0 );
+
+	switch( m_Type )
+	{
+	case JsonColumnType_Double:	m_Doubles.push_back( 0.0 ); break;
+	case JsonColumnType_Int64:	m_Int64s.push_back( 0 ); break;
+	case JsonColumnType_String:	m_StringOffsets.push_back( m_StringData.size() ); break;
+	}
+
+	++m_NbRows;
+}
+
+void JsonColumn::SetValid()
+{
+	size_t row = m_NbRows - 1;
+	m_Validity[row >> 3] |= (unsigned char) (1 << (row & 7));
+}
+
+
+JsonColumnExtractor::JsonColumnExtractor( const char * _pArrayPath )
+	: m_pBinding( NULL )
+	, m_NbRows( 0 )
+	, m_Depth( 0 )
+	, m_OffPathDepth( 0 )
+	, m_bUseNextStringAsKey( false )
+	, m_bKeyOnPath( false )
+	, m_pCurrColumn( NULL )
+{
+	// the pointer is split once, with its ~1 and ~0 escapes resolved
+	std::vector<char> scratch;
+	const char * pCurr = _pArrayPath;
+	while( *pCurr == '/' )
+	{
+		const char * pToken = ++pCurr;
+		while( *pCurr && *pCurr != '/' )
+			++pCurr;
+
+		size_t len = pCurr - pToken;
+		const char * pName = UnescapePointerToken( pToken, len, scratch );
+		m_Path.push_back( std::string( pName, len ) );
+	}
+}
+
+JsonColumnExtractor::~JsonColumnExtractor()
+{
+	delete m_pBinding;
+}
+
+size_t JsonColumnExtractor::AddColumn( const char * _pName, JsonColumnType _Type )
+{
+	m_Columns.push_back( JsonColumn( _pName, _Type ) );
+
+	delete m_pBinding;
+	m_pBinding = NULL;
+
+	return m_Columns.size() - 1;
+}
+
+const JsonColumn * JsonColumnExtractor::FindColumn( const char * _pName ) const
+{
+	for( size_t c=0; c<m_Columns.size(); ++c )
+		if( m_Columns[c].m_Name == _pName )
+			return &m_Columns[c];
+
+	return NULL;
+}
+
+void JsonColumnExtractor::Prepare()
+{
+	// the field names point into the columns, which don't move anymore once extraction starts
+	if( m_pBinding == NULL && !m_Columns.empty() )
+	{
+		m_Fields.resize( m_Columns.size() );
+		for( size_t c=0; c<m_Columns.size(); ++c )
+		{
+			m_Fields[c].pName = m_Columns[c].m_Name.c_str();
+			m_Fields[c].NameLength = m_Columns[c].m_Name.size();
+			m_Fields[c].Type = JsonFieldType_Object;
+			m_Fields[c].Offset = c;
+			m_Fields[c].pGetNested = NULL;
+		}
+
+		m_pBinding = new JsonStructBinding( &m_Fields[0], m_Fields.size() );
+	}
+
+	for( size_t c=0; c<m_Columns.size(); ++c )
+		m_Columns[c].Clear();
+
+	m_NbRows = 0;
+	m_Depth = 0;
+	m_OffPathDepth = 0;
+	m_bUseNextStringAsKey = false;
+	m_bKeyOnPath = false;
+	m_pCurrColumn = NULL;
+}
+
+bool JsonColumnExtractor::Extract( const char * _pBuffer )
+{
+	Prepare();
+
+	const char * pEnd;
+	const char * pRoot = JsonTokenizer::SkipWhitespaces( _pBuffer );
+	JsonTokenizer::ParseResult result = (*pRoot == '[') ? JsonTokenizer::ReadArray( *this, pRoot, &pEnd ) : JsonTokenizer::ReadObject( *this, pRoot, &pEnd );
+
+	return result == JsonTokenizer::ParseOK;
+}
+
+bool JsonColumnExtractor::Extract( JsonInputStream & _Stream )
+{
+	Prepare();
+	return JsonReadStream( *this, _Stream );
+}
+
+void JsonColumnExtractor::BeginContainer( bool _bObject )
+{
+	++m_Depth;
+	m_pCurrColumn = NULL;
+
+	if( m_OffPathDepth )
+		return;
+
+	// containers 1..k are the objects holding the path keys, k+1 is the array, k+2 its rows
+	size_t k = m_Path.size();
+	bool bOnPath;
+	if( m_Depth <= k )
+		bOnPath = _bObject && (m_Depth == 1 || m_bKeyOnPath);
+	else if( m_Depth == k + 1 )
+		bOnPath = !_bObject && (m_Depth == 1 || m_bKeyOnPath);
+	else
+		bOnPath = _bObject && m_Depth == k + 2;
+
+	if( !bOnPath )
+	{
+		m_OffPathDepth = m_Depth;
+		return;
+	}
+
+	if( m_Depth == k + 2 )
+	{
+		for( size_t c=0; c<m_Columns.size(); ++c )
+			m_Columns[c].AddRow();
+		++m_NbRows;
+	}
+}
+
+void JsonColumnExtractor::EndContainer()
+{
+	if( m_OffPathDepth == m_Depth )
+		m_OffPathDepth = 0;
+
+	--m_Depth;
+	m_pCurrColumn = NULL;
+}
+
+void JsonColumnExtractor::OnString( const char * _pParam1, const char * _pParam2 )
+{
+	if( m_OffPathDepth )
+		return;
+
+	const char * pString = _pParam1 + 1;
+	size_t len = _pParam2 - _pParam1 - 2;
+
+	if( m_bUseNextStringAsKey )
+	{
+		m_bUseNextStringAsKey = false;
+
+		if( m_Depth <= m_Path.size() )
+			m_bKeyOnPath = m_Path[m_Depth-1].size() == len && !memcmp( m_Path[m_Depth-1].data(), pString, len );
+		else if( m_Depth == m_Path.size() + 2 && m_pBinding )
+		{
+			const JsonFieldDesc * pField = m_pBinding->FindField( pString, len );
+			m_pCurrColumn = pField ? &m_Columns[pField->Offset] : NULL;
+		}
+		return;
+	}
+
+	if( m_pCurrColumn && m_pCurrColumn->m_Type == JsonColumnType_String )
+	{
+		m_pCurrColumn->m_StringData.insert( m_pCurrColumn->m_StringData.end(), pString, pString + len );
+		m_pCurrColumn->m_StringOffsets.back() = m_pCurrColumn->m_StringData.size();
+		m_pCurrColumn->SetValid();
+	}
+	m_pCurrColumn = NULL;
+}
+
+void JsonColumnExtractor::SetNumber( const char * _pBegin, const char * _pEnd, double _Value, bool _bIsBool )
+{
+	JsonColumn * pColumn = m_pCurrColumn;
+	m_pCurrColumn = NULL;
+
+	if( m_OffPathDepth || pColumn == NULL || pColumn->m_Type == JsonColumnType_String )
+		return;
+
+	if( pColumn->m_Type == JsonColumnType_Int64 )
+	{
+		long long value = (long long) _Value;
+		if( !_bIsBool )
+		{
+			// plain integers are read exactly, in magnitude so that the most negative one fits too
+			const char * pCurr = _pBegin;
+			bool bNegative = (*pCurr == '-');
+			if( *pCurr == '-' || *pCurr == '+' )
+				++pCurr;
+
+			const unsigned long long maxMagnitude = bNegative ? 9223372036854775808ULL : 9223372036854775807ULL;
+			unsigned long long magnitude = 0;
+			bool bOverflow = false;
+			for( ; pCurr < _pEnd && *pCurr >= '0' && *pCurr <= '9'; ++pCurr )
+			{
+				unsigned int digit = *pCurr - '0';
+				bOverflow = bOverflow || magnitude > (maxMagnitude - digit) / 10;
+				if( !bOverflow )
+					magnitude = magnitude * 10 + digit;
+			}
+
+			if( pCurr != _pEnd )
+			{
+				// anything else goes through strtod, and is truncated when it fits
+				double number = strtod( _pBegin, NULL );
+				bOverflow = !(number >= -9223372036854775808.0 && number < 9223372036854775808.0);
+				value = bOverflow ? 0 : (long long) number;
+			}
+			else if( !bOverflow )
+				value = bNegative && magnitude ? -(long long) (magnitude - 1) - 1 : (long long) magnitude;
+
+			// out of range values are null rows, like values of another type
+			if( bOverflow )
+				return;
+		}
+
+		pColumn->m_Int64s.back() = value;
+	}
+	else
+	{
+		pColumn->m_Doubles.back() = _bIsBool ? _Value : strtod( _pBegin, NULL );
+	}
+
+	pColumn->SetValid();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+JsonQueryResult::JsonQueryResult()
+	: m_NbRecords( 0 )
+	, m_NbMatches( 0 )
+	, m_NbErrors( 0 )
+{
+}
+
+void JsonQueryResult::Clear()
+{
+	m_NbRecords = 0;
+	m_NbMatches = 0;
+	m_NbErrors = 0;
+	m_Groups.clear();
+	m_Rows.clear();
+}
+
+const JsonQueryGroup * JsonQueryResult::FindGroup( const char * _pKey ) const
+{
+	size_t low = 0;
+	size_t high = m_Groups.size();
+	while( low < high )
+	{
+		size_t mid = (low + high) / 2;
+		int cmp = m_Groups[mid].Key.compare( _pKey );
+		if( cmp == 0 )
+			return &m_Groups[mid];
+
+		if( cmp < 0 )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return NULL;
+}
+
+
+/// Evaluates the records of a block of lines against a compiled query. Each worker thread
+/// owns one, and each block gets its own partial results, merged afterwards in input order.
+class JsonQueryEvaluator : public JsonTokenizer::TokenProcessor
+{
+public:
+	struct Block
+	{
+		const char * pBegin;
+		const char * pEnd;
+		size_t NbRecords;
+		size_t NbMatches;
+		size_t NbErrors;
+		std::map<std::string, JsonQueryGroup> Groups;
+		std::vector<std::string> Rows;
+	};
+
+protected:
+	struct Value
+	{
+		JsonNodeType Type;			// JsonNodeType_Unknown when the record doesn't have the field
+		const char * pBegin;		// raw text, string delimiters included
+		const char * pEnd;
+		bool bDecoded;
+		double Number;
+	};
+
+	const JsonQuery & m_Query;
+	std::vector<Value> m_Values;
+	std::vector<char> m_Line;
+	std::string m_Key;
+	size_t m_Depth;
+	bool m_bUseNextStringAsKey;
+	Value * m_pCurrValue;
+	Value * m_pContainerValue;
+
+public:
+	explicit JsonQueryEvaluator( const JsonQuery & _Query );
+
+	void Run( Block & _Block );
+
+protected:
+	void Evaluate( Block & _Block );
+	bool Matches( const JsonQuery::Condition & _Condition );
+	double GetNumber( Value & _Value );
+	void SetValue( JsonNodeType _Type, const char * _pBegin, const char * _pEnd );
+	void BeginContainer( JsonNodeType _Type, const char * _pBegin );
+	void EndContainer( const char * _pEnd );
+
+	virtual void OnBeginObject( const char * _pParam1 )						{ BeginContainer( JsonNodeType_Object, _pParam1 ); }
+	virtual void OnEndObject( const char * _pParam1 )						{ EndContainer( _pParam1 ); }
+	virtual void OnBeginArray( const char * _pParam1 )						{ BeginContainer( JsonNodeType_Array, _pParam1 ); }
+	virtual void OnEndArray( const char * _pParam1 )						{ EndContainer( _pParam1 ); }
+	virtual void OnBeginPair( const char * _pParam1 )						{ m_bUseNextStringAsKey = (m_Depth == 1); m_pCurrValue = NULL; }
+	virtual void OnString( const char * _pParam1, const char * _pParam2 );
+	virtual void OnNumber( const char * _pParam1, const char * _pParam2 )	{ SetValue( JsonNodeType_Number, _pParam1, _pParam2 ); }
+	virtual void OnNull( const char * _pParam1, const char * _pParam2 )		{ SetValue( JsonNodeType_Null, _pParam1, _pParam2 ); }
+	virtual void OnTrue( const char * _pParam1, const char * _pParam2 )		{ SetValue( JsonNodeType_Bool, _pParam1, _pParam2 ); }
+	virtual void OnFalse( const char * _pParam1, const char * _pParam2 )	{ SetValue( JsonNodeType_Bool, _pParam1, _pParam2 ); }
+};
+
+JsonQueryEvaluator::JsonQueryEvaluator( const JsonQuery & _Query )
+	: m_Query( _Query )
+	, m_Values( _Query.m_FieldNames.size() )
+	, m_Depth( 0 )
+	, m_bUseNextStringAsKey( false )
+	, m_pCurrValue( NULL )
+	, m_pContainerValue( NULL )
+{
+}
+
+void JsonQueryEvaluator::Run( Block & _Block )
+{
+	_Block.NbRecords = 0;
+	_Block.NbMatches = 0;
+	_Block.NbErrors = 0;
+
+	const char * pCurr = _Block.pBegin;
+	while( pCurr < _Block.pEnd )
+	{
+		const char * pLineEnd = (const char *) memchr( pCurr, '\n', _Block.pEnd - pCurr );
+		const char * pNext = pLineEnd ? pLineEnd + 1 : _Block.pEnd;
+		if( pLineEnd == NULL )
+			pLineEnd = _Block.pEnd;
+
+		// blank lines are not records, and \r\n line ends are accepted
+		while( pCurr < pLineEnd && (*pCurr == ' ' || *pCurr == '\t') )
+			++pCurr;
+		while( pLineEnd > pCurr && (pLineEnd[-1] == ' ' || pLineEnd[-1] == '\t' || pLineEnd[-1] == '\r') )
+			--pLineEnd;
+
+		if( pCurr < pLineEnd )
+		{
+			// the tokenizer needs the record null terminated
+			m_Line.assign( pCurr, pLineEnd );
+			m_Line.push_back( 0 );
+
+			for( size_t v=0; v<m_Values.size(); ++v )
+			{
+				m_Values[v].Type = JsonNodeType_Unknown;
+				m_Values[v].bDecoded = false;
+			}
+			m_Depth = 0;
+			m_bUseNextStringAsKey = false;
+			m_pCurrValue = NULL;
+			m_pContainerValue = NULL;
+
+			++_Block.NbRecords;
+
+			const char * pEnd;
+			if( JsonTokenizer::ReadObject( *this, &m_Line[0], &pEnd ) == JsonTokenizer::ParseOK && *pEnd == 0 )
+				Evaluate( _Block );
+			else
+				++_Block.NbErrors;
+		}
+
+		pCurr = pNext;
+	}
+}
+
+double JsonQueryEvaluator::GetNumber( Value & _Value )
+{
+	if( !_Value.bDecoded )
+	{
+		_Value.Number = strtod( _Value.pBegin, NULL );
+		_Value.bDecoded = true;
+	}
+
+	return _Value.Number;
+}
+
+bool JsonQueryEvaluator::Matches( const JsonQuery::Condition & _Condition )
+{
+	Value & value = m_Values[_Condition.Field];
+
+	int cmp;
+	if( _Condition.bString )
+	{
+		if( value.Type != JsonNodeType_String )
+			return false;
+
+		size_t len = value.pEnd - value.pBegin - 2;
+		size_t expectedLen = _Condition.String.size();
+		cmp = memcmp( value.pBegin + 1, _Condition.String.data(), len < expectedLen ? len : expectedLen );
+		if( cmp == 0 )
+			cmp = (len > expectedLen) - (len < expectedLen);
+	}
+	else
+	{
+		if( value.Type != JsonNodeType_Number )
+			return false;
+
+		double number = GetNumber( value );
+		cmp = (number > _Condition.Number) - (number < _Condition.Number);
+	}
+
+	switch( _Condition.Op )
+	{
+	case JsonQuery::Compare_Equal:			return cmp == 0;
+	case JsonQuery::Compare_NotEqual:		return cmp != 0;
+	case JsonQuery::Compare_Less:			return cmp < 0;
+	case JsonQuery::Compare_LessEqual:		return cmp <= 0;
+	case JsonQuery::Compare_Greater:		return cmp > 0;
+	case JsonQuery::Compare_GreaterEqual:	return cmp >= 0;
+	}
 
-	m_Value.Children->push_back( _pNode );
+	return false;
 }
 
-bool JsonNode::Visit( JsonNodeVisitor & _Visitor )
+void JsonQueryEvaluator::Evaluate( Block & _Block )
 {
-	bool keepGoing;
-	switch( m_Type )
-	{
-	case JsonNodeType_Null: 
-		keepGoing = _Visitor.OnNull( this ); 
-		goto visitEarlyOut;
+	for( size_t c=0; c<m_Query.m_Conditions.size(); ++c )
+		if( !Matches( m_Query.m_Conditions[c] ) )
+			return;
 
-	case JsonNodeType_Bool: 
-		keepGoing = _Visitor.OnBool( this ); 
-		goto visitEarlyOut;
+	++_Block.NbMatches;
 
-	case JsonNodeType_Number: 
-		keepGoing = _Visitor.OnNull( this ); 
-		goto visitEarlyOut;
+	// strings are grouped by their content, other values by their text
+	m_Key.clear();
+	if( m_Query.m_GroupField != JsonQuery::NoField )
+	{
+		const Value & value = m_Values[m_Query.m_GroupField];
+		if( value.Type == JsonNodeType_String )
+			m_Key.assign( value.pBegin + 1, value.pEnd - 1 );
+		else if( value.Type != JsonNodeType_Unknown )
+			m_Key.assign( value.pBegin, value.pEnd );
+	}
 
-	case JsonNodeType_String: 
-		keepGoing = _Visitor.OnString( this ); 
-		goto visitEarlyOut;
+	size_t nbAggregates = m_Query.m_Aggregates.size();
+	std::map<std::string, JsonQueryGroup>::iterator itGroup = _Block.Groups.find( m_Key );
+	if( itGroup == _Block.Groups.end() )
+	{
+		JsonQueryGroup group;
+		group.Key = m_Key;
+		group.NbRecords = 0;
+		group.Values.assign( nbAggregates, 0.0 );
+		group.NbValues.assign( nbAggregates, 0 );
+		itGroup = _Block.Groups.insert( std::make_pair( m_Key, group ) ).first;
+	}
 
-	case JsonNodeType_Array: 
-		keepGoing = _Visitor.OnArrayBegin( this );
-		if( !keepGoing )
-			goto visitEarlyOut;
-		for( size_t c=0; c<m_Value.Children->size(); ++c )
-		{
-			keepGoing = (*m_Value.Children)[c]->Visit( _Visitor );
-			if( !keepGoing )
-				goto visitEarlyOut;
-		}
-		keepGoing = _Visitor.OnArrayEnd( this ); 
-		goto visitEarlyOut;
+	JsonQueryGroup & group = itGroup->second;
+	++group.NbRecords;
 
-	case JsonNodeType_Object: 
-		keepGoing = _Visitor.OnObjectBegin( this ); 
-		for( size_t c=0; c<m_Value.Children->size(); ++c )
+	for( size_t a=0; a<nbAggregates; ++a )
+	{
+		const JsonQuery::AggregateDesc & aggregate = m_Query.m_Aggregates[a];
+		if( aggregate.Func == JsonQuery::Function_Count )
 		{
-			keepGoing = (*m_Value.Children)[c]->Visit( _Visitor );
-			if( !keepGoing )
-				goto visitEarlyOut;
+			if( aggregate.Field == JsonQuery::NoField || m_Values[aggregate.Field].Type != JsonNodeType_Unknown )
+			{
+				group.Values[a] += 1.0;
+				++group.NbValues[a];
+			}
+			continue;
 		}
-		keepGoing = _Visitor.OnObjectEnd( this ); 
-		goto visitEarlyOut;
 
-	case JsonNodeType_Unknown:
-	default:
-		break;
+		Value & value = m_Values[aggregate.Field];
+		if( value.Type != JsonNodeType_Number )
+			continue;
+
+		double number = GetNumber( value );
+		double & result = group.Values[a];
+		if( group.NbValues[a]++ == 0 )
+			result = number;
+		else if( aggregate.Func == JsonQuery::Function_Sum )
+			result += number;
+		else if( aggregate.Func == JsonQuery::Function_Min ? number < result : number > result )
+			result = number;
 	}
 
-visitEarlyOut:
-	return keepGoing;
+	if( !m_Query.m_Selection.empty() )
+	{
+		_Block.Rows.push_back( std::string() );
+		std::string & row = _Block.Rows.back();
+		row += '{';
+		for( size_t s=0; s<m_Query.m_Selection.size(); ++s )
+		{
+			size_t field = m_Query.m_Selection[s];
+			const Value & value = m_Values[field];
+			if( value.Type == JsonNodeType_Unknown )
+				continue;
+
+			if( row.size() > 1 )
+				row += ',';
+			const std::string & name = m_Query.m_FieldNames[field];
+			WriteString( name.c_str(), name.size(), row );
+			row += ':';
+
+			// strings may have been delimited by single quotes, and hold double quotes as they are
+			if( value.Type == JsonNodeType_String )
+				WriteString( value.pBegin + 1, value.pEnd - value.pBegin - 2, row );
+			else
+				row.append( value.pBegin, value.pEnd );
+		}
+		row += '}';
+	}
 }
 
-//------------------------------------------------------------------------------
-//------------------------------------------------------------------------------
-//------------------------------------------------------------------------------
+void JsonQueryEvaluator::SetValue( JsonNodeType _Type, const char * _pBegin, const char * _pEnd )
+{
+	if( m_pCurrValue && m_Depth == 1 )
+	{
+		m_pCurrValue->Type = _Type;
+		m_pCurrValue->pBegin = _pBegin;
+		m_pCurrValue->pEnd = _pEnd;
+		m_pCurrValue->bDecoded = false;
+	}
+	m_pCurrValue = NULL;
+}
 
-JsonDocument::JsonDocument()
-	: m_pCurrPair( NULL )
-	, m_pCurrObject( NULL )
-	, m_pName( NULL )
-	, m_bUseNextStringAsKey( true )
+void JsonQueryEvaluator::BeginContainer( JsonNodeType _Type, const char * _pBegin )
 {
-	m_Type = JsonNodeType_Object;
-	m_Value.Children = new JsonNode::NodeVector;
-	m_pTempName[0] = 0;
+	// nested containers are only kept as raw text, for projections
+	if( m_pCurrValue && m_Depth == 1 )
+	{
+		m_pCurrValue->Type = _Type;
+		m_pCurrValue->pBegin = _pBegin;
+		m_pContainerValue = m_pCurrValue;
+	}
+
+	++m_Depth;
+	m_pCurrValue = NULL;
 }
 
-JsonDocument * JsonDocument::Parse( const char * _pBuffer )
+void JsonQueryEvaluator::EndContainer( const char * _pEnd )
 {
-	JsonDocument * pDoc = new JsonDocument;
+	--m_Depth;
 
-	const char * pParseEnd;
-	if( ReadObject( *pDoc, _pBuffer, &pParseEnd ) )
+	if( m_pContainerValue && m_Depth == 1 )
 	{
-		return pDoc;
+		m_pContainerValue->pEnd = _pEnd;
+		m_pContainerValue = NULL;
 	}
-	else
+}
+
+void JsonQueryEvaluator::OnString( const char * _pParam1, const char * _pParam2 )
+{
+	if( !m_bUseNextStringAsKey )
 	{
-		delete pDoc;
-		return NULL;
+		SetValue( JsonNodeType_String, _pParam1, _pParam2 );
+		return;
 	}
+
+	m_bUseNextStringAsKey = false;
+
+	const JsonFieldDesc * pField = m_Query.m_pBinding ? m_Query.m_pBinding->FindField( _pParam1 + 1, _pParam2 - _pParam1 - 2 ) : NULL;
+	m_pCurrValue = pField ? &m_Values[pField->Offset] : NULL;
 }
 
-JsonDocument * JsonDocument::Create()
+
+#if MINJA_THREADS
+
+static void JsonQueryWorker( const JsonQuery * _pQuery, JsonQueryEvaluator::Block * _pBlocks, size_t _NbBlocks, volatile long * _pNextBlock )
 {
-	JsonDocument * pDoc = new JsonDocument;
+	JsonQueryEvaluator evaluator( *_pQuery );
+	for( ;; )
+	{
+		size_t block = (size_t) MINJA_ATOMIC_INCREMENT( *_pNextBlock ) - 1;
+		if( block >= _NbBlocks )
+			break;
 
-	return pDoc;
+		evaluator.Run( _pBlocks[block] );
+	}
 }
 
-void JsonDocument::OnBeginObject( const char * _pParam1 )
+#endif //MINJA_THREADS
+
+
+const size_t JsonQuery::NoField;
+
+JsonQuery::JsonQuery()
+	: m_pBinding( NULL )
+	, m_GroupField( NoField )
 {
-	if( m_pCurrObject == NULL )
+}
+
+JsonQuery::~JsonQuery()
+{
+	delete m_pBinding;
+}
+
+size_t JsonQuery::AddField( const char * _pName )
+{
+	for( size_t f=0; f<m_FieldNames.size(); ++f )
+		if( m_FieldNames[f] == _pName )
+			return f;
+
+	m_FieldNames.push_back( _pName );
+
+	delete m_pBinding;
+	m_pBinding = NULL;
+
+	return m_FieldNames.size() - 1;
+}
+
+JsonQuery & JsonQuery::Where( const char * _pField, Compare _Compare, double _Value )
+{
+	Condition condition;
+	condition.Field = AddField( _pField );
+	condition.Op = _Compare;
+	condition.bString = false;
+	condition.Number = _Value;
+	m_Conditions.push_back( condition );
+
+	return *this;
+}
+
+JsonQuery & JsonQuery::Where( const char * _pField, Compare _Compare, const char * _pValue )
+{
+	Condition condition;
+	condition.Field = AddField( _pField );
+	condition.Op = _Compare;
+	condition.bString = true;
+	condition.Number = 0.0;
+	condition.String = _pValue;
+	m_Conditions.push_back( condition );
+
+	return *this;
+}
+
+JsonQuery & JsonQuery::GroupBy( const char * _pField )
+{
+	m_GroupField = AddField( _pField );
+	return *this;
+}
+
+JsonQuery & JsonQuery::Aggregate( Function _Function, const char * _pField )
+{
+	ASSERT( _pField != NULL || _Function == Function_Count, "Only counts can do without a field" );
+
+	AggregateDesc aggregate;
+	aggregate.Func = _Function;
+	aggregate.Field = _pField ? AddField( _pField ) : NoField;
+	m_Aggregates.push_back( aggregate );
+
+	return *this;
+}
+
+JsonQuery & JsonQuery::Select( const char * _pField )
+{
+	m_Selection.push_back( AddField( _pField ) );
+	return *this;
+}
+
+void JsonQuery::Compile()
+{
+	if( m_pBinding || m_FieldNames.empty() )
+		return;
+
+	// the field offsets are indices in the evaluators' value arrays
+	m_Fields.resize( m_FieldNames.size() );
+	for( size_t f=0; f<m_FieldNames.size(); ++f )
 	{
-		m_pCurrObject = this;
-		m_pCurrPair = NULL;
+		m_Fields[f].pName = m_FieldNames[f].c_str();
+		m_Fields[f].NameLength = m_FieldNames[f].size();
+		m_Fields[f].Type = JsonFieldType_Object;
+		m_Fields[f].Offset = f;
+		m_Fields[f].pGetNested = NULL;
 	}
-	else
+
+	m_pBinding = new JsonStructBinding( &m_Fields[0], m_Fields.size() );
+}
+
+void JsonQuery::MergeGroup( JsonQueryGroup & _Dest, const JsonQueryGroup & _Src ) const
+{
+	_Dest.NbRecords += _Src.NbRecords;
+
+	for( size_t a=0; a<m_Aggregates.size(); ++a )
 	{
-		m_pCurrObject = m_pCurrObject->AddObject( m_pName );
+		if( _Src.NbValues[a] == 0 )
+			continue;
+
+		double & result = _Dest.Values[a];
+		if( _Dest.NbValues[a] == 0 )
+			result = _Src.Values[a];
+		else if( m_Aggregates[a].Func == Function_Count || m_Aggregates[a].Func == Function_Sum )
+			result += _Src.Values[a];
+		else if( m_Aggregates[a].Func == Function_Min ? _Src.Values[a] < result : _Src.Values[a] > result )
+			result = _Src.Values[a];
+
+		_Dest.NbValues[a] += _Src.NbValues[a];
 	}
 }
 
-void JsonDocument::OnEndObject( const char * _pParam1 )
+void JsonQuery::RunBlocks( const char * _pBuffer, size_t _Len, size_t _BlockSize, size_t _NbThreads, JsonQueryResult & _Result )
 {
-	m_pCurrObject = m_pCurrObject->GetParent();
+	// blocks end on line boundaries
+	std::vector<const char *> cuts;
+	const char * pCurr = _pBuffer;
+	const char * pEnd = _pBuffer + _Len;
+	cuts.push_back( pCurr );
+	while( pCurr < pEnd )
+	{
+		const char * pCut = (size_t) (pEnd - pCurr) > _BlockSize ? pCurr + _BlockSize : pEnd;
+		if( pCut < pEnd )
+		{
+			const char * pLineEnd = (const char *) memchr( pCut, '\n', pEnd - pCut );
+			pCut = pLineEnd ? pLineEnd + 1 : pEnd;
+		}
+
+		cuts.push_back( pCut );
+		pCurr = pCut;
+	}
+
+	std::vector<JsonQueryEvaluator::Block> blocks( cuts.size() - 1 );
+	for( size_t b=0; b<blocks.size(); ++b )
+	{
+		blocks[b].pBegin = cuts[b];
+		blocks[b].pEnd = cuts[b+1];
+	}
+
+	if( blocks.empty() )
+		return;
+
+#if MINJA_THREADS
+	if( _NbThreads > 1 && blocks.size() > 1 )
+	{
+		// the calling thread takes its share of the blocks too
+		volatile long nextBlock = 0;
+		std::vector<std::thread> threads;
+		size_t nbThreads = _NbThreads < blocks.size() ? _NbThreads : blocks.size();
+		for( size_t t=1; t<nbThreads; ++t )
+			threads.push_back( std::thread( JsonQueryWorker, this, &blocks[0], blocks.size(), &nextBlock ) );
+
+		JsonQueryWorker( this, &blocks[0], blocks.size(), &nextBlock );
+
+		for( size_t t=0; t<threads.size(); ++t )
+			threads[t].join();
+	}
+	else
+#endif
+	{
+		JsonQueryEvaluator evaluator( *this );
+		for( size_t b=0; b<blocks.size(); ++b )
+			evaluator.Run( blocks[b] );
+	}
+
+	std::map<std::string, JsonQueryGroup> groups;
+	for( size_t b=0; b<blocks.size(); ++b )
+	{
+		JsonQueryEvaluator::Block & block = blocks[b];
+		_Result.m_NbRecords += block.NbRecords;
+		_Result.m_NbMatches += block.NbMatches;
+		_Result.m_NbErrors += block.NbErrors;
+		_Result.m_Rows.insert( _Result.m_Rows.end(), block.Rows.begin(), block.Rows.end() );
+
+		for( std::map<std::string, JsonQueryGroup>::iterator it = block.Groups.begin(); it != block.Groups.end(); ++it )
+		{
+			std::map<std::string, JsonQueryGroup>::iterator itDest = groups.find( it->first );
+			if( itDest == groups.end() )
+				groups.insert( *it );
+			else
+				MergeGroup( itDest->second, it->second );
+		}
+	}
+
+	// both sides are sorted by key
+	std::vector<JsonQueryGroup> merged;
+	merged.reserve( _Result.m_Groups.size() + groups.size() );
+	std::vector<JsonQueryGroup>::iterator itPrev = _Result.m_Groups.begin();
+	std::map<std::string, JsonQueryGroup>::iterator itNew = groups.begin();
+	while( itPrev != _Result.m_Groups.end() || itNew != groups.end() )
+	{
+		if( itNew == groups.end() || (itPrev != _Result.m_Groups.end() && itPrev->Key < itNew->first) )
+		{
+			merged.push_back( *itPrev++ );
+		}
+		else if( itPrev == _Result.m_Groups.end() || itNew->first < itPrev->Key )
+		{
+			merged.push_back( itNew->second );
+			++itNew;
+		}
+		else
+		{
+			merged.push_back( *itPrev++ );
+			MergeGroup( merged.back(), itNew->second );
+			++itNew;
+		}
+	}
+
+	_Result.m_Groups.swap( merged );
 }
 
-void JsonDocument::OnBeginArray( const char * _pParam1 )
+void JsonQuery::Run( const char * _pBuffer, size_t _Len, JsonQueryResult & _Result, size_t _NbThreads )
 {
-	m_pCurrPair = m_pCurrObject->AddArray( m_pName );
-	m_pCurrObject = m_pCurrPair;
+	ASSERT( _NbThreads > 0, "A query needs at least one thread" );
+
+	_Result.Clear();
+	Compile();
+
+	// a few blocks per thread even out the lines of uneven cost
+	size_t blockSize = _Len / (_NbThreads * 4);
+	if( blockSize < (64 << 10) )
+		blockSize = 64 << 10;
+
+	RunBlocks( _pBuffer, _Len, blockSize, _NbThreads, _Result );
 }
 
-void JsonDocument::OnEndArray( const char * _pParam1 )
+bool JsonQuery::Run( JsonInputStream & _Stream, JsonQueryResult & _Result, size_t _NbThreads, size_t _BlockSize )
 {
-	m_pCurrObject = m_pCurrObject->GetParent();
+	ASSERT( _NbThreads > 0, "A query needs at least one thread" );
+
+	_Result.Clear();
+	Compile();
+
+	std::vector<char> buffer( _NbThreads * _BlockSize );
+	size_t size = 0;
+	for( ;; )
+	{
+		// a line longer than a whole batch grows the buffer
+		if( size == buffer.size() )
+			buffer.resize( 2 * buffer.size() );
+
+		size_t read = _Stream.Read( &buffer[size], buffer.size() - size );
+		size += read;
+
+		if( read == 0 )
+		{
+			RunBlocks( &buffer[0], size, _BlockSize, _NbThreads, _Result );
+			break;
+		}
+
+		if( size < buffer.size() )
+			continue;
+
+		// the partial last line waits for the next batch
+		size_t used = size;
+		while( used > 0 && buffer[used-1] != '\n' )
+			--used;
+
+		if( used == 0 )
+			continue;
+
+		RunBlocks( &buffer[0], used, _BlockSize, _NbThreads, _Result );
+		memmove( &buffer[0], &buffer[used], size - used );
+		size -= used;
+	}
+
+	return !_Stream.HasFailed();
 }
 
-void JsonDocument::OnNewArrayItem( const char * _pParam1 )
+
+#if MINJA_THREADS
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+JsonParserPool::JsonParserPool( size_t _NbThreads, size_t _MaxQueuedJobs, JsonParseMode _Mode, unsigned int _Options )
+	: m_Mode( _Mode )
+	, m_Options( _Options )
+	, m_NextReleaseWorker( 0 )
+	, m_Queue( _MaxQueuedJobs > 0 ? _MaxQueuedJobs : 1 )
+	, m_QueueHead( 0 )
+	, m_NbQueuedJobs( 0 )
+	, m_NbActiveJobs( 0 )
+	, m_bStopping( false )
 {
-	m_bUseNextStringAsKey = false;
-	m_pName = NULL;
+	ASSERT( _NbThreads > 0, "A parser pool needs at least one thread" );
+
+	for( size_t w=0; w<_NbThreads; ++w )
+		m_Workers.push_back( new Worker );
+
+	for( size_t w=0; w<_NbThreads; ++w )
+		m_Workers[w]->Thread = std::thread( &JsonParserPool::WorkerLoop, this, std::ref( *m_Workers[w] ) );
 }
 
-void JsonDocument::OnBeginPair( const char * _pParam1 )
+JsonParserPool::~JsonParserPool()
 {
-	m_bUseNextStringAsKey = true;
-	m_pName = NULL;
+	{
+		std::unique_lock<std::mutex> lock( m_QueueMutex );
+		m_bStopping = true;
+	}
+	m_QueueNotEmpty.notify_all();
+
+	for( size_t w=0; w<m_Workers.size(); ++w )
+	{
+		m_Workers[w]->Thread.join();
+
+		for( size_t d=0; d<m_Workers[w]->FreeDocs.size(); ++d )
+			delete m_Workers[w]->FreeDocs[d];
+
+		delete m_Workers[w];
+	}
 }
 
-void JsonDocument::OnEndPair( const char * _pParam1 )
+void JsonParserPool::PushJob( const Job & _Job )
 {
+	m_Queue[ (m_QueueHead + m_NbQueuedJobs) % m_Queue.size() ] = _Job;
+	++m_NbQueuedJobs;
 }
 
-void JsonDocument::OnString( const char * _pParam1, const char * _pParam2 )
+void JsonParserPool::Submit( const char * _pBuffer, Listener & _Listener, void * _pUserData )
 {
-	if( m_bUseNextStringAsKey )
+	Job job = { _pBuffer, &_Listener, _pUserData };
+
 	{
-		size_t len = _pParam2 - _pParam1 - 2;
-		ASSERT( len < MaxKeyName, "Name too long. Consider a shorter name of changing MaxKeyName" );
+		std::unique_lock<std::mutex> lock( m_QueueMutex );
+		while( m_NbQueuedJobs == m_Queue.size() )
+			m_QueueNotFull.wait( lock );
 
-		memcpy(m_pTempName, _pParam1+1, len );
-		m_pTempName[len] = 0;
-		m_pName = m_pTempName;
-		m_bUseNextStringAsKey = false;
+		PushJob( job );
 	}
-	else
+	m_QueueNotEmpty.notify_one();
+}
+
+bool JsonParserPool::TrySubmit( const char * _pBuffer, Listener & _Listener, void * _pUserData )
+{
+	Job job = { _pBuffer, &_Listener, _pUserData };
+
 	{
-		size_t len = _pParam2 - _pParam1 - 2;
-		m_pCurrPair = m_pCurrObject->AddString( m_pName, _pParam1 + 1, _pParam2 - _pParam1 - 2 );
+		std::unique_lock<std::mutex> lock( m_QueueMutex );
+		if( m_NbQueuedJobs == m_Queue.size() )
+			return false;
+
+		PushJob( job );
 	}
+	m_QueueNotEmpty.notify_one();
+	return true;
 }
 
-void JsonDocument::OnNumber( const char * _pParam1, const char * _pParam2 )
+void JsonParserPool::WaitIdle()
 {
-	char text[64];
-	size_t size = _pParam2 - _pParam1;
-	memcpy( text, _pParam1, size );
-	text[size] = 0;
-
-	m_pCurrPair = m_pCurrObject->AddNumber( m_pName, (float) atof(text) );
+	std::unique_lock<std::mutex> lock( m_QueueMutex );
+	while( m_NbQueuedJobs > 0 || m_NbActiveJobs > 0 )
+		m_Idle.wait( lock );
 }
 
-void JsonDocument::OnNull( const char * _pParam1, const char * _pParam2 )
+void JsonParserPool::ParseBatch( const char * const * _ppBuffers, size_t _NbBuffers, JsonDocument ** _ppDocs )
 {
-	m_pCurrPair = m_pCurrObject->AddNull( m_pName );
+	// collects the documents of one batch and wakes the caller when the last one is in
+	class BatchListener : public Listener
+	{
+	public:
+		JsonDocument ** m_ppDocs;
+		size_t m_NbPending;
+		std::mutex m_Mutex;
+		std::condition_variable m_Done;
+
+		virtual void OnParsed( const char * _pBuffer, JsonDocument * _pDoc, void * _pUserData )
+		{
+			m_ppDocs[ (size_t) _pUserData ] = _pDoc;
+
+			std::unique_lock<std::mutex> lock( m_Mutex );
+			if( --m_NbPending == 0 )
+				m_Done.notify_one();
+		}
+	};
+
+	BatchListener batch;
+	batch.m_ppDocs = _ppDocs;
+	batch.m_NbPending = _NbBuffers;
+
+	for( size_t b=0; b<_NbBuffers; ++b )
+		Submit( _ppBuffers[b], batch, (void *) b );
+
+	std::unique_lock<std::mutex> lock( batch.m_Mutex );
+	while( batch.m_NbPending > 0 )
+		batch.m_Done.wait( lock );
 }
 
-void JsonDocument::OnTrue( const char * _pParam1, const char * _pParam2 )
+void JsonParserPool::Release( JsonDocument * _pDoc )
 {
-	m_pCurrPair = m_pCurrObject->AddBool( m_pName, true );
+	if( _pDoc == NULL )
+		return;
+
+	// spread returned documents over the workers so no single free list becomes a hot spot
+	Worker * pWorker;
+	{
+		std::unique_lock<std::mutex> lock( m_QueueMutex );
+		pWorker = m_Workers[ m_NextReleaseWorker++ % m_Workers.size() ];
+	}
+
+	std::unique_lock<std::mutex> lock( pWorker->FreeDocsMutex );
+	pWorker->FreeDocs.push_back( _pDoc );
 }
 
-void JsonDocument::OnFalse( const char * _pParam1, const char * _pParam2 )
+JsonDocument * JsonParserPool::AcquireDocument( Worker & _Worker )
 {
-	m_pCurrPair = m_pCurrObject->AddBool( m_pName, false );
+	{
+		std::unique_lock<std::mutex> lock( _Worker.FreeDocsMutex );
+		if( !_Worker.FreeDocs.empty() )
+		{
+			JsonDocument * pDoc = _Worker.FreeDocs.back();
+			_Worker.FreeDocs.pop_back();
+			return pDoc;
+		}
+	}
+
+	JsonDocument * pDoc = JsonDocument::Create( m_Mode );
+	pDoc->SetOptions( m_Options );
+	return pDoc;
 }
 
-void JsonDocument::OnError( const char * _pParam1, const char * _pParam2, const char * _pParam3 )
+void JsonParserPool::WorkerLoop( Worker & _Worker )
 {
-	const int snippetLength = 64;
-	char message[snippetLength];
+	for( ;; )
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock( m_QueueMutex );
+			while( m_NbQueuedJobs == 0 && !m_bStopping )
+				m_QueueNotEmpty.wait( lock );
 
-	size_t len = _pParam2 - _pParam1;
-	len = (len > snippetLength-1) ? snippetLength-1 : len;
-	const char * pStart = _pParam2 - len;
+			if( m_NbQueuedJobs == 0 )
+				return;
 
-	memset( message, 0, snippetLength );
-	memcpy( message, pStart, len );
+			job = m_Queue[m_QueueHead];
+			m_QueueHead = (m_QueueHead + 1) % m_Queue.size();
+			--m_NbQueuedJobs;
+			++m_NbActiveJobs;
+		}
+		m_QueueNotFull.notify_one();
 
-	Log( "Json", "%s. Location: %s<-Here!", _pParam3, message );
-}
+		JsonDocument * pDoc = AcquireDocument( _Worker );
+		if( !JsonDocument::ParseInto( *pDoc, job.pBuffer ) )
+		{
+			std::unique_lock<std::mutex> lock( _Worker.FreeDocsMutex );
+			_Worker.FreeDocs.push_back( pDoc );
+			pDoc = NULL;
+		}
 
+		job.pListener->OnParsed( job.pBuffer, pDoc, job.pUserData );
 
-//------------------------------------------------------------------------------
-//------------------------------------------------------------------------------
-//------------------------------------------------------------------------------
+		{
+			std::unique_lock<std::mutex> lock( m_QueueMutex );
+			--m_NbActiveJobs;
+			if( m_NbQueuedJobs == 0 && m_NbActiveJobs == 0 )
+				m_Idle.notify_all();
+		}
+	}
+}
+
+#endif //MINJA_THREADS
@@ -22,13 +22,18 @@
 #define __JSON_PARSER__
 
 
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <list>
+#include <map>
+#include <string>
 #include <vector>
 
 
 /// \todo:
 /// - support for \u in strings
 /// - support for comments? /* and */ make most sense as JSON will most likely be condensed in 1 liners
-/// - check uniqueness of keys when adding pairs
 
 
 //------------------------------------------------------------------------------
@@ -43,6 +48,50 @@
 #define ASSERT_NE( a, b )		assert( (a) != (b) )
 #define Log( cat, msg, ... )	printf( msg, __VA_ARGS__ )
 
+//--- SIMD code paths are enabled when the target instruction set is known at compile time. 
+//--- Define MINJA_NO_SIMD to force the scalar fallbacks.
+#if !defined(MINJA_NO_SIMD) && !defined(MINJA_SIMD_SSSE3) && (defined(__SSSE3__) || defined(__AVX__))
+#define MINJA_SIMD_SSSE3		1
+#endif
+
+//--- Multithreaded services need C++11 threads. Define MINJA_NO_THREADS to leave them out.
+#if !defined(MINJA_NO_THREADS) && !defined(MINJA_THREADS) && (__cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1700))
+#define MINJA_THREADS			1
+#endif
+
+#if MINJA_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+//--- JSON literals are parsed at compile time with C++17 constexpr, see MINJA_JSON_LITERAL.
+#if !defined(MINJA_CONSTEXPR) && (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#define MINJA_CONSTEXPR			1
+#endif
+
+//--- Builders take std::unique_ptr with C++11, and std::string_view with C++17.
+#if !defined(MINJA_UNIQUE_PTR) && (__cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1600))
+#define MINJA_UNIQUE_PTR		1
+#endif
+
+#if !defined(MINJA_STRING_VIEW) && (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#define MINJA_STRING_VIEW		1
+#endif
+
+#if MINJA_UNIQUE_PTR
+#include <memory>
+#endif
+
+#if MINJA_STRING_VIEW
+#include <string_view>
+#endif
+
+//--- Compressed input needs zlib: define MINJA_ZLIB and link with it to enable JsonInflateInputStream.
+#if MINJA_ZLIB
+#include <zlib.h>
+#endif
+
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -52,6 +101,34 @@
 class JsonNode;
 class JsonNodeVisitor;
 class JsonDocument;
+class JsonKeySet;
+class JsonShape;
+class JsonInputStream;
+class JsonStreamFramer;
+class JsonSpanDocument;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/// Syntax errors, as reported by JsonValidate and by the tokenizer
+enum JsonValidateError
+{
+	JsonValidateError_None,
+	JsonValidateError_BadRoot,				// the root must be an object or an array
+	JsonValidateError_TooDeep,
+	JsonValidateError_ExpectedValue,
+	JsonValidateError_ExpectedKey,
+	JsonValidateError_ExpectedColon,
+	JsonValidateError_ExpectedObjectEnd,	// a ',' or a '}' was expected
+	JsonValidateError_ExpectedArrayEnd,		// a ',' or a ']' was expected
+	JsonValidateError_BadNumber,
+	JsonValidateError_BadEscape,
+	JsonValidateError_UnterminatedString,
+	JsonValidateError_InvalidUtf8,
+	JsonValidateError_TrailingCharacters,
+};
 
 
 //------------------------------------------------------------------------------
@@ -60,9 +137,56 @@ class JsonDocument;
 
 namespace JsonTokenizer
 {
+	enum Option
+	{
+		Option_ValidateUtf8		= 1 << 0,	// strings must be well formed UTF-8. Failures are reported through OnError
+
+		// duplicate key policies, applied by JsonDocument both when parsing and in the Add* builders
+		Option_RejectDuplicateKeys	= 1 << 1,	// parsing fails, Add* return NULL
+		Option_KeepFirstKey			= 1 << 2,	// later values of a key are dropped
+		Option_KeepLastKey			= 1 << 3,	// the last value of a key wins, at the position of the first
+		Option_DuplicateKeyPolicy	= Option_RejectDuplicateKeys | Option_KeepFirstKey | Option_KeepLastKey,
+
+		// documents reused for messages of a fixed shape predict each key from the previous parse
+		Option_LearnShape			= 1 << 4,	// see JsonDocument::HasMatchedShape
+
+		// arrays holding only numbers are stored as one contiguous array of floats
+		Option_PackNumbers			= 1 << 5,	// see JsonNode::GetNumbers
+	};
+
 	class TokenProcessor
 	{
+	protected:
+		unsigned int m_Options;
+		size_t m_MaxDepth;			// nesting of objects and arrays the tokenizer accepts
+		size_t m_Depth;
+		bool m_bStopped;
+		const char * m_pInputBase;		// error locations are turned into offsets from it
+		size_t m_InputBaseOffset;
+
 	public:
+		TokenProcessor() : m_Options( 0 ), m_MaxDepth( (size_t) -1 ), m_Depth( 0 ), m_bStopped( false ), m_pInputBase( NULL ), m_InputBaseOffset( 0 ) {}
+
+		void SetOptions( unsigned int _Options )	{ m_Options = _Options; }
+		unsigned int GetOptions() const				{ return m_Options; }
+		void SetMaxDepth( size_t _MaxDepth )		{ m_MaxDepth = _MaxDepth; }
+		size_t GetMaxDepth() const					{ return m_MaxDepth; }
+
+		/// Makes the tokenizer fail before the next value, for processors giving up on their input
+		void Stop()									{ m_bStopped = true; }
+		bool IsStopped() const						{ return m_bStopped; }
+
+		// maintained by the tokenizer around each object and array
+		void EnterContainer()						{ ++m_Depth; }
+		void LeaveContainer()						{ --m_Depth; }
+		bool IsTooDeep() const						{ return m_Depth > m_MaxDepth; }
+		size_t GetDepth() const						{ return m_Depth; }
+
+		/// Where the input being tokenized starts, for processors reporting error offsets.
+		/// Streamed inputs move their base as their buffer slides.
+		void SetInputBase( const char * _pBase, size_t _Offset )	{ m_pInputBase = _pBase; m_InputBaseOffset = _Offset; }
+		size_t GetInputOffset( const char * _pLocation ) const		{ return m_pInputBase ? m_InputBaseOffset + (_pLocation - m_pInputBase) : (size_t) -1; }
+
 		virtual void OnBeginObject( const char * _pParam1 ) {}
 		virtual void OnEndObject( const char * _pParam1 ) {}
 		virtual void OnBeginArray( const char * _pParam1 ) {}
@@ -76,6 +200,8 @@ namespace JsonTokenizer
 		virtual void OnTrue( const char * _pParam1, const char * _pParam2 ) {}
 		virtual void OnFalse( const char * _pParam1, const char * _pParam2 ) {}
 		virtual void OnError( const char * _pParam1, const char * _pParam2, const char * _pParam3 ) {}
+		/// Grammar errors come with their code, and go to OnError unless overridden
+		virtual void OnSyntaxError( const char * _pParam1, const char * _pParam2, const char * _pParam3, JsonValidateError _Error ) { OnError( _pParam1, _pParam2, _pParam3 ); }
 	};
 
 	enum ParseResult
@@ -88,6 +214,7 @@ namespace JsonTokenizer
 	const char * SkipWhitespaces( const char * _pCurr );
 	bool IsOneOf( char _Val, const char * _Chars );
 	bool IsStringDelimiter( char _Val );
+	bool ValidateUtf8( const char * _pBegin, const char * _pEnd, const char ** _ppError );
 
 	ParseResult ReadKeyword( TokenProcessor & _Ctx,  const char * _pCurr, const char ** _ppEnd );
 	ParseResult ReadArray( TokenProcessor & _Ctx,  const char * _pCurr, const char ** _ppEnd );
@@ -98,6 +225,168 @@ namespace JsonTokenizer
 	ParseResult ReadValue( TokenProcessor & _Ctx,  const char * _pCurr, const char ** _ppEnd );
 };
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+struct JsonValidateResult
+{
+	JsonValidateError Error;
+	size_t Offset;		// offset of the offending byte, or the buffer length when valid
+
+	bool IsValid() const	{ return Error == JsonValidateError_None; }
+};
+
+/// Checks that _pBuffer holds one well formed document, with the same grammar as JsonDocument::Parse,
+/// without any callback nor allocation. Unlike Parse, only whitespaces may follow the root.
+/// Option_ValidateUtf8 is the only option that applies.
+JsonValidateResult JsonValidate( const char * _pBuffer, size_t _Len, unsigned int _Options = 0 );
+
+enum JsonParseErrorCode
+{
+	JsonParseError_None,
+	JsonParseError_Syntax,			// see JsonParseError::Syntax
+	JsonParseError_TooDeep,
+	JsonParseError_InputTooLarge,
+	JsonParseError_TooManyNodes,
+	JsonParseError_MemoryLimit,
+	JsonParseError_StringTooLong,
+	JsonParseError_KeyTooLong,
+	JsonParseError_NumberTooLong,
+	JsonParseError_DuplicateKey,
+	JsonParseError_ReadError,		// the input stream failed
+};
+
+/// First error of a parse. Only a few integers are recorded when it happens: the expected
+/// token, line, column and context snippet are worked out from the input when asked for.
+struct JsonParseError
+{
+	JsonParseErrorCode Code;
+	JsonValidateError Syntax;		// what was expected, for syntax errors
+	size_t Offset;					// of the offending byte, (size_t) -1 when unknown
+	size_t Depth;					// nesting at the error, the root counting as 1
+	const char * pMessage;			// static text
+
+	JsonParseError();
+
+	bool IsError() const			{ return Code != JsonParseError_None; }
+
+	/// As it would be written in a message: "a value", "':'", "',' or '}'"... Empty when not a syntax error.
+	const char * GetExpected() const;
+	/// 1 based, counted from the start of the parsed input
+	void GetLineColumn( const char * _pInput, size_t * _pLine, size_t * _pColumn ) const;
+	/// Up to _MaxLength bytes of input, ending right before the error
+	std::string GetSnippet( const char * _pInput, size_t _MaxLength = 63 ) const;
+	/// One line with all of the above
+	std::string Format( const char * _pInput ) const;
+};
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/// Sequential source of bytes for the streaming entry points (see JsonReadStream)
+class JsonInputStream
+{
+public:
+	virtual ~JsonInputStream() {}
+
+	/// Reads up to _Size bytes and returns how many were read, 0 only once the input is exhausted
+	virtual size_t Read( char * _pBuffer, size_t _Size ) = 0;
+	virtual bool HasFailed() const			{ return false; }
+};
+
+class JsonFileInputStream : public JsonInputStream
+{
+protected:
+	FILE * m_pFile;
+
+public:
+	explicit JsonFileInputStream( FILE * _pFile ) : m_pFile( _pFile ) {}
+
+	virtual size_t Read( char * _pBuffer, size_t _Size )	{ return fread( _pBuffer, 1, _Size, m_pFile ); }
+	virtual bool HasFailed() const							{ return ferror( m_pFile ) != 0; }
+};
+
+#if MINJA_THREADS
+
+/// Reads its source ahead on a dedicated thread, into a ring of chunks, so that the
+/// I/O of the next chunks overlaps the parsing of the current one.
+class JsonReadAheadStream : public JsonInputStream
+{
+protected:
+	struct Chunk
+	{
+		std::vector<char> Data;
+		size_t Size;
+	};
+
+	JsonInputStream & m_Source;
+	std::vector<Chunk> m_Chunks;
+	size_t m_Head;				// next chunk to consume
+	size_t m_Tail;				// next chunk to fill
+	size_t m_NbFilled;
+	size_t m_ReadOffset;		// within the head chunk
+	bool m_bStopping;
+	bool m_bFailed;
+
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_ChunkFilled;
+	std::condition_variable m_ChunkFreed;
+	std::thread m_Reader;
+
+public:
+	JsonReadAheadStream( JsonInputStream & _Source, size_t _ChunkSize = 1 << 20, size_t _NbChunks = 4 );
+	~JsonReadAheadStream();
+
+	virtual size_t Read( char * _pBuffer, size_t _Size );
+	virtual bool HasFailed() const;
+
+protected:
+	void ReaderLoop();
+
+private:
+	JsonReadAheadStream( const JsonReadAheadStream & );
+	JsonReadAheadStream & operator = ( const JsonReadAheadStream & );
+};
+
+#endif //MINJA_THREADS
+
+#if MINJA_ZLIB
+
+/// Decompresses gzip or zlib data from its source as it is read, through a fixed size input buffer.
+/// Concatenated gzip members are read as one stream. Put a JsonReadAheadStream on top of it to
+/// run the decompression on a separate thread, overlapping the parsing.
+class JsonInflateInputStream : public JsonInputStream
+{
+protected:
+	JsonInputStream & m_Source;
+	z_stream m_ZStream;
+	std::vector<char> m_Input;
+	bool m_bAtMemberEnd;
+	bool m_bFailed;
+
+public:
+	JsonInflateInputStream( JsonInputStream & _Source, size_t _InputBufferSize = 64 * 1024 );
+	~JsonInflateInputStream();
+
+	virtual size_t Read( char * _pBuffer, size_t _Size );
+	virtual bool HasFailed() const			{ return m_bFailed; }
+
+private:
+	JsonInflateInputStream( const JsonInflateInputStream & );
+	JsonInflateInputStream & operator = ( const JsonInflateInputStream & );
+};
+
+#endif //MINJA_ZLIB
+
+/// Feeds a whole document from a stream to a TokenProcessor, with the same events as 
+/// ReadObject / ReadArray. The stream is cut at the boundaries of the root's children,
+/// and only the child being tokenized is held in memory: a child straddling two reads 
+/// is carried over to the next one.
+bool JsonReadStream( JsonTokenizer::TokenProcessor & _Ctx, JsonInputStream & _Stream );
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -114,76 +403,354 @@ enum JsonNodeType
 };
 
 
+/// Controls how a parsed document stores its strings and key names:
+/// - Copy: every string and name is copied in the string storage of the document
+/// - BorrowBuffer: strings and names are (pointer, length) views into the source buffer. 
+///   The caller guarantees that the buffer outlives the document. Views are NOT null 
+///   terminated, so use GetStringLength() / GetNameLength() to read them.
+enum JsonParseMode
+{
+	JsonParseMode_Copy,
+	JsonParseMode_BorrowBuffer
+};
+
+/// Bounds on what a parse may consume, so that one oversized or hostile input fails fast
+/// instead of exhausting a worker. 0 means no limit. Only parsing is checked, not the Add* builders.
+struct JsonParseLimits
+{
+	size_t MaxBytes;			// input size. A null terminated buffer is not scanned past it
+	size_t MaxDepth;			// nesting of objects and arrays, the root counting as 1
+	size_t MaxNodes;
+	size_t MaxStringLength;		// in bytes, escape sequences as written. Also bounds the text of numbers
+	size_t MaxKeyLength;
+	size_t MaxMemory;			// bytes of nodes, strings and child arrays used by the document
+
+	JsonParseLimits() : MaxBytes( 0 ), MaxDepth( 0 ), MaxNodes( 0 ), MaxStringLength( 0 ), MaxKeyLength( 0 ), MaxMemory( 0 ) {}
+};
+
+/// A string handed to the builders with its length, so that it isn't measured again.
+/// A borrowed string is referenced instead of copied: it must outlive the document, as
+/// string literals and buffers owned by the caller do, and it needs no null terminator.
+/// A NULL string names no key, for array items.
+struct JsonStringRef
+{
+	const char * pData;
+	size_t Length;
+	bool bBorrowed;
+
+	JsonStringRef() : pData( NULL ), Length( 0 ), bBorrowed( false ) {}
+	JsonStringRef( const char * _pString ) : pData( _pString ), Length( _pString ? strlen( _pString ) : 0 ), bBorrowed( false ) {}
+	JsonStringRef( const char * _pData, size_t _Length, bool _bBorrowed = false ) : pData( _pData ), Length( _Length ), bBorrowed( _bBorrowed ) {}
+	JsonStringRef( const std::string & _String ) : pData( _String.data() ), Length( _String.size() ), bBorrowed( false ) {}
+#if MINJA_STRING_VIEW
+	JsonStringRef( std::string_view _String ) : pData( _String.data() ), Length( _String.size() ), bBorrowed( false ) {}
+#endif
+
+	static JsonStringRef Borrow( const char * _pData, size_t _Length )		{ return JsonStringRef( _pData, _Length, true ); }
+};
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 
+/// Nodes take 32 bytes on 64 bit targets and have no virtual table. Children are stored as contiguous
+/// arrays of pointers, allocated in the document storage. Strings short enough to fit in the
+/// value itself are stored inline, null terminated, whatever the parse mode.
+/// operator [] returns an invalid node instead of NULL, which reads as false, 0 or an error 
+/// string and whose own operator [] returns itself, so lookups can be chained safely.
 class JsonNode
 {
-protected:
-	typedef std::vector<JsonNode *>		NodeVector;
+	friend class JsonDocument;
 
 public:
-	typedef NodeVector::iterator		iterator;
-	typedef NodeVector::const_iterator	const_iterator;
+	typedef JsonNode **					iterator;
+
+	class const_iterator;
+
+	enum
+	{
+		MaxNameLength = (1 << 24) - 1,
+		InlineStringCapacity = sizeof(char *) - 1,
+	};
 
 protected:
-	JsonNodeType m_Type;
+	enum
+	{
+		Flag_Invalid		= 1 << 0,	// the node returned for missing children
+		Flag_InlineString	= 1 << 1,	// the string is held by m_Value.Inline
+		Flag_PackedNumbers	= 1 << 2,	// the array is held by m_Value.Children as m_Length floats
+		Flag_BorrowedString	= 1 << 3,	// m_Value.String points to memory the document doesn't own
+	};
+
 	JsonNode * m_pParent;
 	char * m_pName;
 
 	union
 	{
 		char * String;
+		char Inline[sizeof(char *)];
 		bool Bool;
 		float Number;
-		NodeVector * Children;
-		NodeVector * Items;
+		JsonNode ** Children;			// the capacity of the array is stored just before it, in pointers
 	} m_Value;
 
+	unsigned int m_Length;				// of the string, or number of children
+	unsigned int m_NameLength : 24;
+	unsigned int m_Type : 4;
+	unsigned int m_Flags : 4;
+
+	static const JsonNode s_InvalidNode;
+
 public:
 	JsonNode();
-	virtual ~JsonNode();
 
-	JsonNodeType GetType() const;
-	JsonNode * GetParent() const;
-	const char * GetName() const;
-	virtual bool IsValid() const;
+	JsonNodeType GetType() const				{ return (JsonNodeType) m_Type; }
+	JsonNode * GetParent() const				{ return m_pParent; }
+	const char * GetName() const				{ return m_pName; }
+	size_t GetNameLength() const				{ return m_NameLength; }
+	bool IsValid() const						{ return !(m_Flags & Flag_Invalid); }
 
-	virtual bool GetBool() const;
-	virtual float GetNumber() const;
-	virtual const char * GetString() const;
+	inline bool GetBool() const;
+	inline float GetNumber() const;
+	inline const char * GetString() const;
+	inline size_t GetStringLength() const;
 
-	virtual const size_t GetNbChildren() const;
-	virtual const JsonNode * GetChild( const char * _pName ) const;
-	virtual const JsonNode * GetChild( size_t _Index ) const;
-	virtual const NodeVector & GetChildren() const;
-	virtual bool IsLastChild() const;
+	inline size_t GetNbChildren() const;
 
-	virtual iterator begin();
-	virtual const_iterator begin() const;
-	virtual iterator end();
-	virtual const_iterator end() const;
+	/// A packed array stores its numbers as one contiguous array of GetNbChildren() floats instead
+	/// of one node each, see JsonTokenizer::Option_PackNumbers and AddNumbers. GetNumbers returns 
+	/// that array, or NULL when the array isn't packed. The const GetChild and operator [] have no
+	/// node to return for a packed number: const readers use GetNumbers, or the const iterators
+	/// whose nodes are views valid until the iterator moves. The non const accessors, Visit and
+	/// the edits unpack the array for good, as does Freeze.
+	inline bool IsPacked() const;
+	inline const float * GetNumbers() const;
 
-	virtual const JsonNode & operator [] ( size_t _Index ) const;
-	virtual const JsonNode & operator [] ( const char * _pName ) const;
+	const JsonNode * GetChild( const char * _pName ) const;
+	const JsonNode * GetChild( const char * _pName, size_t _NameLength ) const;
+	inline const JsonNode * GetChild( size_t _Index ) const;
+	JsonNode * GetChild( const char * _pName );
+	JsonNode * GetChild( size_t _Index );
+	bool IsLastChild() const;
+
+	inline iterator begin();
+	inline const_iterator begin() const;
+	inline iterator end();
+	inline const_iterator end() const;
+
+	const JsonNode & operator [] ( size_t _Index ) const;
+	const JsonNode & operator [] ( const char * _pName ) const;
 
 	JsonNode * AddNull( const char * _pName );
 	JsonNode * AddBool( const char * _pName, bool _Value );
 	JsonNode * AddNumber( const char * _pName, float _Value );
 	JsonNode * AddString( const char * _pName, const char * _pValue );
 	JsonNode * AddString( const char * _pName, const char * _pBegin, size_t _Len );
+	JsonNode * AddNumbers( const char * _pName, const float * _pValues, size_t _Count );
 	JsonNode * AddArray( const char * _pName );
 	JsonNode * AddObject( const char * _pName );
-	
+	JsonNode * AddCopy( const char * _pName, const JsonNode & _Source );
+
+	/// Same builders for measured or borrowed strings, see JsonStringRef. Containers can be
+	/// given the number of children they will get, so their child array is allocated once.
+	JsonNode * AddNull( const JsonStringRef & _Name );
+	JsonNode * AddBool( const JsonStringRef & _Name, bool _Value );
+	JsonNode * AddNumber( const JsonStringRef & _Name, float _Value );
+	JsonNode * AddString( const JsonStringRef & _Name, const JsonStringRef & _Value );
+	JsonNode * AddArray( const JsonStringRef & _Name, size_t _NbChildren = 0 );
+	JsonNode * AddObject( const JsonStringRef & _Name, size_t _NbChildren = 0 );
+	void ReserveChildren( size_t _NbChildren );
+
+	/// _pNode must be a node of the same document, detached from its previous parent
 	void AttachNode( JsonNode * _pNode );
+#if MINJA_UNIQUE_PTR
+	/// Moves a whole document under this node, without copying: its storage joins the storage of 
+	/// this document, and its root becomes the returned child. The document is left to the caller
+	/// when the child can't be added (duplicate key policy), and NULL is returned.
+	JsonNode * AttachDocument( const JsonStringRef & _Name, std::unique_ptr<JsonDocument> && _pDoc );
+#endif
+
+	/// In-place edits. Setters may change the type of a value node: the previous value is 
+	/// simply dropped, as it lives in the document storage anyway. Removed children stay 
+	/// readable until the next Reset of the document.
+	/// Without _bKeepOrder, removal swaps the last child in and runs in O(1).
+	void SetNull();
+	void SetBool( bool _Value );
+	void SetNumber( float _Value );
+	void SetString( const char * _pValue );
+	void SetString( const char * _pBegin, size_t _Len );
+
+	JsonNode * InsertAt( size_t _Index, const char * _pName, JsonNodeType _Type );
+	JsonNode * ReplaceChild( size_t _Index, const JsonNode & _Source );
+	JsonNode * ReplaceChild( const char * _pName, const JsonNode & _Source );
+	bool RemoveChild( size_t _Index, bool _bKeepOrder = true );
+	bool RemoveChild( const char * _pName, bool _bKeepOrder = true );
+
+	/// Structural hash of the subtree: ignores formatting and the order of object keys
+	unsigned long long GetHash() const;
+	/// Structural equality, consistent with GetHash. Names are not compared, only the children's.
+	bool IsEqual( const JsonNode & _Other ) const;
+
+	/// Deep copies this object or array into a new mutable document, with all its nodes
+	/// and strings laid out in one block each.
+	JsonDocument * Clone() const;
 
 	bool Visit( JsonNodeVisitor & _Visitor );
 
 protected:
-	JsonNode * CreateNode( const char * _pName, JsonNodeType _Type );
+	explicit JsonNode( unsigned int _Flags );
+
+	JsonDocument * GetDocument();
+	void MeasureSubtree( size_t & _NbNodes, size_t & _NbPackedNumbers, size_t & _NbStorageBytes ) const;
+	JsonNode * CopyNode( JsonDocument & _Doc, const char * _pName, size_t _NameLength, const JsonNode & _Source );
+	void CloneChildren( JsonDocument & _Doc, const JsonNode & _Source );
+	JsonNode * CreateNode( JsonDocument & _Doc, const JsonStringRef & _Name, JsonNodeType _Type );
+	JsonNode * CreateNode( JsonDocument & _Doc, const char * _pName, size_t _NameLength, bool _bBorrowName, JsonNodeType _Type );
+	JsonNode * CreateDetachedNode( JsonDocument & _Doc, const char * _pName, size_t _NameLength, bool _bBorrowName, JsonNodeType _Type );
+	size_t GetChildCapacity() const;
+	void ReserveChildren( JsonDocument & _Doc, size_t _Capacity );
+	void PushChild( JsonDocument & _Doc, JsonNode * _pNode );
+	void SetStringValue( JsonDocument & _Doc, const char * _pBegin, size_t _Len, bool _bBorrow );
+	void PushNumber( JsonDocument & _Doc, float _Value );
+	void SetPackedNumbers( JsonDocument & _Doc, const float * _pValues, size_t _Count );
+	void UnpackNumbers();
+	void UnpackSubtree();
+	void MoveLastChildTo( size_t _Index );
+	size_t FindChildIndex( const JsonNode * _pChild ) const;
+	void BeginValueEdit( JsonNodeType _Type );
+};
+
+bool JsonNode::GetBool() const
+{
+	if( m_Flags & Flag_Invalid )
+		return false;
+
+	ASSERT( m_Type == JsonNodeType_Bool, "Wrong node type. Not a bool" );
+	return m_Value.Bool;
+}
+
+float JsonNode::GetNumber() const
+{
+	if( m_Flags & Flag_Invalid )
+		return 0.0f;
+
+	ASSERT( m_Type == JsonNodeType_Number, "Wrong node type. Not a number" );
+	return m_Value.Number;
+}
+
+const char * JsonNode::GetString() const
+{
+	if( m_Flags & Flag_Invalid )
+		return "! invalid Json node";
+
+	ASSERT( m_Type == JsonNodeType_String, "Wrong node type. Not a string" );
+	return (m_Flags & Flag_InlineString) ? m_Value.Inline : m_Value.String;
+}
+
+size_t JsonNode::GetStringLength() const
+{
+	if( m_Flags & Flag_Invalid )
+		return sizeof("! invalid Json node") - 1;
+
+	ASSERT( m_Type == JsonNodeType_String, "Wrong node type. Not a string" );
+	return m_Length;
+}
+
+size_t JsonNode::GetNbChildren() const
+{
+	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
+	return m_Length;
+}
+
+bool JsonNode::IsPacked() const
+{
+	return (m_Flags & Flag_PackedNumbers) != 0;
+}
+
+const float * JsonNode::GetNumbers() const
+{
+	return (m_Flags & Flag_PackedNumbers) ? reinterpret_cast<const float *>( m_Value.Children ) : NULL;
+}
+
+/// Iterates the child pointers, or the numbers of a packed array through a view held by the
+/// iterator itself.
+class JsonNode::const_iterator
+{
+	JsonNode * const * m_ppChild;
+	const JsonNode * m_pPacked;		// the packed array, NULL otherwise
+	size_t m_Index;
+	mutable JsonNode m_View;
+
+public:
+	const_iterator() : m_ppChild( NULL ), m_pPacked( NULL ), m_Index( 0 ) {}
+	const_iterator( JsonNode * const * _ppChild ) : m_ppChild( _ppChild ), m_pPacked( NULL ), m_Index( 0 ) {}
+	const_iterator( const JsonNode * _pPacked, size_t _Index ) : m_ppChild( NULL ), m_pPacked( _pPacked ), m_Index( _Index ) {}
+
+	inline const JsonNode * operator * () const;
+	const_iterator & operator ++ ()								{ if( m_pPacked ) ++m_Index; else ++m_ppChild; return *this; }
+	const_iterator operator ++ ( int )							{ const_iterator prev = *this; ++*this; return prev; }
+	bool operator == ( const const_iterator & _Other ) const	{ return m_ppChild == _Other.m_ppChild && m_Index == _Other.m_Index; }
+	bool operator != ( const const_iterator & _Other ) const	{ return !(*this == _Other); }
+	ptrdiff_t operator - ( const const_iterator & _Other ) const	{ return m_pPacked ? (ptrdiff_t) m_Index - (ptrdiff_t) _Other.m_Index : m_ppChild - _Other.m_ppChild; }
 };
 
+const JsonNode * JsonNode::const_iterator::operator * () const
+{
+	if( !m_pPacked )
+		return *m_ppChild;
+
+	// the view keeps its index in m_Length, which a number doesn't use, for IsLastChild
+	m_View.m_pParent = const_cast<JsonNode *>( m_pPacked );
+	m_View.m_Type = JsonNodeType_Number;
+	m_View.m_Length = (unsigned int) m_Index;
+	m_View.m_Value.Number = m_pPacked->GetNumbers()[m_Index];
+	return &m_View;
+}
+
+const JsonNode * JsonNode::GetChild( size_t _Index ) const
+{
+	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
+	ASSERT( _Index < m_Length, "Index out of bounds" );
+
+	ASSERT( !(m_Flags & Flag_PackedNumbers), "Packed array. Read its numbers with GetNumbers" );
+	if( m_Flags & Flag_PackedNumbers )
+		return NULL;
+	return m_Value.Children[_Index];
+}
+
+JsonNode::iterator JsonNode::begin()
+{
+	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
+	if( m_Flags & Flag_PackedNumbers )
+		UnpackNumbers();
+	return m_Value.Children;
+}
+
+JsonNode::const_iterator JsonNode::begin() const
+{
+	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
+	if( m_Flags & Flag_PackedNumbers )
+		return const_iterator( this, 0 );
+	return m_Value.Children;
+}
+
+JsonNode::iterator JsonNode::end()
+{
+	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
+	if( m_Flags & Flag_PackedNumbers )
+		UnpackNumbers();
+	return m_Value.Children + m_Length;
+}
+
+JsonNode::const_iterator JsonNode::end() const
+{
+	ASSERT( m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array, "Wrong node type. Not Object nor Array" );
+	if( m_Flags & Flag_PackedNumbers )
+		return const_iterator( this, m_Length );
+	return m_Value.Children + m_Length;
+}
+
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -208,17 +775,98 @@ public:
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 
+/// A document owns the storage of all its nodes, child arrays and copied strings.
+/// Reset() and ParseInto() recycle that storage without releasing it, so a document
+/// reused for messages of similar shapes stops allocating after the first few parses.
 class JsonDocument : public JsonNode, public JsonTokenizer::TokenProcessor
 {
-	enum { MaxKeyName = 255 };
+	friend class JsonNode;
+	friend class JsonDocumentRef;
+	friend class JsonElementReader;
+
+	enum
+	{
+		NodeBlockSize = 256,		// nodes are allocated by blocks of that many
+		StringBlockSize = 4096,		// minimum size of the blocks storing copied strings and names
+	};
+
+	struct NodeBlock
+	{
+		JsonNode * pNodes;
+		size_t Size;
+	};
+
+	struct StringBlock
+	{
+		char * pData;
+		size_t Size;
+	};
 
 protected:
-	char m_pTempName[ MaxKeyName + 1 ];
+	std::vector<NodeBlock> m_NodeBlocks;
+	size_t m_CurrNodeBlock;
+	size_t m_CurrNodeOffset;
+	std::vector<StringBlock> m_StringBlocks;
+	size_t m_CurrStringBlock;
+	size_t m_CurrStringOffset;
+	std::vector<JsonNode **> m_FreeChildren;	// outgrown child arrays by capacity class, linked through their first slot
+
+	volatile long m_RefCount;
+	bool m_bFrozen;
+
+	JsonParseMode m_Mode;
+	JsonNode * m_pParseRoot;		// the node the root of the input is parsed into: the document, or a container parsed again
 	JsonNode * m_pCurrPair;
 	JsonNode * m_pCurrObject;
-	char * m_pName;
+	const char * m_pCurrName;
+	size_t m_CurrNameLength;
 	bool m_bUseNextStringAsKey;
 
+	// with a duplicate key policy, one hash set is reused for all objects. The parser checks
+	// an object in one pass when it closes; the builders keep the set of the last object
+	// they added to, and rebuild it when they move on to another one.
+	JsonKeySet * m_pKeySet;
+	const JsonNode * m_pKeySetOwner;
+	size_t m_NbKeySetChildren;
+
+	// well formed input the document can't take: duplicate keys, names too long, limits exceeded
+	bool m_bRejected;
+	JsonParseError m_Error;		// the first one of the last parse
+
+	// with Option_LearnShape, the keys of the last parse in creation order. A parse that strays from
+	// it has its own shape recorded as it ends, while borrowed names still point to a live input.
+	JsonShape * m_pShape;
+
+	// parse limits, (size_t) -1 when unlimited. The depth is checked by the tokenizer.
+	size_t m_MaxBytes;
+	size_t m_MaxNodes;
+	size_t m_MaxStringLength;
+	size_t m_MaxKeyLength;
+	size_t m_MaxMemory;
+	size_t m_NbNodes;			// allocated since the last Reset
+	size_t m_NbPackedNumbers;	// count as nodes for the limits, and tell Freeze whether to unpack
+	size_t m_NbStorageBytes;
+
+protected:
+	JsonNode * AllocateNode();
+	JsonNode ** AllocateChildren( size_t _Capacity );
+	void ReleaseChildren( JsonNode ** _ppChildren );
+	char * AllocateStorage( size_t _Size, size_t _Alignment );
+	char * AllocateString( const char * _pBegin, size_t _Len );
+	JsonNode * AddParsedNode( JsonNodeType _Type, const char * _pParam1 );
+	void Reject( const char * _pLocation, JsonParseErrorCode _Code, const char * _pMessage );
+	void RejectOverLimits( const char * _pLocation );
+	void SetError( const char * _pLocation, JsonParseErrorCode _Code, JsonValidateError _Syntax, const char * _pMessage );
+	bool IsOverLimits() const;
+	void EndParse();
+	JsonKeySet & GetKeySet();
+	bool ApplyKeyPolicy( JsonNode & _Object );
+	JsonNode * CreateKeyedNode( JsonNode & _Object, const char * _pName, size_t _NameLength, bool _bBorrowName, JsonNodeType _Type );
+	void AdoptStorage( JsonDocument & _Source );
+	// tokenizes the object or array at _pBegin into _Container, which keeps its address, name and
+	// place. Its previous descendants are dropped: they stay in the storage until the next Reset.
+	JsonTokenizer::ParseResult ParseContainer( JsonNode & _Container, const char * _pBegin, const char ** _ppEnd, size_t * _pNbDroppedNodes );
+
 protected:
 	virtual void OnBeginObject( const char * _pParam1 );
 	virtual void OnEndObject( const char * _pParam1 );
@@ -233,16 +881,1161 @@ protected:
 	virtual void OnTrue( const char * _pParam1, const char * _pParam2 );
 	virtual void OnFalse( const char * _pParam1, const char * _pParam2 );
 	virtual void OnError( const char * _pParam1, const char * _pParam2, const char * _pParam3 );
+	virtual void OnSyntaxError( const char * _pParam1, const char * _pParam2, const char * _pParam3, JsonValidateError _Error );
+
+public:
+	virtual ~JsonDocument();
+
+	static JsonDocument * Create( JsonParseMode _Mode = JsonParseMode_Copy, JsonNodeType _RootType = JsonNodeType_Object );
+	/// The root of a parsed document can be an object or an array. On failure NULL is returned,
+	/// and the error is stored in _pError when given. Nothing is ever printed.
+	static JsonDocument * Parse( const char * _pBuffer, JsonParseMode _Mode = JsonParseMode_Copy, unsigned int _Options = 0, JsonParseError * _pError = NULL );
+	static JsonDocument * Parse( const char * _pBuffer, const JsonParseLimits & _Limits, JsonParseMode _Mode = JsonParseMode_Copy, unsigned int _Options = 0, JsonParseError * _pError = NULL );
+	/// Parses with the limits set on _Doc. The error is kept by the document, see GetError.
+	static bool ParseInto( JsonDocument & _Doc, const char * _pBuffer );
+	/// Streamed parsing, see JsonReadStream. Strings are always copied.
+	static JsonDocument * ParseStream( JsonInputStream & _Stream, unsigned int _Options = 0, JsonParseError * _pError = NULL );
+	static JsonDocument * ParseStream( JsonInputStream & _Stream, const JsonParseLimits & _Limits, unsigned int _Options = 0, JsonParseError * _pError = NULL );
+	/// The file is read ahead on a separate thread when threads are available
+	static JsonDocument * ParseFile( const char * _pPath, unsigned int _Options = 0, JsonParseError * _pError = NULL );
+
+	JsonParseMode GetMode() const;
+	/// The first error of the last parse into this document, Code is None after a success
+	const JsonParseError & GetError() const;
+	void Reset();
+
+	/// Limits applied by the following parses into this document; they survive Reset
+	void SetLimits( const JsonParseLimits & _Limits );
+
+	/// With Option_LearnShape, whether the last parse had exactly the keys of the one before.
+	/// Matching keys are compared with one memcmp and borrowed from the learned shape instead
+	/// of being copied, and containers get their previous child count reserved upfront. Only the
+	/// first 65536 nodes of a larger tree are predicted, and such a tree never counts as matched.
+	bool HasMatchedShape() const;
+
+	/// Makes sure the next _NbNodes nodes and _NbStorageBytes bytes of strings and child arrays 
+	/// fit in one block each
+	void Reserve( size_t _NbNodes, size_t _NbStorageBytes );
+
+	/// A frozen document can't be modified anymore and can be read from any number of threads.
+	/// Packed arrays are unpacked first, so that readers get lasting nodes rather than views.
+	void Freeze();
+	bool IsFrozen() const;
+
+	/// Applies an RFC 6902 JSON Patch (an array of operations, see JsonDiff) in place.
+	/// Stops at the first operation that fails and returns false; earlier ones stay applied.
+	bool ApplyPatch( const JsonNode & _Patch );
+
+protected:
+	JsonNode * FindPointer( const char * _pPointer, size_t _Len, JsonNode ** _ppParent, const char ** _ppLastToken, size_t * _pLastTokenLength );
+	bool AddAtPointer( const char * _pPointer, size_t _Len, const JsonNode & _Value );
+	bool RemoveAtPointer( const char * _pPointer, size_t _Len, JsonNode ** _ppRemoved );
+
+protected:
+	JsonDocument( JsonParseMode _Mode );
+};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/// Computes the RFC 6902 JSON Patch turning _From into _To, returned as a document whose root 
+/// is the array of operations. Object keys are matched through hash tables and subtrees with 
+/// identical structural hashes are skipped, so the cost stays close to linear in the input size.
+/// Arrays are compared after trimming their common head and tail, not with a full LCS.
+JsonDocument * JsonDiff( const JsonNode & _From, const JsonNode & _To );
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/// Reference counted handle on a frozen document. Handles can be copied and released
+/// from any thread; the document is deleted with the last handle.
+class JsonDocumentRef
+{
+protected:
+	JsonDocument * m_pDoc;
+
+public:
+	JsonDocumentRef();
+	explicit JsonDocumentRef( JsonDocument * _pDoc );	// takes ownership of _pDoc and freezes it
+	JsonDocumentRef( const JsonDocumentRef & _Other );
+	~JsonDocumentRef();
+
+	JsonDocumentRef & operator = ( const JsonDocumentRef & _Other );
+
+	bool IsValid() const									{ return m_pDoc != NULL; }
+	const JsonDocument * Get() const						{ return m_pDoc; }
+	const JsonDocument * operator -> () const				{ return m_pDoc; }
+	const JsonDocument & operator * () const				{ return *m_pDoc; }
+
+	void Release();
+};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/// 64 bit hash of raw input bytes (xxHash64 with a 0 seed), processing 32 bytes per round
+unsigned long long JsonHashContent( const char * _pBuffer, size_t _Len );
+
+/// Bounded cache of frozen documents, looked up by the content hash and length of their input, 
+/// so byte identical inputs are parsed once. Each entry keeps a copy of its input, compared on 
+/// a hit so that colliding inputs are never confused. The least recently used entry is dropped 
+/// when full. Parsing happens outside the lock; safe to share between threads. Inputs that 
+/// fail to parse are not cached.
+class JsonParseCache
+{
+protected:
+	typedef std::pair<unsigned long long, size_t> Key;
+
+	struct Entry
+	{
+		Key HashKey;
+		std::string Input;
+		JsonDocumentRef Doc;
+	};
+
+	typedef std::list<Entry> EntryList;
+
+	EntryList m_Entries;							// the most recently used first
+	std::multimap<Key, EntryList::iterator> m_Index;
+	size_t m_MaxEntries;
+	unsigned int m_Options;
+	JsonParseLimits m_Limits;
+	size_t m_NbHits;
+	size_t m_NbMisses;
+
+#if MINJA_THREADS
+	mutable std::mutex m_Mutex;
+#endif
+
+public:
+	explicit JsonParseCache( size_t _MaxEntries = 1024, unsigned int _Options = 0, const JsonParseLimits & _Limits = JsonParseLimits() );
+
+	/// Returns the document parsed from the null terminated _pBuffer, invalid on a parse error
+	JsonDocumentRef Parse( const char * _pBuffer );
+	JsonDocumentRef Parse( const char * _pBuffer, size_t _Len );	// _pBuffer[_Len] must be 0
+
+	void Clear();
+	size_t GetNbEntries() const;
+	size_t GetNbHits() const;
+	size_t GetNbMisses() const;
+
+protected:
+	EntryList::iterator Find( const Key & _Key, const char * _pBuffer, size_t _Len );
+
+private:
+	JsonParseCache( const JsonParseCache & );
+	JsonParseCache & operator = ( const JsonParseCache & );
+};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/// Walks a huge array one element at a time, straight from a stream. Each element is built 
+/// into a document recycled for the next one, so memory is bounded by the largest element 
+/// rather than by the input. The array is the root, or is addressed by a JSON pointer made of
+/// object keys; the siblings on the way are skipped without being kept, and the input after 
+/// the array is not read. In borrowed mode, strings are views into the read buffer.
+class JsonElementReader
+{
+protected:
+	JsonStreamFramer * m_pFramer;
+	std::vector<std::string> m_Path;
+	JsonDocument * m_pDoc;
+	size_t m_NbElements;
+	bool m_bStarted;
+	bool m_bDone;
+	bool m_bFailed;
 
 public:
-	static JsonDocument * Create();
-	static JsonDocument * Parse( const char * _pBuffer );
+	JsonElementReader( JsonInputStream & _Stream, const char * _pArrayPath = "", JsonParseMode _Mode = JsonParseMode_Copy, unsigned int _Options = 0 );
+	~JsonElementReader();
+
+	/// Returns the next element, or NULL at the end of the array or on error. The element
+	/// and all its descendants are only valid until the next call.
+	JsonNode * Next();
+	/// Set when Next failed, with offsets from the start of the stream
+	const JsonParseError & GetError() const;
+
+	bool HasFailed() const					{ return m_bFailed; }
+	size_t GetNbElements() const			{ return m_NbElements; }
+
+protected:
+	bool Start();
 
 private:
-	JsonDocument();
+	JsonElementReader( const JsonElementReader & );
+	JsonElementReader & operator = ( const JsonElementReader & );
 };
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/// Keeps a document in sync with a text being edited, as in an editor. An edit replaces a
+/// byte range of the text, and only the innermost object or array around it is tokenized 
+/// again: its new children replace the old ones, and the offsets of what follows are shifted. 
+/// Nodes outside of that container, the container included, keep their addresses.
+/// The whole text is parsed again when the edit touches the brackets of the root, when the
+/// container doesn't parse back into itself (unbalanced brackets, errors), or once dropped 
+/// nodes outnumber live ones, so that the storage stays bounded.
+/// Offsets are kept per container in a flat table: shifting them is a pass over memory, far
+/// cheaper than tokenizing. Strings are always copied, as the text moves as it's edited.
+class JsonIncrementalParser
+{
+	friend class JsonSpanDocument;
+
+protected:
+	struct Span
+	{
+		JsonNode * pNode;
+		size_t Begin;		// offset of the opening bracket
+		size_t End;			// offset of the closing bracket
+		size_t Parent;		// index of the enclosing span, NoSpan for the root
+	};
+
+	static const size_t NoSpan = (size_t) -1;
+
+	std::string m_Text;
+	JsonSpanDocument * m_pDoc;
+	std::vector<Span> m_Spans;			// every container of the document, in the order of their opening bracket
+	size_t m_MaxBytes;
+	size_t m_NbDroppedNodes;
+	size_t m_LastParsedLength;
+	bool m_bValid;
+
+public:
+	explicit JsonIncrementalParser( unsigned int _Options = 0, const JsonParseLimits & _Limits = JsonParseLimits() );
+	~JsonIncrementalParser();
+
+	/// Replaces the whole text, and parses it
+	bool SetText( const char * _pText, size_t _Len );
+	/// Replaces _Length bytes of the text at _Offset by _pText. Returns whether the new text parses.
+	bool Edit( size_t _Offset, size_t _Length, const char * _pText, size_t _TextLength );
+
+	const std::string & GetText() const			{ return m_Text; }
+	/// NULL while the text doesn't parse. Nodes are only valid until the next edit touching them.
+	const JsonDocument * GetDocument() const;
+	const JsonParseError & GetError() const;
+	/// Bytes tokenized by the last SetText or Edit
+	size_t GetLastParsedLength() const			{ return m_LastParsedLength; }
+	/// Offsets of the brackets of an object or array of the document, in O(number of containers)
+	bool GetSpan( const JsonNode * _pContainer, size_t * _pBegin, size_t * _pEnd ) const;
+
+protected:
+	bool ParseAll();
+	bool ParseSpan( size_t _Span, size_t _NewEnd );
+	size_t FindSpan( size_t _Offset, size_t _Length ) const;
+
+private:
+	JsonIncrementalParser( const JsonIncrementalParser & );
+	JsonIncrementalParser & operator = ( const JsonIncrementalParser & );
+};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/// Compact text of a value: names and strings between double quotes, numbers with 9 significant 
+/// digits, or null when not finite. Strings are written as they are stored, parsed strings 
+/// keeping their escape sequences: a backslash opening a valid sequence is kept, while double 
+/// quotes, any other backslash and control characters are escaped. Packed arrays are read in 
+/// place, the tree is not modified.
+void JsonWriteNode( const JsonNode & _Node, std::string & _Out );
+
+/// Writes large trees on several threads, into the same text as JsonWriteNode. The tree is cut
+/// into parts, in order: a container with many children is cut into runs of children, while the 
+/// children of the others are measured (up to _MinPartSize) to find the big ones, which are cut
+/// in turn. Each part is measured and written into its own buffer by a worker. The buffers are 
+/// then copied into one string, or handed out as they are, for one writev.
+class JsonParallelWriter
+{
+public:
+	/// Same members as struct iovec
+	struct Chunk
+	{
+		const char * pData;
+		size_t Length;
+	};
+
+protected:
+	struct Part
+	{
+		const JsonNode * pNode;		// NULL for text between the runs: brackets, commas and names
+		size_t First;				// the run of children of pNode
+		size_t Last;
+		std::string Text;
+	};
+
+	size_t m_NbThreads;
+	size_t m_MinPartSize;
+	std::vector<Part> m_Parts;
+	std::vector<Chunk> m_Chunks;
+
+public:
+	explicit JsonParallelWriter( size_t _NbThreads, size_t _MinPartSize = 64 * 1024 );
+
+	void Write( const JsonNode & _Node, std::string & _Out );
+	/// The chunks point into the writer: they are valid until the next Write
+	const std::vector<Chunk> & WriteChunks( const JsonNode & _Node );
+	size_t GetNbParts() const					{ return m_Parts.size(); }
+
+protected:
+	void Plan( const JsonNode & _Node );
+	void PlanContainer( const JsonNode & _Container, const std::string & _Prefix );
+	void AddText( const std::string & _Text );
+	void AddRun( const JsonNode & _Container, size_t _First, size_t _Last );
+	static void WriteParts( Part * _pParts, size_t _NbParts, volatile long * _pNextPart );
+
+private:
+	JsonParallelWriter( const JsonParallelWriter & );
+	JsonParallelWriter & operator = ( const JsonParallelWriter & );
+};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/// Binds JSON objects straight to C++ structs, without building any JsonNode.
+/// Fields are declared once per struct, at global scope:
+///
+///		MINJA_BIND_BEGIN( Player )
+///			MINJA_BIND_FIELD( name )
+///			MINJA_BIND_FIELD( level )
+///			MINJA_BIND_FIELD( stats )		// a struct with its own binding
+///		MINJA_BIND_END()
+///
+/// then JsonRead( player, buffer ) fills the struct and JsonWrite( player, out ) serializes it.
+/// Supported members are bool, int, float, double, std::string and bound structs. Unknown keys
+/// are skipped, null values leave the member untouched, and strings keep their escape sequences
+/// verbatim like in JsonNode. JsonWrite escapes strings and writes numbers like JsonWriteNode.
+enum JsonFieldType
+{
+	JsonFieldType_Bool,
+	JsonFieldType_Int,
+	JsonFieldType_Float,
+	JsonFieldType_Double,
+	JsonFieldType_String,
+	JsonFieldType_Object
+};
+
+class JsonStructBinding;
+
+struct JsonFieldDesc
+{
+	const char * pName;
+	size_t NameLength;
+	JsonFieldType Type;
+	size_t Offset;
+	const JsonStructBinding & (*pGetNested)();
+};
+
+/// Field table of a struct, with a perfect hash on the key names computed on first use:
+/// looking up a key costs one hash and one memcmp.
+class JsonStructBinding
+{
+protected:
+	const JsonFieldDesc * m_pFields;
+	size_t m_NbFields;
+	unsigned int m_Seed;
+	size_t m_Mask;
+	std::vector<unsigned short> m_Slots;	// field index + 1, 0 for empty slots
+
+public:
+	JsonStructBinding( const JsonFieldDesc * _pFields, size_t _NbFields );
+
+	size_t GetNbFields() const								{ return m_NbFields; }
+	const JsonFieldDesc & GetField( size_t _Index ) const	{ return m_pFields[_Index]; }
+	const JsonFieldDesc * FindField( const char * _pName, size_t _NameLength ) const;
+
+protected:
+	static unsigned int HashName( const char * _pName, size_t _NameLength, unsigned int _Seed );
+	bool TrySeed( unsigned int _Seed );
+};
+
+template<class T> struct JsonBinding;
+
+template<class S> JsonFieldType JsonFieldTypeOf( bool S::* )			{ return JsonFieldType_Bool; }
+template<class S> JsonFieldType JsonFieldTypeOf( int S::* )				{ return JsonFieldType_Int; }
+template<class S> JsonFieldType JsonFieldTypeOf( float S::* )			{ return JsonFieldType_Float; }
+template<class S> JsonFieldType JsonFieldTypeOf( double S::* )			{ return JsonFieldType_Double; }
+template<class S> JsonFieldType JsonFieldTypeOf( std::string S::* )		{ return JsonFieldType_String; }
+template<class S, class M> JsonFieldType JsonFieldTypeOf( M S::* )		{ return JsonFieldType_Object; }
+
+typedef const JsonStructBinding & (*JsonGetBindingFunc)();
+
+template<class S> JsonGetBindingFunc JsonNestedBindingOf( bool S::* )			{ return NULL; }
+template<class S> JsonGetBindingFunc JsonNestedBindingOf( int S::* )			{ return NULL; }
+template<class S> JsonGetBindingFunc JsonNestedBindingOf( float S::* )			{ return NULL; }
+template<class S> JsonGetBindingFunc JsonNestedBindingOf( double S::* )			{ return NULL; }
+template<class S> JsonGetBindingFunc JsonNestedBindingOf( std::string S::* )	{ return NULL; }
+template<class S, class M> JsonGetBindingFunc JsonNestedBindingOf( M S::* )		{ return &JsonBinding<M>::Get; }
+
+#define MINJA_BIND_BEGIN( _Struct )																	\
+	template<> struct JsonBinding<_Struct>															\
+	{																								\
+		typedef _Struct Type;																		\
+		static const JsonStructBinding & Get()														\
+		{																							\
+			static const JsonFieldDesc s_Fields [] =												\
+			{
+
+#define MINJA_BIND_FIELD( _Member )																	\
+				{ #_Member, sizeof(#_Member) - 1, JsonFieldTypeOf( &Type::_Member ), offsetof( Type, _Member ), JsonNestedBindingOf( &Type::_Member ) },
+
+#define MINJA_BIND_END()																			\
+			};																						\
+			static const JsonStructBinding s_Binding( s_Fields, sizeof(s_Fields) / sizeof(s_Fields[0]) );	\
+			return s_Binding;																		\
+		}																							\
+	};
+
+bool JsonReadStruct( const JsonStructBinding & _Binding, void * _pStruct, const char * _pBuffer, unsigned int _Options = 0 );
+void JsonWriteStruct( const JsonStructBinding & _Binding, const void * _pStruct, std::string & _Out );
+
+template<class T> bool JsonRead( T & _Struct, const char * _pBuffer, unsigned int _Options = 0 )
+{
+	return JsonReadStruct( JsonBinding<T>::Get(), &_Struct, _pBuffer, _Options );
+}
+
+template<class T> void JsonWrite( const T & _Struct, std::string & _Out )
+{
+	JsonWriteStruct( JsonBinding<T>::Get(), &_Struct, _Out );
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+enum JsonColumnType
+{
+	JsonColumnType_Double,
+	JsonColumnType_Int64,		// true / false are read as 1 / 0 in numeric columns. Fractions are truncated, out of range values are null
+	JsonColumnType_String,		// escape sequences are kept verbatim
+};
+
+/// One field of an array of objects, with all the rows in contiguous arrays. Missing values, 
+/// nulls and values of another type are null rows: their bit is clear in the validity bitmap
+/// and their value is 0 or the empty string.
+class JsonColumn
+{
+	friend class JsonColumnExtractor;
+
+protected:
+	std::string m_Name;
+	JsonColumnType m_Type;
+	std::vector<double> m_Doubles;
+	std::vector<long long> m_Int64s;
+	std::vector<size_t> m_StringOffsets;	// nb rows + 1, row i is [offset i, offset i+1)
+	std::vector<char> m_StringData;
+	std::vector<unsigned char> m_Validity;	// bit i for row i, set when valid
+	size_t m_NbRows;
+
+public:
+	JsonColumn( const char * _pName, JsonColumnType _Type );
+
+	const char * GetName() const					{ return m_Name.c_str(); }
+	JsonColumnType GetType() const					{ return m_Type; }
+	size_t GetNbRows() const						{ return m_NbRows; }
+	bool IsNull( size_t _Row ) const				{ return !(m_Validity[_Row >> 3] & (1 << (_Row & 7))); }
+
+	const double * GetDoubles() const				{ return m_Doubles.empty() ? NULL : &m_Doubles[0]; }
+	const long long * GetInt64s() const				{ return m_Int64s.empty() ? NULL : &m_Int64s[0]; }
+	const unsigned char * GetValidity() const		{ return m_Validity.empty() ? NULL : &m_Validity[0]; }
+	const size_t * GetStringOffsets() const			{ return &m_StringOffsets[0]; }
+	const char * GetStringData() const				{ return m_StringData.empty() ? "" : &m_StringData[0]; }
+	const char * GetString( size_t _Row, size_t & _Len ) const;
+
+protected:
+	void Clear();
+	void AddRow();
+	void SetValid();
+};
+
+/// Extracts columns out of an array of objects, straight from the tokenizer. The array is
+/// addressed by a JSON pointer made of object keys, "" for a root array. Only the declared
+/// fields are decoded; nested containers and other fields are skipped. 
+class JsonColumnExtractor : public JsonTokenizer::TokenProcessor
+{
+protected:
+	std::vector<std::string> m_Path;
+	std::vector<JsonColumn> m_Columns;
+	std::vector<JsonFieldDesc> m_Fields;
+	JsonStructBinding * m_pBinding;
+	size_t m_NbRows;
+
+	size_t m_Depth;
+	size_t m_OffPathDepth;				// depth of the container that left the path, 0 while on it
+	bool m_bUseNextStringAsKey;
+	bool m_bKeyOnPath;
+	JsonColumn * m_pCurrColumn;
+
+public:
+	explicit JsonColumnExtractor( const char * _pArrayPath );
+	~JsonColumnExtractor();
+
+	size_t AddColumn( const char * _pName, JsonColumnType _Type );
+
+	/// Columns are cleared first but keep their capacity, so an extractor can be reused
+	bool Extract( const char * _pBuffer );
+	bool Extract( JsonInputStream & _Stream );
+
+	size_t GetNbRows() const							{ return m_NbRows; }
+	size_t GetNbColumns() const							{ return m_Columns.size(); }
+	const JsonColumn & GetColumn( size_t _Index ) const	{ return m_Columns[_Index]; }
+	const JsonColumn * FindColumn( const char * _pName ) const;
+
+protected:
+	void Prepare();
+	void BeginContainer( bool _bObject );
+	void EndContainer();
+	void SetNumber( const char * _pBegin, const char * _pEnd, double _Value, bool _bIsBool );
+
+	virtual void OnBeginObject( const char * _pParam1 )						{ BeginContainer( true ); }
+	virtual void OnEndObject( const char * _pParam1 )						{ EndContainer(); }
+	virtual void OnBeginArray( const char * _pParam1 )						{ BeginContainer( false ); }
+	virtual void OnEndArray( const char * _pParam1 )						{ EndContainer(); }
+	virtual void OnBeginPair( const char * _pParam1 )						{ m_bUseNextStringAsKey = true; m_pCurrColumn = NULL; }
+	virtual void OnString( const char * _pParam1, const char * _pParam2 );
+	virtual void OnNumber( const char * _pParam1, const char * _pParam2 )	{ SetNumber( _pParam1, _pParam2, 0.0, false ); }
+	virtual void OnNull( const char * _pParam1, const char * _pParam2 )		{ m_pCurrColumn = NULL; }
+	virtual void OnTrue( const char * _pParam1, const char * _pParam2 )		{ SetNumber( NULL, NULL, 1.0, true ); }
+	virtual void OnFalse( const char * _pParam1, const char * _pParam2 )	{ SetNumber( NULL, NULL, 0.0, true ); }
+
+private:
+	JsonColumnExtractor( const JsonColumnExtractor & );
+	JsonColumnExtractor & operator = ( const JsonColumnExtractor & );
+};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/// Aggregates of the records sharing one value of the GroupBy field. Records without that 
+/// field share the "" group, which is also the only group of a query without GroupBy.
+/// Values[i] is the result of the i-th aggregate and NbValues[i] the number of records that
+/// contributed to it.
+struct JsonQueryGroup
+{
+	std::string Key;
+	size_t NbRecords;
+	std::vector<double> Values;
+	std::vector<size_t> NbValues;
+};
+
+class JsonQueryResult
+{
+	friend class JsonQuery;
+
+protected:
+	size_t m_NbRecords;
+	size_t m_NbMatches;
+	size_t m_NbErrors;
+	std::vector<JsonQueryGroup> m_Groups;		// sorted by key
+	std::vector<std::string> m_Rows;			// projections of the matching records, in input order
+
+public:
+	JsonQueryResult();
+
+	void Clear();
+
+	size_t GetNbRecords() const								{ return m_NbRecords; }
+	size_t GetNbMatches() const								{ return m_NbMatches; }
+	/// Lines that are not a valid object. They are skipped and count as records.
+	size_t GetNbErrors() const								{ return m_NbErrors; }
+
+	size_t GetNbGroups() const								{ return m_Groups.size(); }
+	const JsonQueryGroup & GetGroup( size_t _Index ) const	{ return m_Groups[_Index]; }
+	const JsonQueryGroup * FindGroup( const char * _pKey ) const;
+
+	size_t GetNbRows() const								{ return m_Rows.size(); }
+	const std::string & GetRow( size_t _Index ) const		{ return m_Rows[_Index]; }
+};
+
+/// Filters and aggregates NDJSON (one object per line) straight from the tokenizer, without
+/// any node. The query is compiled once into a perfect hash of the fields it refers to; the
+/// other fields and all nested containers are only skipped over, and a value is decoded only
+/// when a condition or an aggregate needs it. Fields are keys of the record objects.
+/// Lines are cut into blocks which are evaluated on up to _NbThreads threads.
+class JsonQuery
+{
+	friend class JsonQueryEvaluator;
+
+public:
+	enum Compare
+	{
+		Compare_Equal,
+		Compare_NotEqual,
+		Compare_Less,
+		Compare_LessEqual,
+		Compare_Greater,
+		Compare_GreaterEqual,
+	};
+
+	enum Function
+	{
+		Function_Count,				// counts the records, or those having the field when one is given
+		Function_Sum,
+		Function_Min,
+		Function_Max,
+	};
+
+protected:
+	struct Condition
+	{
+		size_t Field;
+		Compare Op;
+		bool bString;
+		double Number;
+		std::string String;
+	};
+
+	struct AggregateDesc
+	{
+		Function Func;
+		size_t Field;				// NoField for a plain count
+	};
+
+	static const size_t NoField = (size_t) -1;
+
+	std::vector<std::string> m_FieldNames;
+	std::vector<JsonFieldDesc> m_Fields;
+	JsonStructBinding * m_pBinding;
+	std::vector<Condition> m_Conditions;
+	std::vector<AggregateDesc> m_Aggregates;
+	std::vector<size_t> m_Selection;
+	size_t m_GroupField;
+
+public:
+	JsonQuery();
+	~JsonQuery();
+
+	/// All the conditions must hold for a record to match. A record without the field, or with
+	/// a value of another type, never matches. Strings are compared byte-wise, escapes included.
+	JsonQuery & Where( const char * _pField, Compare _Compare, double _Value );
+	JsonQuery & Where( const char * _pField, Compare _Compare, const char * _pValue );
+
+	JsonQuery & GroupBy( const char * _pField );
+	JsonQuery & Aggregate( Function _Function, const char * _pField = NULL );
+
+	/// Matching records are also kept as objects made of the selected fields only
+	JsonQuery & Select( const char * _pField );
+
+	/// _Result is cleared first. The buffer does not need to be null terminated.
+	void Run( const char * _pBuffer, size_t _Len, JsonQueryResult & _Result, size_t _NbThreads = 1 );
+
+	/// Reads the stream by batches of _NbThreads blocks of about _BlockSize bytes.
+	/// Returns false if the stream failed, _Result then holds what was read before.
+	bool Run( JsonInputStream & _Stream, JsonQueryResult & _Result, size_t _NbThreads = 1, size_t _BlockSize = 1 << 20 );
+
+protected:
+	size_t AddField( const char * _pName );
+	void Compile();
+	void RunBlocks( const char * _pBuffer, size_t _Len, size_t _BlockSize, size_t _NbThreads, JsonQueryResult & _Result );
+	void MergeGroup( JsonQueryGroup & _Dest, const JsonQueryGroup & _Src ) const;
+
+private:
+	JsonQuery( const JsonQuery & );
+	JsonQuery & operator = ( const JsonQuery & );
+};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#if MINJA_THREADS
+
+/// Parses independent buffers on a fixed set of worker threads.
+/// Each worker recycles its own documents (see JsonDocument::Reset), so in steady state
+/// parsing does not go through the shared heap at all. Jobs wait in a bounded queue:
+/// Submit() blocks while it is full, which throttles producers to the parsing throughput.
+/// Buffers must stay alive until their job completes.
+class JsonParserPool
+{
+public:
+	class Listener
+	{
+	public:
+		virtual ~Listener() {}
+
+		/// Called from a worker thread. _pDoc is NULL if the buffer failed to parse.
+		/// The document belongs to the caller, who hands it back with Release().
+		virtual void OnParsed( const char * _pBuffer, JsonDocument * _pDoc, void * _pUserData ) = 0;
+	};
+
+protected:
+	struct Job
+	{
+		const char * pBuffer;
+		Listener * pListener;
+		void * pUserData;
+	};
+
+	struct Worker
+	{
+		std::thread Thread;
+		std::mutex FreeDocsMutex;
+		std::vector<JsonDocument *> FreeDocs;
+	};
+
+	JsonParseMode m_Mode;
+	unsigned int m_Options;
+
+	std::vector<Worker *> m_Workers;
+	size_t m_NextReleaseWorker;
+
+	std::mutex m_QueueMutex;
+	std::condition_variable m_QueueNotEmpty;
+	std::condition_variable m_QueueNotFull;
+	std::condition_variable m_Idle;
+	std::vector<Job> m_Queue;
+	size_t m_QueueHead;
+	size_t m_NbQueuedJobs;
+	size_t m_NbActiveJobs;
+	bool m_bStopping;
+
+protected:
+	void WorkerLoop( Worker & _Worker );
+	JsonDocument * AcquireDocument( Worker & _Worker );
+	void PushJob( const Job & _Job );
+
+public:
+	JsonParserPool( size_t _NbThreads, size_t _MaxQueuedJobs, JsonParseMode _Mode = JsonParseMode_Copy, unsigned int _Options = 0 );
+	~JsonParserPool();
+
+	/// Queues a buffer for parsing. _Listener is notified from a worker thread.
+	void Submit( const char * _pBuffer, Listener & _Listener, void * _pUserData = NULL );
+	bool TrySubmit( const char * _pBuffer, Listener & _Listener, void * _pUserData = NULL );
+
+	/// Parses a batch and waits for it. _ppDocs[i] is the document of _ppBuffers[i], or NULL on error.
+	/// Must not be called from a Listener.
+	void ParseBatch( const char * const * _ppBuffers, size_t _NbBuffers, JsonDocument ** _ppDocs );
+
+	/// Waits until the queue is empty and no job is in progress.
+	void WaitIdle();
+
+	/// Hands a document obtained from the pool back for reuse.
+	void Release( JsonDocument * _pDoc );
+
+private:
+	JsonParserPool( const JsonParserPool & );
+	JsonParserPool & operator = ( const JsonParserPool & );
+};
+
+#endif //MINJA_THREADS
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#if MINJA_CONSTEXPR
+
+/// Read-only node of a JSON literal parsed at compile time, see MINJA_JSON_LITERAL. The accessors 
+/// are those of JsonNode, all constexpr. Nodes are laid out in document order in one array, each
+/// one followed by its descendants, so children are reached by skipping subtrees. As with 
+/// JsonParseMode_BorrowBuffer, strings and names are views into the literal, not null terminated.
+class JsonLiteralNode
+{
+	friend class JsonLiteralParser;
+
+protected:
+	const char * m_pName = nullptr;
+	size_t m_NameLength = 0;
+	const char * m_pString = nullptr;
+	size_t m_Length = 0;				// of the string, or number of children
+	size_t m_NbDescendants = 0;
+	float m_Number = 0.0f;
+	bool m_Bool = false;
+	bool m_bValid = true;
+	JsonNodeType m_Type = JsonNodeType_Unknown;
+
+	static const JsonLiteralNode s_InvalidNode;
+
+	constexpr explicit JsonLiteralNode( bool _bValid ) : m_bValid( _bValid ) {}
+
+public:
+	class const_iterator
+	{
+		const JsonLiteralNode * m_pNode;
+
+	public:
+		constexpr explicit const_iterator( const JsonLiteralNode * _pNode ) : m_pNode( _pNode ) {}
+
+		constexpr const JsonLiteralNode & operator * () const					{ return *m_pNode; }
+		constexpr const JsonLiteralNode * operator -> () const					{ return m_pNode; }
+		constexpr const_iterator & operator ++ ()								{ m_pNode += m_pNode->m_NbDescendants + 1; return *this; }
+		constexpr bool operator == ( const const_iterator & _Other ) const		{ return m_pNode == _Other.m_pNode; }
+		constexpr bool operator != ( const const_iterator & _Other ) const		{ return m_pNode != _Other.m_pNode; }
+	};
+
+	constexpr JsonLiteralNode() {}
+
+	constexpr JsonNodeType GetType() const				{ return m_Type; }
+	constexpr const char * GetName() const				{ return m_pName; }
+	constexpr size_t GetNameLength() const				{ return m_NameLength; }
+	constexpr bool IsValid() const						{ return m_bValid; }
+
+	constexpr bool GetBool() const						{ return m_bValid && m_Bool; }
+	constexpr float GetNumber() const					{ return m_bValid ? m_Number : 0.0f; }
+	constexpr const char * GetString() const			{ return m_bValid ? m_pString : "! invalid Json node"; }
+	constexpr size_t GetStringLength() const			{ return m_bValid ? m_Length : sizeof("! invalid Json node") - 1; }
+	constexpr size_t GetNbChildren() const				{ return (m_Type == JsonNodeType_Object || m_Type == JsonNodeType_Array) ? m_Length : 0; }
+
+	constexpr const_iterator begin() const				{ return const_iterator( this + 1 ); }
+	constexpr const_iterator end() const				{ return const_iterator( this + 1 + m_NbDescendants ); }
+
+	constexpr const JsonLiteralNode * GetChild( size_t _Index ) const
+	{
+		ASSERT( _Index < GetNbChildren(), "Index out of bounds" );
+
+		const JsonLiteralNode * pChild = this + 1;
+		for( ; _Index > 0; --_Index )
+			pChild += pChild->m_NbDescendants + 1;
+
+		return pChild;
+	}
+
+	constexpr const JsonLiteralNode * GetChild( const char * _pName, size_t _NameLength ) const
+	{
+		size_t offset = FindChild( _pName, _NameLength );
+		return offset ? this + offset : nullptr;
+	}
+
+	constexpr const JsonLiteralNode * GetChild( const char * _pName ) const
+	{
+		return GetChild( _pName, NameLength( _pName ) );
+	}
+
+	constexpr const JsonLiteralNode & operator [] ( size_t _Index ) const
+	{
+		if( !m_bValid )
+			return *this;
+
+		return _Index < GetNbChildren() ? *GetChild( _Index ) : s_InvalidNode;
+	}
+
+	constexpr const JsonLiteralNode & operator [] ( const char * _pName ) const
+	{
+		if( !m_bValid || m_Type != JsonNodeType_Object )
+			return m_bValid ? s_InvalidNode : *this;
+
+		size_t offset = FindChild( _pName, NameLength( _pName ) );
+		return offset ? this[offset] : s_InvalidNode;
+	}
+
+protected:
+	static constexpr size_t NameLength( const char * _pName )
+	{
+		size_t len = 0;
+		while( _pName[len] != 0 )
+			++len;
+
+		return len;
+	}
+
+	// offset of the child from this node, 0 when not found. Null pointers are avoided
+	// because gcc cannot compare them in a constant expression with -fsanitize=undefined
+	constexpr size_t FindChild( const char * _pName, size_t _NameLength ) const
+	{
+		ASSERT( m_Type == JsonNodeType_Object, "Wrong node type. Not an Object" );
+
+		for( size_t offset = 1; offset <= m_NbDescendants; offset += this[offset].m_NbDescendants + 1 )
+		{
+			const JsonLiteralNode & child = this[offset];
+			if( child.m_NameLength != _NameLength )
+				continue;
+
+			size_t c = 0;
+			while( c < _NameLength && child.m_pName[c] == _pName[c] )
+				++c;
+			if( c == _NameLength )
+				return offset;
+		}
+
+		return 0;
+	}
+};
+
+inline constexpr JsonLiteralNode JsonLiteralNode::s_InvalidNode( false );
+
+/// Same grammar as JsonValidate. Used in a constant expression, an error stops the compilation
+/// on a call to the non constexpr ReportError, with the error code in the diagnostic.
+class JsonLiteralParser
+{
+protected:
+	const char * m_pCurr;
+	JsonLiteralNode * m_pNodes;		// nullptr when only counting
+	bool m_bCounting;				// rather than a null test on m_pNodes, see FindChild
+	size_t m_NbNodes;
+
+public:
+	constexpr JsonLiteralParser( const char * _pText, JsonLiteralNode * _pNodes ) : m_pCurr( _pText ), m_pNodes( _pNodes ), m_bCounting( false ), m_NbNodes( 0 ) {}
+	constexpr explicit JsonLiteralParser( const char * _pText ) : m_pCurr( _pText ), m_pNodes( nullptr ), m_bCounting( true ), m_NbNodes( 0 ) {}
+
+	static constexpr size_t CountNodes( const char * _pText )
+	{
+		JsonLiteralParser parser( _pText );
+		parser.ParseRoot();
+		return parser.m_NbNodes;
+	}
+
+	constexpr bool ParseRoot()
+	{
+		SkipWhitespaces();
+		if( *m_pCurr != '{' && *m_pCurr != '[' )
+			return Fail( JsonValidateError_BadRoot );
+
+		if( !ParseValue( nullptr, 0 ) )
+			return false;
+
+		SkipWhitespaces();
+		return *m_pCurr == 0 || Fail( JsonValidateError_TrailingCharacters );
+	}
+
+	static void ReportError( JsonValidateError ) {}
+
+protected:
+	constexpr bool Fail( JsonValidateError _Error )
+	{
+		if( _Error != JsonValidateError_None )
+			ReportError( _Error );
+
+		// outside of a constant expression, the document is left invalid
+		if( !m_bCounting )
+			m_pNodes[0].m_bValid = false;
+		return false;
+	}
+
+	constexpr void SkipWhitespaces()
+	{
+		while( *m_pCurr == ' ' || *m_pCurr == '\t' || *m_pCurr == '\n' )
+			++m_pCurr;
+	}
+
+	static constexpr bool IsDigit( char _Char )		{ return _Char >= '0' && _Char <= '9'; }
+	static constexpr char ToLower( char _Char )		{ return (_Char >= 'A' && _Char <= 'Z') ? char( _Char - 'A' + 'a' ) : _Char; }
+
+	// keywords are matched in any case, as by the tokenizer
+	constexpr bool ReadKeyword( const char * _pKeyword )
+	{
+		size_t c = 0;
+		for( ; _pKeyword[c] != 0; ++c )
+		{
+			if( ToLower( m_pCurr[c] ) != _pKeyword[c] )
+				return false;
+		}
+
+		m_pCurr += c;
+		return true;
+	}
+
+	constexpr bool ReadString( const char ** _ppBegin, size_t * _pLen )
+	{
+		const char * pBegin = ++m_pCurr;
+		while( *m_pCurr != '"' && *m_pCurr != '\'' )
+		{
+			if( *m_pCurr == 0 )
+				return Fail( JsonValidateError_UnterminatedString );
+
+			// escape sequences are kept verbatim, only checked
+			if( *m_pCurr == '\\' )
+			{
+				char escaped = *++m_pCurr;
+				if( escaped != '"' && escaped != '\\' && escaped != '/' && escaped != 'b' && escaped != 'f' && escaped != 'n' && escaped != 'r' && escaped != 't' && escaped != 'u' )
+					return Fail( JsonValidateError_BadEscape );
+			}
+			++m_pCurr;
+		}
+
+		*_ppBegin = pBegin;
+		*_pLen = size_t( m_pCurr - pBegin );
+		++m_pCurr;
+		return true;
+	}
+
+	constexpr bool ReadNumber( float * _pNumber )
+	{
+		bool bNegative = (*m_pCurr == '-');
+		if( *m_pCurr == '-' || *m_pCurr == '+' )
+			++m_pCurr;
+
+		if( !IsDigit( *m_pCurr ) )
+			return Fail( JsonValidateError_BadNumber );
+
+		double value = 0.0;
+		while( IsDigit( *m_pCurr ) )
+			value = value * 10.0 + (*m_pCurr++ - '0');
+
+		int exponent = 0;
+		if( *m_pCurr == '.' )
+		{
+			if( !IsDigit( *++m_pCurr ) )
+				return Fail( JsonValidateError_BadNumber );
+
+			for( ; IsDigit( *m_pCurr ); --exponent )
+				value = value * 10.0 + (*m_pCurr++ - '0');
+		}
+
+		if( *m_pCurr == 'e' || *m_pCurr == 'E' )
+		{
+			bool bNegativeExponent = (*++m_pCurr == '-');
+			if( *m_pCurr == '-' || *m_pCurr == '+' )
+				++m_pCurr;
+
+			if( !IsDigit( *m_pCurr ) )
+				return Fail( JsonValidateError_BadNumber );
+
+			// clamped, floats saturate long before
+			int written = 0;
+			for( ; IsDigit( *m_pCurr ); ++m_pCurr )
+			{
+				if( written < 10000 )
+					written = written * 10 + (*m_pCurr - '0');
+			}
+			exponent += bNegativeExponent ? -written : written;
+		}
+
+		// dividing by exact powers of ten rounds better than multiplying by inexact ones
+		for( ; exponent > 0; --exponent )
+			value *= 10.0;
+		for( ; exponent < 0; ++exponent )
+			value /= 10.0;
+
+		*_pNumber = float( bNegative ? -value : value );
+		return true;
+	}
+
+	constexpr bool ParseValue( const char * _pName, size_t _NameLength )
+	{
+		size_t index = m_NbNodes++;
+		JsonLiteralNode node;
+		node.m_pName = _pName;
+		node.m_NameLength = _NameLength;
+
+		char first = *m_pCurr;
+		if( first == '"' || first == '\'' )
+		{
+			node.m_Type = JsonNodeType_String;
+			if( !ReadString( &node.m_pString, &node.m_Length ) )
+				return false;
+		}
+		else if( first == '{' || first == '[' )
+		{
+			node.m_Type = (first == '{') ? JsonNodeType_Object : JsonNodeType_Array;
+			if( !ParseChildren( first == '{', &node.m_Length ) )
+				return false;
+		}
+		else if( IsDigit( first ) || first == '-' || first == '+' )
+		{
+			node.m_Type = JsonNodeType_Number;
+			if( !ReadNumber( &node.m_Number ) )
+				return false;
+		}
+		else if( ReadKeyword( "null" ) )
+		{
+			node.m_Type = JsonNodeType_Null;
+		}
+		else if( ReadKeyword( "true" ) || ReadKeyword( "false" ) )
+		{
+			node.m_Type = JsonNodeType_Bool;
+			node.m_Bool = (ToLower( first ) == 't');
+		}
+		else
+		{
+			return Fail( JsonValidateError_ExpectedValue );
+		}
+
+		node.m_NbDescendants = m_NbNodes - index - 1;
+		if( !m_bCounting )
+			m_pNodes[index] = node;
+		return true;
+	}
+
+	// a trailing comma is accepted, as by the tokenizer
+	constexpr bool ParseChildren( bool _bObject, size_t * _pNbChildren )
+	{
+		char closing = _bObject ? '}' : ']';
+		++m_pCurr;
+
+		for( ;; )
+		{
+			SkipWhitespaces();
+			if( *m_pCurr == closing )
+				break;
+
+			const char * pName = nullptr;
+			size_t nameLength = 0;
+			if( _bObject )
+			{
+				if( *m_pCurr != '"' && *m_pCurr != '\'' )
+					return Fail( JsonValidateError_ExpectedKey );
+				if( !ReadString( &pName, &nameLength ) )
+					return false;
+
+				SkipWhitespaces();
+				if( *m_pCurr++ != ':' )
+					return Fail( JsonValidateError_ExpectedColon );
+				SkipWhitespaces();
+			}
+
+			if( !ParseValue( pName, nameLength ) )
+				return false;
+			++*_pNbChildren;
+
+			SkipWhitespaces();
+			if( *m_pCurr == ',' )
+				++m_pCurr;
+			else if( *m_pCurr != closing )
+				return Fail( _bObject ? JsonValidateError_ExpectedObjectEnd : JsonValidateError_ExpectedArrayEnd );
+		}
+
+		++m_pCurr;
+		return true;
+	}
+};
+
+/// The node table of a literal, built by its constexpr constructor. Use it through MINJA_JSON_LITERAL.
+template< size_t NbNodes >
+class JsonLiteralDocument
+{
+protected:
+	JsonLiteralNode m_Nodes[NbNodes];
+
+public:
+	constexpr explicit JsonLiteralDocument( const char * _pText ) : m_Nodes()
+	{
+		JsonLiteralParser parser( _pText, m_Nodes );
+		parser.ParseRoot();
+	}
+
+	constexpr const JsonLiteralNode & GetRoot() const									{ return m_Nodes[0]; }
+	constexpr size_t GetNbNodes() const													{ return NbNodes; }
+
+	constexpr const JsonLiteralNode & operator [] ( size_t _Index ) const				{ return m_Nodes[0][_Index]; }
+	constexpr const JsonLiteralNode & operator [] ( const char * _pName ) const		{ return m_Nodes[0][_pName]; }
+};
+
+/// Parses a JSON string literal at compile time, into a read-only node table with no startup cost:
+///		static constexpr auto s_Defaults = MINJA_JSON_LITERAL( "{ 'retries': 3 }" );
+#define MINJA_JSON_LITERAL( _Text )		JsonLiteralDocument< JsonLiteralParser::CountNodes( _Text ) >( _Text )
+
+#endif //MINJA_CONSTEXPR
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------